@@ -0,0 +1,150 @@
+#include "allocationcounter.h"
+#include <QDebug>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef POINTCLOUD_COUNT_ALLOCATIONS
+
+// Plain pointer, constant-initialized: reading it from malloc needs no
+// allocation of its own, even on a thread that is just starting.
+static thread_local std::atomic<quint64> *allocationSink = nullptr;
+
+static inline void countAllocation()
+{
+    if (std::atomic<quint64> *sink = allocationSink) {
+        sink->fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+#if defined(__GLIBC__)
+
+// Interposes the C allocator, which operator new and QArrayData both end in.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(pointer, size);
+}
+}
+
+#else
+
+// Elsewhere only C++ allocations can be replaced portably; Qt containers
+// allocate with malloc and go uncounted.
+void *operator new(std::size_t size)
+{
+    countAllocation();
+    if (void *pointer = std::malloc(size ? size : 1)) {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    countAllocation();
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+#endif
+
+bool AllocationCounter::isEnabled()
+{
+    return true;
+}
+
+std::atomic<quint64> *AllocationCounter::sink()
+{
+    return allocationSink;
+}
+
+void AllocationCounter::setSink(std::atomic<quint64> *sink)
+{
+    allocationSink = sink;
+}
+
+#else
+
+bool AllocationCounter::isEnabled()
+{
+    return false;
+}
+
+std::atomic<quint64> *AllocationCounter::sink()
+{
+    return nullptr;
+}
+
+void AllocationCounter::setSink(std::atomic<quint64> *)
+{
+}
+
+#endif
+
+AllocationScope::AllocationScope(const char *label)
+    : m_label(label),
+    m_count(0),
+    m_previous(AllocationCounter::sink())
+{
+    AllocationCounter::setSink(&m_count);
+}
+
+AllocationScope::~AllocationScope()
+{
+    // Read before logging, which allocates itself.
+    const quint64 count = allocations();
+    AllocationCounter::setSink(m_previous);
+    if (m_previous) {
+        m_previous->fetch_add(count, std::memory_order_relaxed);
+    }
+    if (AllocationCounter::isEnabled() && m_label) {
+        qDebug() << m_label << "made" << count << "heap allocations";
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+#include <atomic>
+
+// Heap allocation counting, for checking that loaders and filters keep to a
+// constant number of allocations however large the input (see
+// BenchmarkSuite, which fails when they do not).
+//
+// Built in with the POINTCLOUD_COUNT_ALLOCATIONS CMake option. The counter
+// then sees malloc, calloc and realloc on glibc (which covers operator new
+// and Qt's containers), and the global operator new elsewhere. Without the
+// option every count is 0 and COUNT_ALLOCATIONS expands to nothing.
+namespace AllocationCounter {
+bool isEnabled();
+// Where the calling thread's allocations are counted: its innermost
+// AllocationScope, or null outside one. parallelForBlocks() hands it on to
+// the workers it starts.
+std::atomic<quint64> *sink();
+void setSink(std::atomic<quint64> *sink);
+}
+
+// Counts the allocations made while it is alive by the thread that created
+// it and by the parallelFor() workers that thread starts, but not by other
+// threads, such as concurrent batch jobs. Scopes nest; an inner scope's
+// allocations count towards the outer one too. Logs the count under label
+// when it ends, unless label is null.
+class AllocationScope
+{
+public:
+    explicit AllocationScope(const char *label = nullptr);
+    ~AllocationScope();
+
+    AllocationScope(const AllocationScope &) = delete;
+    AllocationScope &operator=(const AllocationScope &) = delete;
+
+    quint64 allocations() const { return m_count.load(std::memory_order_relaxed); }
+
+private:
+    const char *m_label;
+    std::atomic<quint64> m_count;
+    std::atomic<quint64> *m_previous;
+};
+
+#ifdef POINTCLOUD_COUNT_ALLOCATIONS
+#define COUNT_ALLOCATIONS(label) const AllocationScope allocationScope(label)
+#else
+#define COUNT_ALLOCATIONS(label) ((void)0)
+#endif
+
+#endif // ALLOCATIONCOUNTER_H
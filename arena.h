@@ -0,0 +1,141 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <QtGlobal>
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Monotonic allocator for the temporaries of one operation (a load, a
+// filter pass): allocation bumps a pointer, nothing is freed individually,
+// and the memory is handed back all at once when the enclosing Scope ends.
+//
+// Blocks are kept across scopes, so an operation that runs again with
+// similar sizes allocates nothing from the heap. Each thread has its own
+// scratch arena (see scratch()); hand pointers to worker threads, not the
+// arena itself.
+class Arena
+{
+public:
+    // Rewinds the arena to where it was on construction. Scopes nest.
+    class Scope
+    {
+    public:
+        explicit Scope(Arena &arena)
+            : m_arena(arena),
+            m_block(arena.m_current),
+            m_offset(arena.m_offset)
+        {
+        }
+        ~Scope()
+        {
+            m_arena.m_current = m_block;
+            m_arena.m_offset = m_offset;
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        Arena &m_arena;
+        size_t m_block;
+        size_t m_offset;
+    };
+
+    Arena()
+        : m_current(0),
+        m_offset(0)
+    {
+    }
+
+    ~Arena()
+    {
+        for (Block &block : m_blocks) {
+            std::free(block.data);
+        }
+    }
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // The calling thread's arena for short-lived scratch memory.
+    static Arena &scratch()
+    {
+        static thread_local Arena arena;
+        return arena;
+    }
+
+    void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+    {
+        for (;;) {
+            if (m_current < m_blocks.size()) {
+                Block &block = m_blocks[m_current];
+                const size_t aligned = (m_offset + alignment - 1) & ~(alignment - 1);
+                if (aligned + bytes <= block.size) {
+                    m_offset = aligned + bytes;
+                    return block.data + aligned;
+                }
+                // Later blocks may be free again after a scope rewound.
+                ++m_current;
+                m_offset = 0;
+                continue;
+            }
+            addBlock(bytes + alignment);
+        }
+    }
+
+    // Uninitialized storage for count objects; only for types that need no
+    // destructor, since the arena never runs one.
+    template <typename T>
+    T *allocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena memory is never destructed");
+        return static_cast<T *>(allocate(std::max<size_t>(count, 1) * sizeof(T), alignof(T)));
+    }
+
+    // Makes sure the next allocation of up to bytes needs no new block.
+    void reserve(size_t bytes)
+    {
+        Arena::Scope probe(*this);
+        allocate(bytes);
+    }
+
+    // Bytes held from the heap, used or not.
+    size_t capacity() const
+    {
+        size_t total = 0;
+        for (const Block &block : m_blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    static const size_t MinBlockSize = 1024 * 1024;
+
+    void addBlock(size_t bytes)
+    {
+        // Geometric growth keeps the block count logarithmic in the peak.
+        const size_t size = std::max({ bytes, MinBlockSize, capacity() });
+        char *data = static_cast<char *>(std::malloc(size));
+        if (!data) {
+            throw std::bad_alloc();
+        }
+        m_blocks.push_back(Block{ data, size });
+        m_offset = 0;
+    }
+
+    std::vector<Block> m_blocks;
+    size_t m_current;
+    size_t m_offset;
+};
+
+#endif // ARENA_H
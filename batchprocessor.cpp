@@ -0,0 +1,222 @@
+#include "batchprocessor.h"
+#include "outlierfilter.h"
+#include "parallelfor.h"
+#include "pointclouddata.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Narrows keep (empty for all points) to the points mask also keeps.
+static void combineMasks(QVector<quint8> &keep, QVector<quint8> &mask)
+{
+    if (keep.isEmpty()) {
+        keep.swap(mask);
+        return;
+    }
+    quint8 *flags = keep.data();
+    const quint8 *maskFlags = mask.constData();
+    for (int i = 0; i < keep.size(); ++i) {
+        flags[i] &= maskFlags[i];
+    }
+}
+
+BatchProcessor::Options::Options()
+    : outputDirectory("."),
+    format("ply"),
+    crop(false),
+    cropMin(0.0f, 0.0f, 0.0f),
+    cropMax(0.0f, 0.0f, 0.0f),
+    decimateFraction(1.0),
+    sorNeighbors(0),
+    sorStdDevMultiplier(1.0),
+    radius(0.0f),
+    radiusMinNeighbors(1),
+    jobs(std::max(1, QThread::idealThreadCount()))
+{
+}
+
+BatchProcessor::BatchProcessor(const Options &options)
+    : m_options(options),
+    m_elapsedMs(0)
+{
+}
+
+bool BatchProcessor::run(const QStringList &files)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!QDir(m_options.outputDirectory).exists() && !QDir().mkpath(m_options.outputDirectory)) {
+        qDebug() << "Failed to create output directory:" << m_options.outputDirectory;
+        return false;
+    }
+
+    // Outputs are assigned up front: an output that is one of the inputs
+    // (converting in place, or a.pts onto an input a.ply) or that another
+    // file already writes (a.pts and a.ply) would be clobbered while in
+    // use, so those files are refused. Inputs are listed by absolute path,
+    // and by canonical path to see through links.
+    QSet<QString> inputPaths;
+    for (const QString &filename : files) {
+        const QFileInfo input(filename);
+        inputPaths.insert(QDir::cleanPath(input.absoluteFilePath()));
+        if (input.exists()) {
+            inputPaths.insert(input.canonicalFilePath());
+        }
+    }
+    const QDir outputDir(m_options.outputDirectory);
+    QSet<QString> outputPaths;
+    QVector<int> accepted;
+    m_results = QVector<FileResult>(files.size());
+    for (int i = 0; i < files.size(); ++i) {
+        FileResult &result = m_results[i];
+        result.input = files[i];
+        result.output = outputDir.filePath(QFileInfo(files[i]).completeBaseName() + "." + m_options.format);
+
+        const QFileInfo output(result.output);
+        const QString outputPath = QDir::cleanPath(output.absoluteFilePath());
+        const bool overwritesInput = inputPaths.contains(outputPath)
+                                     || (output.exists() && inputPaths.contains(output.canonicalFilePath()));
+        if (overwritesInput) {
+            qDebug() << "Refusing to overwrite input file" << result.output << "; choose another --output";
+        } else if (outputPaths.contains(outputPath)) {
+            qDebug() << "Refusing" << result.input << ": another file is already written to" << result.output;
+        } else {
+            outputPaths.insert(outputPath);
+            accepted.append(i);
+        }
+    }
+
+    // Workers take the next file as they finish one, so a few large scans
+    // do not hold up the rest of a static share. Loading and filtering are
+    // parallel loops themselves, so each worker gets only its share of the
+    // cores for them: about one thread per core in all, not jobs times that.
+    const int workerCount = std::max(1, std::min(m_options.jobs, int(accepted.size())));
+    const int threadsPerWorker = (parallelThreadCount() + workerCount - 1) / workerCount;
+    std::atomic<int> next(0);
+    auto work = [&]() {
+        const ParallelThreadLimit limit(threadsPerWorker);
+        for (int i = next++; i < accepted.size(); i = next++) {
+            processFile(m_results[accepted[i]]);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(workerCount - 1);
+    for (int w = 1; w < workerCount; ++w) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+
+    m_elapsedMs = timer.elapsed();
+    const int failed = int(std::count_if(m_results.constBegin(), m_results.constEnd(),
+                                         [](const FileResult &result) { return !result.ok; }));
+    qDebug() << "Processed" << files.size() << "files," << failed << "failed, in" << m_elapsedMs << "ms";
+    return failed == 0;
+}
+
+void BatchProcessor::processFile(FileResult &result) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const QString &filename = result.input;
+    const QFileInfo info(filename);
+    PointCloudData cloud;
+    const bool loaded = info.suffix().compare("ply", Qt::CaseInsensitive) == 0 ? cloud.loadPlyFile(filename)
+                                                                               : cloud.loadPtsFile(filename);
+    result.loadMs = timer.elapsed();
+    if (!loaded) {
+        result.totalMs = result.loadMs;
+        return;
+    }
+    result.inputPoints = cloud.pointCount();
+
+    QVector<quint8> keep;
+    QVector<quint8> mask;
+    bool filtered = true;
+    if (m_options.decimateFraction < 1.0) {
+        cloud.sortSpatially();
+        filtered = OutlierFilter::decimationMask(cloud, m_options.decimateFraction, keep);
+    }
+    for (int axis = 0; axis < 3 && filtered && m_options.crop; ++axis) {
+        filtered = OutlierFilter::passThroughMask(cloud, axis, m_options.cropMin[axis], m_options.cropMax[axis], mask);
+        if (filtered) {
+            combineMasks(keep, mask);
+        }
+    }
+    if (filtered && m_options.sorNeighbors > 0) {
+        filtered = OutlierFilter::statisticalMask(cloud, m_options.sorNeighbors, m_options.sorStdDevMultiplier, mask);
+        if (filtered) {
+            combineMasks(keep, mask);
+        }
+    }
+    if (filtered && m_options.radius > 0.0f) {
+        filtered = OutlierFilter::radiusMask(cloud, m_options.radius, m_options.radiusMinNeighbors, mask);
+        if (filtered) {
+            combineMasks(keep, mask);
+        }
+    }
+    result.filterMs = timer.elapsed() - result.loadMs;
+    if (!filtered) {
+        result.totalMs = timer.elapsed();
+        return;
+    }
+    result.outputPoints = keep.isEmpty() ? result.inputPoints
+                                         : int(std::count(keep.constBegin(), keep.constEnd(), quint8(1)));
+
+    const bool written = m_options.format == "pts" ? cloud.savePtsFile(result.output, keep)
+                                                   : cloud.savePlyFile(result.output, keep);
+    result.totalMs = timer.elapsed();
+    result.writeMs = result.totalMs - result.loadMs - result.filterMs;
+    result.ok = written;
+}
+
+bool BatchProcessor::saveTimings(const QString &filename) const
+{
+    QJsonArray files;
+    for (const FileResult &result : m_results) {
+        QJsonObject object;
+        object.insert("input", result.input);
+        object.insert("output", result.output);
+        object.insert("ok", result.ok);
+        object.insert("inputPoints", result.inputPoints);
+        object.insert("outputPoints", result.outputPoints);
+        object.insert("loadMs", double(result.loadMs));
+        object.insert("filterMs", double(result.filterMs));
+        object.insert("writeMs", double(result.writeMs));
+        object.insert("totalMs", double(result.totalMs));
+        files.append(object);
+    }
+
+    QJsonObject root;
+    root.insert("jobs", m_options.jobs);
+    root.insert("totalMs", double(m_elapsedMs));
+    root.insert("files", files);
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to open timing file for writing:" << filename;
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    if (!file.commit()) {
+        qDebug() << "Error writing timing file:" << filename;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector3D>
+#include <QVector>
+
+// Headless load, filter and convert pipeline over many point cloud files,
+// for scripted jobs without a display.
+//
+// Uses PointCloudData's loaders and writers and OutlierFilter's masks
+// directly, so no GL context is needed. Nothing is streamed: each input is
+// loaded whole, every filter contributes a keep mask over it, and the
+// survivors are written chunk by chunk through the combined mask, without
+// a filtered copy of the cloud. Files are handed out one at a time to a
+// fixed number of worker threads, which bounds memory to that many whole
+// clouds however long the list.
+class BatchProcessor
+{
+public:
+    struct Options {
+        // Written as <outputDirectory>/<input base name>.<format>, where
+        // format is "ply" (binary) or "pts".
+        QString outputDirectory;
+        QString format;
+        // Axis-aligned box to keep; ignored unless crop is set.
+        bool crop;
+        QVector3D cropMin;
+        QVector3D cropMax;
+        // Fraction of points to keep, see OutlierFilter::decimationMask();
+        // 1 keeps all. Clouds are sorted spatially first.
+        double decimateFraction;
+        // Statistical outlier removal, disabled when sorNeighbors is 0.
+        int sorNeighbors;
+        double sorStdDevMultiplier;
+        // Radius outlier removal, disabled when radius is 0.
+        float radius;
+        int radiusMinNeighbors;
+        // Files processed at once. The cores are split between them, since
+        // loading and filtering are parallel within a file too.
+        int jobs;
+
+        Options();
+    };
+
+    // Timings in milliseconds; phases a failed file did not reach stay 0.
+    struct FileResult {
+        QString input;
+        QString output;
+        bool ok = false;
+        int inputPoints = 0;
+        int outputPoints = 0;
+        qint64 loadMs = 0;
+        qint64 filterMs = 0;
+        qint64 writeMs = 0;
+        qint64 totalMs = 0;
+    };
+
+    explicit BatchProcessor(const Options &options);
+
+    // Processes every file; returns false if any failed. Results are in
+    // the order of files. Files whose output would overwrite an input, or
+    // the output of an earlier file, are refused and count as failed.
+    bool run(const QStringList &files);
+    const QVector<FileResult> &results() const { return m_results; }
+    qint64 elapsedMs() const { return m_elapsedMs; }
+
+    // Writes the results as JSON: the options' job count, the total time
+    // and one object per file.
+    bool saveTimings(const QString &filename) const;
+
+private:
+    // Fills in result, whose input and output are set.
+    void processFile(FileResult &result) const;
+
+    Options m_options;
+    QVector<FileResult> m_results;
+    qint64 m_elapsedMs;
+};
+
+#endif // BATCHPROCESSOR_H
@@ -0,0 +1,405 @@
+#include "benchmarksuite.h"
+#include "allocationcounter.h"
+#include "measurementengine.h"
+#include "outlierfilter.h"
+#include "parallelfor.h"
+#include "pointclouddata.h"
+#include "pointcloudrenderer.h"
+#include "pointselection.h"
+#include "syntheticcloudgenerator.h"
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMatrix4x4>
+#include <QPolygonF>
+#include <QSaveFile>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Share of stray returns mixed into the in-memory cloud, for the outlier
+// filters to find.
+static const double ClutterFraction = 0.02;
+// Rays cast by the pick case.
+static const int PickRays = 1000;
+// Frames, each from its own camera position, of the level of detail case.
+static const int LodFrames = 1000;
+// Input sizes the allocation counts are compared at, and the thread count
+// they run with: fixed, so the workers started (which allocate a little
+// each) depend neither on the machine nor on the input size.
+static const int AllocationCheckSizes[2] = { 100000, 400000 };
+static const int AllocationCheckThreads = 2;
+
+BenchmarkSuite::BenchmarkSuite(const Options &options)
+    : m_options(options)
+{
+    m_options.pointCount = std::max(1, m_options.pointCount);
+    m_options.repetitions = std::max(1, m_options.repetitions);
+}
+
+template <typename Setup, typename Body>
+bool BenchmarkSuite::measure(const QString &name, Setup setup, Body body)
+{
+    QVector<double> times;
+    for (int run = 0; run <= m_options.repetitions; ++run) {
+        if (!setup()) {
+            qDebug() << "Benchmark" << name << "failed to set up";
+            return false;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        const bool ok = body();
+        const double ms = double(timer.nsecsElapsed()) / 1e6;
+        if (!ok) {
+            qDebug() << "Benchmark" << name << "failed";
+            return false;
+        }
+        // The first run only warms caches.
+        if (run > 0) {
+            times.append(ms);
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+    Result result;
+    result.name = name;
+    result.medianMs = times[times.size() / 2];
+    result.minMs = times.first();
+    m_results.append(result);
+    qDebug().noquote() << QString("%1 %2 ms (min %3 ms)").arg(name, -28).arg(result.medianMs, 10, 'f', 2)
+                                                        .arg(result.minMs, 0, 'f', 2);
+    return true;
+}
+
+template <typename Body>
+bool BenchmarkSuite::measure(const QString &name, Body body)
+{
+    return measure(name, []() { return true; }, body);
+}
+
+template <typename Pass>
+bool BenchmarkSuite::compareAllocations(const QString &name, Pass pass)
+{
+    quint64 counts[2];
+    for (int size = 0; size < 2; ++size) {
+        // The first run fills the scratch arenas and whatever else is kept
+        // for reuse by design; only the second is counted.
+        bool ok = pass(size);
+        if (ok) {
+            const AllocationScope scope;
+            ok = pass(size);
+            counts[size] = scope.allocations();
+        }
+        if (!ok) {
+            qDebug() << "Allocation check" << name << "failed";
+            return false;
+        }
+    }
+
+    const bool constant = counts[0] == counts[1];
+    qDebug().noquote() << QString("%1 %2 / %3 allocations%4").arg(name, -28).arg(counts[0], 10).arg(counts[1])
+                                                           .arg(constant ? "" : " GROWS WITH INPUT");
+    return constant;
+}
+
+bool BenchmarkSuite::run()
+{
+    typedef SyntheticCloudGenerator::Shape Shape;
+    typedef SyntheticCloudGenerator::Format Format;
+    m_results.clear();
+
+    QTemporaryDir temporary;
+    const QDir dir(m_options.workDirectory.isEmpty() ? temporary.path() : m_options.workDirectory);
+    if (!dir.exists() && !QDir().mkpath(dir.path())) {
+        qDebug() << "Failed to create benchmark directory:" << dir.path();
+        return false;
+    }
+
+    const int count = m_options.pointCount;
+    qDebug() << "Benchmarking" << count << "points," << m_options.repetitions << "runs per case";
+
+    // Loaders, over the terrain in each format they read.
+    const QString ptsFile = dir.filePath("terrain.pts");
+    const QString asciiPlyFile = dir.filePath("terrain_ascii.ply");
+    const QString binaryPlyFile = dir.filePath("terrain_binary.ply");
+    if (!SyntheticCloudGenerator::writeFile(ptsFile, Shape::Terrain, count, Format::Pts)
+        || !SyntheticCloudGenerator::writeFile(asciiPlyFile, Shape::Terrain, count, Format::AsciiPly)
+        || !SyntheticCloudGenerator::writeFile(binaryPlyFile, Shape::Terrain, count, Format::BinaryPly)) {
+        return false;
+    }
+
+    bool ok = measure("loadPtsFile", [&]() { PointCloudData cloud; return cloud.loadPtsFile(ptsFile); })
+              && measure("loadPlyFile (ascii)", [&]() { PointCloudData cloud; return cloud.loadPlyFile(asciiPlyFile); })
+              && measure("loadPlyFile (binary)", [&]() { PointCloudData cloud; return cloud.loadPlyFile(binaryPlyFile); });
+    if (!ok) {
+        return false;
+    }
+
+    // Terrain with stray returns, in memory.
+    const int clutterCount = int(count * ClutterFraction);
+    QVector<PointCloudData::Vertex> vertices(count);
+    SyntheticCloudGenerator::generate(Shape::Terrain, 1, 0, count - clutterCount, vertices.data());
+    SyntheticCloudGenerator::generate(Shape::Clutter, 1, 0, clutterCount, vertices.data() + count - clutterCount);
+    PointCloudData cloud;
+    // Mean spacing of the terrain points.
+    const float spacing = 100.0f / std::sqrt(float(count));
+
+    // Bounds and chunk bounds are reduced on every vertex change.
+    ok = measure("bounds (setVertices)", [&]() { cloud.setVertices(vertices); return true; })
+         && measure("sortSpatially", [&]() { cloud.setVertices(vertices); return true; },
+                    [&]() { cloud.sortSpatially(); return cloud.isSpatiallySorted(); });
+    if (!ok) {
+        return false;
+    }
+
+    // Normals arrive after load, often on a cloud compressed on load.
+    QSharedPointer<PointCloudData> compressed = cloud.clone();
+    compressed->compress();
+    const QVector<QVector3D> normals(count, QVector3D(0.0f, 1.0f, 0.0f));
+    ok = measure("setNormals (compressed)", [&]() { compressed->setNormals(QVector<QVector3D>()); return true; },
+                 [&]() { compressed->setNormals(normals); return compressed->hasNormals(); });
+    compressed.reset();
+    if (!ok) {
+        return false;
+    }
+
+    // Filters on the sorted cloud, as the viewer runs them.
+    QVector<quint8> keep;
+    ok = measure("passThroughMask", [&]() { return OutlierFilter::passThroughMask(cloud, 1, -1.0f, 1.0f, keep); })
+         && measure("decimationMask", [&]() { return OutlierFilter::decimationMask(cloud, 0.1, keep); })
+         && measure("statisticalMask", [&]() { return OutlierFilter::statisticalMask(cloud, 8, 1.0, keep); })
+         && measure("radiusMask", [&]() { return OutlierFilter::radiusMask(cloud, 3.0f * spacing, 4, keep); });
+    if (!ok) {
+        return false;
+    }
+
+    // Picks straight down onto the terrain, spread over a grid.
+    QSharedPointer<PointCloudData> shared = cloud.clone();
+    MeasurementEngine engine;
+    engine.setPointCloud(shared);
+    ok = measure("pickAlongRay (x1000)", [&]() {
+        int hits = 0;
+        for (int i = 0; i < PickRays; ++i) {
+            const float x = -45.0f + 90.0f * float(i % 32) / 31.0f;
+            const float z = -45.0f + 90.0f * float(i / 32) / float(PickRays / 32);
+            QVector3D point;
+            hits += engine.pickAlongRay(QVector3D(x, 50.0f, z), QVector3D(0.0f, -1.0f, 0.0f), spacing, point);
+        }
+        return hits > 0;
+    });
+    if (!ok) {
+        return false;
+    }
+
+    // The renderer's per-frame chunk culling and thinning, for a 1080p view
+    // orbiting the terrain at an oblique angle.
+    QMatrix4x4 projection;
+    projection.perspective(45.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+    const float pixelsPerUnit = 0.5f * 1080.0f * projection(1, 1);
+    QVector<int> counts;
+    ok = measure(QString("selectChunks (x%1)").arg(LodFrames), [&]() {
+        qint64 drawn = 0;
+        for (int frame = 0; frame < LodFrames; ++frame) {
+            const float angle = 2.0f * float(M_PI) * frame / LodFrames;
+            QMatrix4x4 modelView;
+            modelView.lookAt(QVector3D(80.0f * std::cos(angle), 40.0f, 80.0f * std::sin(angle)),
+                             QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
+            float nearDepth = std::numeric_limits<float>::max();
+            float farDepth = std::numeric_limits<float>::lowest();
+            counts.clear();
+            PointCloudRenderer::selectChunks(cloud.chunks(), cloud.pointCount(), projection, modelView, true,
+                                             pixelsPerUnit, 4.0f, true, counts, nearDepth, farDepth);
+            for (int count : counts) {
+                drawn += count;
+            }
+        }
+        return drawn > 0;
+    });
+    return ok && checkAllocations(dir);
+}
+
+bool BenchmarkSuite::checkAllocations(const QDir &dir)
+{
+    typedef SyntheticCloudGenerator::Shape Shape;
+    typedef SyntheticCloudGenerator::Format Format;
+
+    if (!AllocationCounter::isEnabled()) {
+        qDebug() << "Allocation counting not built in (POINTCLOUD_COUNT_ALLOCATIONS), skipping its checks";
+        return true;
+    }
+    qDebug() << "Counting heap allocations at" << AllocationCheckSizes[0] << "and" << AllocationCheckSizes[1]
+             << "points";
+    const ParallelThreadLimit threads(AllocationCheckThreads);
+
+    // The same inputs as the timed cases, at both sizes.
+    QString ptsFiles[2];
+    QString asciiPlyFiles[2];
+    QString binaryPlyFiles[2];
+    QSharedPointer<PointCloudData> clouds[2];
+    float spacings[2];
+    for (int size = 0; size < 2; ++size) {
+        const int count = AllocationCheckSizes[size];
+        ptsFiles[size] = dir.filePath(QString("allocations_%1.pts").arg(count));
+        asciiPlyFiles[size] = dir.filePath(QString("allocations_%1_ascii.ply").arg(count));
+        binaryPlyFiles[size] = dir.filePath(QString("allocations_%1_binary.ply").arg(count));
+        if (!SyntheticCloudGenerator::writeFile(ptsFiles[size], Shape::Terrain, count, Format::Pts)
+            || !SyntheticCloudGenerator::writeFile(asciiPlyFiles[size], Shape::Terrain, count, Format::AsciiPly)
+            || !SyntheticCloudGenerator::writeFile(binaryPlyFiles[size], Shape::Terrain, count, Format::BinaryPly)) {
+            return false;
+        }
+
+        const int clutterCount = int(count * ClutterFraction);
+        QVector<PointCloudData::Vertex> vertices(count);
+        SyntheticCloudGenerator::generate(Shape::Terrain, 1, 0, count - clutterCount, vertices.data());
+        SyntheticCloudGenerator::generate(Shape::Clutter, 1, 0, clutterCount, vertices.data() + count - clutterCount);
+        clouds[size].reset(new PointCloudData);
+        clouds[size]->setVertices(vertices);
+        clouds[size]->sortSpatially();
+        spacings[size] = 100.0f / std::sqrt(float(count));
+    }
+
+    // A lasso over part of the terrain, seen from straight above, so that
+    // some chunks are decided whole and others point by point.
+    const QSize viewport(800, 800);
+    QMatrix4x4 viewProjection;
+    viewProjection.ortho(-60.0f, 60.0f, -60.0f, 60.0f, -100.0f, 100.0f);
+    viewProjection.rotate(90.0f, 1.0f, 0.0f, 0.0f);
+    QPolygonF lasso;
+    lasso << QPointF(150.0, 200.0) << QPointF(620.0, 120.0) << QPointF(700.0, 560.0) << QPointF(380.0, 430.0)
+          << QPointF(220.0, 680.0);
+
+    QVector<quint8> keep;
+    return compareAllocations("loadPtsFile", [&](int size) {
+               PointCloudData cloud;
+               return cloud.loadPtsFile(ptsFiles[size]);
+           })
+           && compareAllocations("loadPlyFile (ascii)", [&](int size) {
+               PointCloudData cloud;
+               return cloud.loadPlyFile(asciiPlyFiles[size]);
+           })
+           && compareAllocations("loadPlyFile (binary)", [&](int size) {
+               PointCloudData cloud;
+               return cloud.loadPlyFile(binaryPlyFiles[size]);
+           })
+           && compareAllocations("passThroughMask", [&](int size) {
+               return OutlierFilter::passThroughMask(*clouds[size], 1, -1.0f, 1.0f, keep);
+           })
+           && compareAllocations("decimationMask", [&](int size) {
+               return OutlierFilter::decimationMask(*clouds[size], 0.1, keep);
+           })
+           && compareAllocations("statisticalMask", [&](int size) {
+               return OutlierFilter::statisticalMask(*clouds[size], 8, 1.0, keep);
+           })
+           && compareAllocations("radiusMask", [&](int size) {
+               return OutlierFilter::radiusMask(*clouds[size], 3.0f * spacings[size], 4, keep);
+           })
+           && compareAllocations("selectPolygon", [&](int size) {
+               PointSelection selection;
+               selection.setPointCloud(clouds[size]);
+               selection.selectPolygon(lasso, viewProjection, viewport, PointSelection::Operation::Replace);
+               return !selection.isEmpty();
+           })
+           && compareAllocations("pickAlongRay", [&](int size) {
+               // Down the middle, where chunks meet at either size, so both
+               // picks have enough candidates to start every worker.
+               MeasurementEngine engine;
+               engine.setPointCloud(clouds[size]);
+               QVector3D point;
+               return engine.pickAlongRay(QVector3D(0.0f, 50.0f, 0.0f), QVector3D(0.0f, -1.0f, 0.0f),
+                                          spacings[size], point);
+           });
+}
+
+bool BenchmarkSuite::saveBaseline(const QString &filename) const
+{
+    QJsonArray results;
+    for (const Result &result : m_results) {
+        QJsonObject object;
+        object.insert("name", result.name);
+        object.insert("medianMs", result.medianMs);
+        object.insert("minMs", result.minMs);
+        results.append(object);
+    }
+
+    QJsonObject root;
+    root.insert("pointCount", m_options.pointCount);
+    root.insert("repetitions", m_options.repetitions);
+    root.insert("results", results);
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to open baseline file for writing:" << filename;
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    if (!file.commit()) {
+        qDebug() << "Error writing baseline file:" << filename;
+        return false;
+    }
+    return true;
+}
+
+bool BenchmarkSuite::compareWithBaseline(const QString &filename, double thresholdPercent) const
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to open baseline file:" << filename;
+        return false;
+    }
+    QJsonParseError error;
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll(), &error).object();
+    if (error.error != QJsonParseError::NoError) {
+        qDebug() << "Invalid baseline file:" << filename << error.errorString();
+        return false;
+    }
+    if (root.value("pointCount").toInt() != m_options.pointCount) {
+        qDebug() << "Baseline was recorded with" << root.value("pointCount").toInt() << "points, not"
+                 << m_options.pointCount;
+        return false;
+    }
+
+    bool passed = true;
+    const QJsonArray baseline = root.value("results").toArray();
+    for (const Result &result : m_results) {
+        double baselineMs = -1.0;
+        for (int i = 0; i < baseline.size(); ++i) {
+            const QJsonObject object = baseline.at(i).toObject();
+            if (object.value("name").toString() == result.name) {
+                baselineMs = object.value("medianMs").toDouble();
+                break;
+            }
+        }
+        if (baselineMs <= 0.0) {
+            qDebug().noquote() << QString("%1 not in baseline").arg(result.name, -28);
+            continue;
+        }
+
+        const double change = (result.medianMs / baselineMs - 1.0) * 100.0;
+        const bool regressed = change > thresholdPercent;
+        passed = passed && !regressed;
+        qDebug().noquote() << QString("%1 %2 ms vs %3 ms (%4%5%)%6")
+                                  .arg(result.name, -28)
+                                  .arg(result.medianMs, 10, 'f', 2)
+                                  .arg(baselineMs, 0, 'f', 2)
+                                  .arg(change >= 0.0 ? "+" : "")
+                                  .arg(change, 0, 'f', 1)
+                                  .arg(regressed ? " REGRESSION" : "");
+    }
+
+    // A case dropped or renamed since the baseline would hide its regressions.
+    for (int i = 0; i < baseline.size(); ++i) {
+        const QString name = baseline.at(i).toObject().value("name").toString();
+        const bool ran = std::any_of(m_results.constBegin(), m_results.constEnd(),
+                                     [&name](const Result &result) { return result.name == name; });
+        if (!ran) {
+            qDebug().noquote() << QString("%1 in baseline, not run").arg(name, -28);
+            passed = false;
+        }
+    }
+    return passed;
+}
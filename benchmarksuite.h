@@ -0,0 +1,67 @@
+#ifndef BENCHMARKSUITE_H
+#define BENCHMARKSUITE_H
+
+#include <QDir>
+#include <QString>
+#include <QVector>
+
+// Timings of the loaders and of the CPU work behind filtering, picking and
+// level of detail, over SyntheticCloudGenerator clouds, and their
+// comparison with a stored baseline.
+//
+// Every case runs once to warm caches and then repetitions times; its
+// median is what gets compared, as the least sensitive to a stray slow run.
+// Baselines are only comparable on the machine and point count they were
+// recorded with.
+//
+// In a build with POINTCLOUD_COUNT_ALLOCATIONS, the loaders, filters and
+// picking are also run at two input sizes, and the suite fails if any of
+// them makes more or fewer heap allocations at one than at the other.
+class BenchmarkSuite
+{
+public:
+    struct Options {
+        int pointCount = 1000000;
+        int repetitions = 5;
+        // Where the input files go; a temporary directory when empty.
+        QString workDirectory;
+    };
+
+    struct Result {
+        QString name;
+        double medianMs;
+        double minMs;
+    };
+
+    explicit BenchmarkSuite(const Options &options);
+
+    // Returns false if an input could not be generated, a case failed or
+    // an allocation count changed with the input size.
+    bool run();
+    const QVector<Result> &results() const { return m_results; }
+
+    bool saveBaseline(const QString &filename) const;
+    // Logs every case against the baseline; returns false if any median is
+    // more than thresholdPercent slower, a baseline case did not run, or the
+    // baseline does not match.
+    bool compareWithBaseline(const QString &filename, double thresholdPercent) const;
+
+private:
+    // Times body, after an untimed setup on each run; both return false
+    // on failure.
+    template <typename Setup, typename Body>
+    bool measure(const QString &name, Setup setup, Body body);
+    template <typename Body>
+    bool measure(const QString &name, Body body);
+
+    bool checkAllocations(const QDir &dir);
+    // Counts the allocations of pass(size) for both sizes, each after an
+    // uncounted run; false if they differ or the pass fails.
+    template <typename Pass>
+    bool compareAllocations(const QString &name, Pass pass);
+
+    Options m_options;
+    QVector<Result> m_results;
+};
+
+#endif // BENCHMARKSUITE_H
@@ -0,0 +1,260 @@
+#include "compressedpointstore.h"
+#include "parallelfor.h"
+#include <algorithm>
+#include <cmath>
+
+// Bit streams are little-endian within 64-bit words. Fields are at most 32
+// bits wide, so a field spans at most two words; encoders allocate one spare
+// word so readers never need a bounds check.
+static inline void writeBits(quint64 *words, quint64 &position, quint32 value, int count)
+{
+    if (count == 0) {
+        return;
+    }
+    const quint64 word = position >> 6;
+    const int shift = int(position & 63);
+    words[word] |= quint64(value) << shift;
+    if (shift + count > 64) {
+        words[word + 1] |= quint64(value) >> (64 - shift);
+    }
+    position += count;
+}
+
+static inline quint32 readBits(const quint64 *words, quint64 &position, int count)
+{
+    if (count == 0) {
+        return 0;
+    }
+    const quint64 word = position >> 6;
+    const int shift = int(position & 63);
+    quint64 value = words[word] >> shift;
+    if (shift + count > 64) {
+        value |= words[word + 1] << (64 - shift);
+    }
+    position += count;
+    return quint32(value & ((quint64(1) << count) - 1));
+}
+
+static inline quint32 packColor888(const QVector3D &color)
+{
+    const quint32 r = quint32(std::lround(std::clamp(color.x(), 0.0f, 1.0f) * 255.0f));
+    const quint32 g = quint32(std::lround(std::clamp(color.y(), 0.0f, 1.0f) * 255.0f));
+    const quint32 b = quint32(std::lround(std::clamp(color.z(), 0.0f, 1.0f) * 255.0f));
+    return (r << 16) | (g << 8) | b;
+}
+
+static inline QVector3D unpackColor888(quint32 color)
+{
+    return QVector3D(float((color >> 16) & 0xff), float((color >> 8) & 0xff), float(color & 0xff)) / 255.0f;
+}
+
+static inline quint32 packColor565(quint32 color888)
+{
+    const quint32 r = (((color888 >> 16) & 0xff) * 31 + 127) / 255;
+    const quint32 g = (((color888 >> 8) & 0xff) * 63 + 127) / 255;
+    const quint32 b = ((color888 & 0xff) * 31 + 127) / 255;
+    return (r << 11) | (g << 5) | b;
+}
+
+static inline QVector3D unpackColor565(quint32 color)
+{
+    return QVector3D(float((color >> 11) & 31) / 31.0f, float((color >> 5) & 63) / 63.0f, float(color & 31) / 31.0f);
+}
+
+static inline quint8 bitsFor(quint64 maxValue)
+{
+    quint8 bits = 0;
+    while (bits < 32 && (quint64(1) << bits) <= maxValue) {
+        ++bits;
+    }
+    return bits;
+}
+
+CompressedPointStore::CompressedPointStore()
+    : m_step(1.0f),
+    m_pointCount(0)
+{
+}
+
+void CompressedPointStore::build(const QVector<Vertex> &vertices, const QVector<PointCloudData::Chunk> &chunks,
+                                 const QVector3D &boundsMin, const QVector3D &boundsMax, float quantizationStep)
+{
+    m_pointCount = vertices.size();
+    m_step = quantizationStep;
+    if (m_step <= 0.0f) {
+        const QVector3D extent = boundsMax - boundsMin;
+        m_step = std::max(extent.x(), std::max(extent.y(), extent.z())) / float(1 << 20);
+        if (m_step <= 0.0f) {
+            m_step = 1.0f;
+        }
+    }
+
+    m_chunks.resize(chunks.size());
+    for (int c = 0; c < chunks.size(); ++c) {
+        m_chunks[c].first = chunks[c].first;
+        m_chunks[c].count = chunks[c].count;
+    }
+
+    const Vertex *vertexData = vertices.constData();
+    EncodedChunk *encoded = m_chunks.data();
+    const float step = m_step;
+    parallelFor(m_chunks.size(), [vertexData, encoded, step](qint64 begin, qint64 end) {
+        for (qint64 c = begin; c < end; ++c) {
+            encodeChunk(vertexData, encoded[c], step);
+        }
+    }, 1);
+}
+
+void CompressedPointStore::encodeChunk(const Vertex *vertices, EncodedChunk &chunk, float step)
+{
+    const Vertex *points = vertices + chunk.first;
+    const int count = chunk.count;
+    if (count == 0) {
+        chunk.origin = QVector3D();
+        chunk.step = step;
+        chunk.positionBits[0] = chunk.positionBits[1] = chunk.positionBits[2] = 0;
+        chunk.colorBits = 0;
+        return;
+    }
+
+    QVector3D boundsMin = points[0].position;
+    QVector3D boundsMax = points[0].position;
+    for (int i = 1; i < count; ++i) {
+        const QVector3D &p = points[i].position;
+        boundsMin.setX(std::min(boundsMin.x(), p.x()));
+        boundsMin.setY(std::min(boundsMin.y(), p.y()));
+        boundsMin.setZ(std::min(boundsMin.z(), p.z()));
+
+        boundsMax.setX(std::max(boundsMax.x(), p.x()));
+        boundsMax.setY(std::max(boundsMax.y(), p.y()));
+        boundsMax.setZ(std::max(boundsMax.z(), p.z()));
+    }
+
+    // A chunk too large for 32-bit offsets at this step (stray points in an
+    // unsorted cloud) is coarsened rather than overflowing.
+    const QVector3D extent = boundsMax - boundsMin;
+    const float maxExtent = std::max(extent.x(), std::max(extent.y(), extent.z()));
+    chunk.origin = boundsMin;
+    chunk.step = std::max(step, maxExtent / 4294967295.0f);
+
+    quint32 maxOffset[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        maxOffset[axis] = quint32(std::min(4294967295.0, std::floor(double(extent[axis]) / chunk.step + 0.5)));
+        chunk.positionBits[axis] = bitsFor(maxOffset[axis]);
+    }
+
+    QVector<quint32> colors(count);
+    for (int i = 0; i < count; ++i) {
+        colors[i] = packColor888(points[i].color);
+    }
+    QVector<quint32> palette = colors;
+    std::sort(palette.begin(), palette.end());
+    palette.erase(std::unique(palette.begin(), palette.end()), palette.end());
+    if (palette.size() <= 256) {
+        chunk.palette = palette;
+        chunk.colorBits = bitsFor(quint64(palette.size() - 1));
+    } else {
+        chunk.palette.clear();
+        chunk.colorBits = 16;
+    }
+
+    const int bitsPerPoint = chunk.positionBits[0] + chunk.positionBits[1] + chunk.positionBits[2] + chunk.colorBits;
+    chunk.bits.fill(0, int((quint64(count) * bitsPerPoint + 63) / 64) + 1);
+    quint64 *words = chunk.bits.data();
+    quint64 position = 0;
+
+    const float inverseStep = 1.0f / chunk.step;
+    for (int i = 0; i < count; ++i) {
+        const QVector3D offset = (points[i].position - chunk.origin) * inverseStep;
+        for (int axis = 0; axis < 3; ++axis) {
+            const double rounded = std::floor(double(offset[axis]) + 0.5);
+            const quint32 q = quint32(std::clamp(rounded, 0.0, double(maxOffset[axis])));
+            writeBits(words, position, q, chunk.positionBits[axis]);
+        }
+
+        if (chunk.palette.isEmpty()) {
+            writeBits(words, position, packColor565(colors[i]), 16);
+        } else {
+            const quint32 index = quint32(std::lower_bound(chunk.palette.constBegin(), chunk.palette.constEnd(), colors[i])
+                                          - chunk.palette.constBegin());
+            writeBits(words, position, index, chunk.colorBits);
+        }
+    }
+}
+
+void CompressedPointStore::decodeChunk(int chunkIndex, Vertex *out) const
+{
+    decodePoints(m_chunks[chunkIndex], 0, m_chunks[chunkIndex].count, out);
+}
+
+// Decodes points [begin, end) of the chunk, relative to its first vertex.
+void CompressedPointStore::decodePoints(const EncodedChunk &chunk, int begin, int end, Vertex *out) const
+{
+    const quint64 *words = chunk.bits.constData();
+    const quint32 *palette = chunk.palette.constData();
+    const bool hasPalette = !chunk.palette.isEmpty();
+    const int bitsPerPoint = chunk.positionBits[0] + chunk.positionBits[1] + chunk.positionBits[2] + chunk.colorBits;
+    quint64 position = quint64(begin) * bitsPerPoint;
+
+    for (int i = 0; i < end - begin; ++i) {
+        const quint32 x = readBits(words, position, chunk.positionBits[0]);
+        const quint32 y = readBits(words, position, chunk.positionBits[1]);
+        const quint32 z = readBits(words, position, chunk.positionBits[2]);
+        out[i].position = chunk.origin + QVector3D(float(x), float(y), float(z)) * chunk.step;
+
+        const quint32 color = readBits(words, position, chunk.colorBits);
+        out[i].color = hasPalette ? unpackColor888(palette[color]) : unpackColor565(color);
+    }
+}
+
+void CompressedPointStore::decodeAll(Vertex *out) const
+{
+    parallelFor(m_chunks.size(), [this, out](qint64 begin, qint64 end) {
+        for (qint64 c = begin; c < end; ++c) {
+            decodeChunk(int(c), out + m_chunks[c].first);
+        }
+    }, 1);
+}
+
+void CompressedPointStore::decodeRange(int first, int count, Vertex *out) const
+{
+    const int last = first + count;
+    const EncodedChunk *chunks = m_chunks.constData();
+    const EncodedChunk *begin = std::upper_bound(chunks, chunks + m_chunks.size(), first,
+                                                 [](int vertex, const EncodedChunk &chunk) {
+                                                     return vertex < chunk.first;
+                                                 });
+    const int firstChunk = std::max(0, int(begin - chunks) - 1);
+    int lastChunk = firstChunk;
+    while (lastChunk < m_chunks.size() && chunks[lastChunk].first < last) {
+        ++lastChunk;
+    }
+
+    parallelFor(lastChunk - firstChunk, [=](qint64 blockBegin, qint64 blockEnd) {
+        for (qint64 c = firstChunk + blockBegin; c < firstChunk + blockEnd; ++c) {
+            const EncodedChunk &chunk = chunks[c];
+            const int from = std::max(first, chunk.first);
+            const int to = std::min(last, chunk.first + chunk.count);
+            if (from < to) {
+                decodePoints(chunk, from - chunk.first, to - chunk.first, out + (from - first));
+            }
+        }
+    }, 1);
+}
+
+qint64 CompressedPointStore::compressedBytes() const
+{
+    qint64 bytes = qint64(sizeof(*this));
+    for (const EncodedChunk &chunk : m_chunks) {
+        bytes += qint64(sizeof(EncodedChunk));
+        bytes += qint64(chunk.bits.size()) * qint64(sizeof(quint64));
+        bytes += qint64(chunk.palette.size()) * qint64(sizeof(quint32));
+    }
+    return bytes;
+}
+
+double CompressedPointStore::compressionRatio() const
+{
+    const qint64 compressed = compressedBytes();
+    return compressed > 0 ? double(uncompressedBytes()) / double(compressed) : 1.0;
+}
@@ -0,0 +1,65 @@
+#ifndef COMPRESSEDPOINTSTORE_H
+#define COMPRESSEDPOINTSTORE_H
+
+#include <QVector3D>
+#include <QVector>
+#include "pointclouddata.h"
+
+// Compact host-side copy of a cloud's vertices, encoded per chunk.
+//
+// Positions are quantized to a fixed step relative to the chunk's minimum
+// corner and bit-packed with just enough bits per axis for the chunk's
+// extent, so spatially compact (Morton-sorted) chunks pack tightest. Colors
+// become 8-bit indices into a per-chunk palette when a chunk has at most 256
+// distinct colors, and RGB565 otherwise. Chunks are independent: any chunk
+// can be decoded on its own, from any thread.
+class CompressedPointStore
+{
+public:
+    typedef PointCloudData::Vertex Vertex;
+
+    CompressedPointStore();
+
+    // Encodes the given chunks of vertices in parallel. A step of 0 picks
+    // 1/2^20 of the largest extent of the cloud.
+    void build(const QVector<Vertex> &vertices, const QVector<PointCloudData::Chunk> &chunks,
+               const QVector3D &boundsMin, const QVector3D &boundsMax, float quantizationStep = 0.0f);
+
+    int pointCount() const { return m_pointCount; }
+    int chunkCount() const { return m_chunks.size(); }
+    float quantizationStep() const { return m_step; }
+
+    qint64 compressedBytes() const;
+    qint64 uncompressedBytes() const { return qint64(m_pointCount) * qint64(sizeof(Vertex)); }
+    double compressionRatio() const;
+
+    // Writes the chunk's vertices to out, which must hold its count.
+    void decodeChunk(int chunk, Vertex *out) const;
+    // Decodes every chunk to out[first] on all cores.
+    void decodeAll(Vertex *out) const;
+    // Decodes vertices [first, first + count) to out on all cores. Points
+    // have a fixed width within a chunk, so a range may start mid-chunk.
+    void decodeRange(int first, int count, Vertex *out) const;
+
+private:
+    struct EncodedChunk {
+        int first;
+        int count;
+        QVector3D origin;
+        float step;
+        quint8 positionBits[3];
+        // Palette index width, or 16 for RGB565 when there is no palette.
+        quint8 colorBits;
+        QVector<quint32> palette;
+        QVector<quint64> bits;
+    };
+
+    static void encodeChunk(const Vertex *vertices, EncodedChunk &chunk, float step);
+    void decodePoints(const EncodedChunk &chunk, int begin, int end, Vertex *out) const;
+
+    QVector<EncodedChunk> m_chunks;
+    float m_step;
+    int m_pointCount;
+};
+
+#endif // COMPRESSEDPOINTSTORE_H
@@ -0,0 +1,267 @@
+#include "gpuuploadmanager.h"
+#include <QOpenGLContext>
+#include <QDebug>
+#include <algorithm>
+
+static const qint64 FrameIntervalMs = 16;
+static const qint64 MinBufferCapacity = 1024 * 1024;
+
+// Rounds up to the next eighth of the leading power of two, so pooled
+// buffers waste at most 12.5% and similar sizes land in the same bucket.
+static qint64 roundCapacity(qint64 bytes)
+{
+    if (bytes <= MinBufferCapacity) {
+        return MinBufferCapacity;
+    }
+    qint64 power = MinBufferCapacity;
+    while (power * 2 <= bytes) {
+        power *= 2;
+    }
+    const qint64 step = power / 8;
+    return (bytes + step - 1) / step * step;
+}
+
+GpuUploadManager *GpuUploadManager::instance()
+{
+    static GpuUploadManager manager;
+    return &manager;
+}
+
+GpuUploadManager::GpuUploadManager()
+    : m_nextTicket(1),
+    m_nextStaging(0),
+    m_frameBudget(32 * 1024 * 1024),
+    m_budget(m_frameBudget)
+{
+}
+
+GLuint GpuUploadManager::acquireBuffer(qint64 bytes)
+{
+    QOpenGLExtraFunctions *gl = QOpenGLContext::currentContext()->extraFunctions();
+    deleteEvictedBuffers(gl);
+
+    // Best fit among idle buffers, but not one so large that a small cloud
+    // would pin a big allocation.
+    const qint64 capacity = roundCapacity(bytes);
+    int best = -1;
+    for (int i = 0; i < m_idleBuffers.size(); ++i) {
+        const qint64 idle = m_bufferCapacity.value(m_idleBuffers[i]);
+        if (idle >= bytes && idle <= capacity * 2
+            && (best < 0 || idle < m_bufferCapacity.value(m_idleBuffers[best]))) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        const GLuint buffer = m_idleBuffers[best];
+        m_idleBuffers.remove(best);
+        return buffer;
+    }
+
+    GLuint buffer = 0;
+    gl->glGenBuffers(1, &buffer);
+    gl->glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    gl->glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+    gl->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_bufferCapacity.insert(buffer, capacity);
+    return buffer;
+}
+
+void GpuUploadManager::releaseBuffer(GLuint buffer)
+{
+    if (buffer == 0) {
+        return;
+    }
+
+    for (int i = m_jobs.size() - 1; i >= 0; --i) {
+        if (m_jobs[i].buffer == buffer) {
+            m_jobs.remove(i);
+        }
+    }
+    m_idleBuffers.append(buffer);
+
+    // Evict the longest idle buffers beyond the limit. Deleting needs a
+    // context, so it happens on the next acquire or upload.
+    qint64 idleBytes = 0;
+    for (GLuint idle : m_idleBuffers) {
+        idleBytes += m_bufferCapacity.value(idle);
+    }
+    while (idleBytes > MaxIdleBytes && !m_idleBuffers.isEmpty()) {
+        const GLuint evicted = m_idleBuffers.takeFirst();
+        idleBytes -= m_bufferCapacity.value(evicted);
+        m_bufferCapacity.remove(evicted);
+        m_deletedBuffers.append(evicted);
+    }
+}
+
+void GpuUploadManager::deleteEvictedBuffers(QOpenGLExtraFunctions *gl)
+{
+    if (!m_deletedBuffers.isEmpty()) {
+        gl->glDeleteBuffers(GLsizei(m_deletedBuffers.size()), m_deletedBuffers.constData());
+        m_deletedBuffers.clear();
+    }
+}
+
+quint64 GpuUploadManager::upload(GLuint buffer, int count, int elementSize, const Writer &writer,
+                                 const Progress &progress)
+{
+    Job job;
+    job.ticket = m_nextTicket++;
+    job.buffer = buffer;
+    job.count = count;
+    job.elementSize = elementSize;
+    job.uploaded = 0;
+    job.writer = writer;
+    job.progress = progress;
+    m_jobs.append(job);
+    return job.ticket;
+}
+
+void GpuUploadManager::cancelUpload(quint64 ticket)
+{
+    for (int i = 0; i < m_jobs.size(); ++i) {
+        if (m_jobs[i].ticket == ticket) {
+            m_jobs.remove(i);
+            return;
+        }
+    }
+}
+
+bool GpuUploadManager::processPendingUploads()
+{
+    QOpenGLExtraFunctions *gl = QOpenGLContext::currentContext()->extraFunctions();
+    deleteEvictedBuffers(gl);
+
+    // Token bucket refilled at one budget per frame interval and capped at
+    // one budget, so renderers painting back to back share a frame's worth.
+    if (m_budgetTimer.isValid()) {
+        const qint64 elapsed = m_budgetTimer.restart();
+        m_budget = std::min(m_frameBudget, m_budget + m_frameBudget * elapsed / FrameIntervalMs);
+    } else {
+        m_budgetTimer.start();
+    }
+
+    while (!m_jobs.isEmpty() && m_budget > 0) {
+        const int staging = acquireStagingBuffer(gl);
+        if (staging < 0) {
+            break;
+        }
+
+        Job &job = m_jobs.first();
+        const int before = job.uploaded;
+        uploadSlice(gl, job, staging);
+        if (job.uploaded == before) {
+            break;
+        }
+        m_budget -= qint64(job.uploaded - before) * job.elementSize;
+
+        // The callback may not touch the manager, so the job stays put.
+        const bool done = job.uploaded == job.count;
+        job.progress(job.uploaded);
+        if (done) {
+            m_jobs.removeFirst();
+        }
+    }
+
+    return !m_jobs.isEmpty();
+}
+
+void GpuUploadManager::finishPendingUploads()
+{
+    QOpenGLExtraFunctions *gl = QOpenGLContext::currentContext()->extraFunctions();
+    while (!m_jobs.isEmpty()) {
+        m_budget = m_frameBudget;
+        m_budgetTimer.invalidate();
+        processPendingUploads();
+        // Staging buffers only come back once the GPU has read them, and
+        // their fences only signal once the copies are flushed.
+        gl->glFlush();
+    }
+}
+
+// Fences signal in submission order, so only the oldest staging buffer in
+// the ring needs checking.
+int GpuUploadManager::acquireStagingBuffer(QOpenGLExtraFunctions *gl)
+{
+    if (m_staging.isEmpty()) {
+        m_staging.resize(StagingBufferCount);
+        for (StagingBuffer &staging : m_staging) {
+            gl->glGenBuffers(1, &staging.buffer);
+            gl->glBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+            gl->glBufferData(GL_COPY_READ_BUFFER, StagingBufferSize, nullptr, GL_STREAM_DRAW);
+            staging.fence = nullptr;
+        }
+        gl->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+    StagingBuffer &staging = m_staging[m_nextStaging];
+    if (staging.fence) {
+        const GLenum status = gl->glClientWaitSync(staging.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            return -1;
+        }
+        gl->glDeleteSync(staging.fence);
+        staging.fence = nullptr;
+    }
+
+    const int index = m_nextStaging;
+    m_nextStaging = (m_nextStaging + 1) % m_staging.size();
+    return index;
+}
+
+void GpuUploadManager::uploadSlice(QOpenGLExtraFunctions *gl, Job &job, int stagingIndex)
+{
+    StagingBuffer &staging = m_staging[stagingIndex];
+    const int count = std::min(job.count - job.uploaded, int(StagingBufferSize / job.elementSize));
+    const qint64 bytes = qint64(count) * job.elementSize;
+    const qint64 offset = qint64(job.uploaded) * job.elementSize;
+
+    // The fence guarantees the GPU finished copying out of this staging
+    // buffer, so the driver need not synchronize the mapping.
+    gl->glBindBuffer(GL_COPY_READ_BUFFER, staging.buffer);
+    void *mapped = gl->glMapBufferRange(GL_COPY_READ_BUFFER, 0, bytes,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT
+                                            | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (mapped) {
+        job.writer(mapped, job.uploaded, count);
+        if (!gl->glUnmapBuffer(GL_COPY_READ_BUFFER)) {
+            // Contents lost (e.g. a mode switch); the slice is retried.
+            qWarning("GpuUploadManager: staging buffer contents lost");
+            gl->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            return;
+        }
+
+        gl->glBindBuffer(GL_COPY_WRITE_BUFFER, job.buffer);
+        gl->glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, bytes);
+        staging.fence = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    } else {
+        m_fallback.resize(int(bytes));
+        job.writer(m_fallback.data(), job.uploaded, count);
+        gl->glBindBuffer(GL_COPY_WRITE_BUFFER, job.buffer);
+        gl->glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, m_fallback.constData());
+    }
+    gl->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    gl->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    job.uploaded += count;
+}
+
+void GpuUploadManager::releaseGpuResources()
+{
+    QOpenGLExtraFunctions *gl = QOpenGLContext::currentContext()->extraFunctions();
+
+    m_deletedBuffers += m_idleBuffers;
+    for (GLuint idle : m_idleBuffers) {
+        m_bufferCapacity.remove(idle);
+    }
+    m_idleBuffers.clear();
+    deleteEvictedBuffers(gl);
+
+    for (StagingBuffer &staging : m_staging) {
+        if (staging.fence) {
+            gl->glDeleteSync(staging.fence);
+        }
+        gl->glDeleteBuffers(1, &staging.buffer);
+    }
+    m_staging.clear();
+    m_nextStaging = 0;
+}
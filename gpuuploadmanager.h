@@ -0,0 +1,116 @@
+#ifndef GPUUPLOADMANAGER_H
+#define GPUUPLOADMANAGER_H
+
+#include <QOpenGLExtraFunctions>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QVector>
+#include <functional>
+
+// Moves host arrays into GPU buffers a bounded slice per frame, so loading,
+// sorting or recoloring a large cloud never stalls the UI on one huge
+// glBufferData.
+//
+// There is one manager per share group (the application shares all renderer
+// contexts, see PointCloudData), used from the GL thread with any context of
+// the group current. It keeps two pools:
+//
+// - Destination buffers, recycled across clouds. A released buffer is handed
+//   to the next request that fits it, so reloading a file of similar size
+//   reuses the same allocation instead of fragmenting GPU memory.
+// - A ring of staging buffers. Each slice is written through an
+//   unsynchronized mapping, copied into place on the GPU and fenced; a
+//   staging buffer is only reused once its fence has signaled, so writers
+//   never wait on the driver.
+//
+// Callers render whatever prefix has arrived (see the progress callback) and
+// keep requesting frames while hasPendingUploads() is true.
+class GpuUploadManager
+{
+public:
+    // Fills count elements starting at element first into dst.
+    typedef std::function<void(void *dst, int first, int count)> Writer;
+    // Called after each slice with the number of leading elements now on
+    // the GPU; the upload is complete when it reaches the element count.
+    typedef std::function<void(int uploaded)> Progress;
+
+    static GpuUploadManager *instance();
+
+    // A buffer of at least the given size, from the pool when one fits.
+    // Capacity is rounded up so moderately larger requests reuse it too.
+    GLuint acquireBuffer(qint64 bytes);
+    qint64 bufferCapacity(GLuint buffer) const { return m_bufferCapacity.value(buffer, 0); }
+    // Returns a buffer to the pool and cancels uploads into it. Needs no
+    // current context; the buffer is only deleted when the pool overflows.
+    void releaseBuffer(GLuint buffer);
+
+    // Queues count elements of elementSize bytes for buffer, starting at
+    // its beginning. The writer and progress callback run on the GL thread
+    // inside processPendingUploads() and must not call back into the
+    // manager. The writer must own (or share) the data it reads, since the
+    // upload can outlive the caller's next change.
+    // Returns a ticket for cancelUpload().
+    quint64 upload(GLuint buffer, int count, int elementSize, const Writer &writer, const Progress &progress);
+    void cancelUpload(quint64 ticket);
+
+    // Uploads as many slices as this frame's byte budget and free staging
+    // buffers allow. Returns true while uploads remain.
+    bool processPendingUploads();
+    bool hasPendingUploads() const { return !m_jobs.isEmpty(); }
+    // Moves everything pending regardless of the budget, for offline
+    // rendering that must not show clouds still filling in. Blocks until
+    // the last slice is queued.
+    void finishPendingUploads();
+
+    // Bytes uploaded per 16 ms frame; several renderers painting in one
+    // frame share it.
+    void setFrameBudget(qint64 bytes) { m_frameBudget = bytes; }
+    qint64 frameBudget() const { return m_frameBudget; }
+
+    // Deletes every pooled and staging buffer. Call with a context of the
+    // share group current, e.g. before the last renderer goes away.
+    void releaseGpuResources();
+
+private:
+    struct Job {
+        quint64 ticket;
+        GLuint buffer;
+        int count;
+        int elementSize;
+        int uploaded;
+        Writer writer;
+        Progress progress;
+    };
+
+    struct StagingBuffer {
+        GLuint buffer;
+        GLsync fence;
+    };
+
+    static const int StagingBufferCount = 8;
+    static const qint64 StagingBufferSize = 4 * 1024 * 1024;
+    static const qint64 MaxIdleBytes = qint64(512) * 1024 * 1024;
+
+    GpuUploadManager();
+
+    int acquireStagingBuffer(QOpenGLExtraFunctions *gl);
+    void uploadSlice(QOpenGLExtraFunctions *gl, Job &job, int stagingIndex);
+    void deleteEvictedBuffers(QOpenGLExtraFunctions *gl);
+
+    QVector<Job> m_jobs;
+    quint64 m_nextTicket;
+
+    QHash<GLuint, qint64> m_bufferCapacity;
+    QVector<GLuint> m_idleBuffers;
+    QVector<GLuint> m_deletedBuffers;
+
+    QVector<StagingBuffer> m_staging;
+    int m_nextStaging;
+    QVector<char> m_fallback;
+
+    qint64 m_frameBudget;
+    qint64 m_budget;
+    QElapsedTimer m_budgetTimer;
+};
+
+#endif // GPUUPLOADMANAGER_H
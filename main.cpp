@@ -1,10 +1,122 @@
+#include "batchprocessor.h"
+#include "benchmarksuite.h"
 #include "mainwindow.h"
+#include "pointclouddata.h"
+#include "pointcloudscene.h"
+#include "syntheticcloudgenerator.h"
+#include "viewportexporter.h"
+#include "viewportobject.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QFileInfo>
+#include <QScopedPointer>
 #include <QSurfaceFormat>
+#include <cmath>
+#include <limits>
+
+// Batch, generator and benchmark runs need neither a display nor a GL
+// context, so they get a QCoreApplication; the parser is not up yet when
+// it is created.
+static bool isHeadlessRun(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        // Options may also be given as --name=value.
+        const QByteArray argument(argv[i]);
+        const int equals = argument.indexOf('=');
+        const QByteArray name = equals < 0 ? argument : argument.left(equals);
+        if (name == "--batch" || name == "--generate" || name == "--benchmark") {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads a count with an optional K, M or B suffix, e.g. "250K" or "1B".
+static bool parsePointCount(const QString &text, qint64 &count)
+{
+    QString digits = text.trimmed().toUpper();
+    qint64 scale = 1;
+    if (digits.endsWith('K')) {
+        scale = 1000;
+    } else if (digits.endsWith('M')) {
+        scale = 1000000;
+    } else if (digits.endsWith('B')) {
+        scale = 1000000000;
+    }
+    if (scale > 1) {
+        digits.chop(1);
+    }
+    bool ok = false;
+    count = digits.toLongLong(&ok) * scale;
+    return ok && count > 0;
+}
+
+// Reads count comma-separated numbers.
+static bool parseNumbers(const QString &text, int count, QVector<double> &values)
+{
+    const QStringList parts = text.split(',');
+    if (parts.size() != count) {
+        return false;
+    }
+    values.clear();
+    for (const QString &part : parts) {
+        bool ok = false;
+        values.append(part.trimmed().toDouble(&ok));
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whole numbers of at least 1 that fit an int; rejects NaN too.
+static bool isCount(double value)
+{
+    return value >= 1.0 && value <= std::numeric_limits<int>::max() && value == std::floor(value);
+}
+
+// Renders the viewports saved in viewportFile over the given clouds to
+// images in outputDirectory, without opening a window. Clouds are named by
+// file name, which is how saved viewports refer to them.
+static int exportViewports(const QString &viewportFile, const QStringList &cloudFiles,
+                           const QString &outputDirectory, const QSize &imageSize)
+{
+    QSharedPointer<PointCloudScene> scene(new PointCloudScene);
+    for (const QString &filename : cloudFiles) {
+        QSharedPointer<PointCloudData> cloud(new PointCloudData);
+        const bool loaded = filename.endsWith(".ply", Qt::CaseInsensitive) ? cloud->loadPlyFile(filename)
+                                                                            : cloud->loadPtsFile(filename);
+        if (!loaded) {
+            qDebug() << "Failed to load point cloud:" << filename;
+            return 1;
+        }
+        cloud->sortSpatially();
+        scene->addCloud(cloud, QFileInfo(filename).fileName());
+    }
+
+    QList<ViewportObject*> viewports;
+    if (!ViewportObject::loadViewports(viewportFile, viewports)) {
+        return 1;
+    }
+
+    bool success;
+    {
+        ViewportExporter exporter(scene);
+        exporter.setImageSize(imageSize);
+        success = exporter.exportViewports(viewports, outputDirectory);
+    }
+    qDeleteAll(viewports);
+    return success ? 0 : 1;
+}
 
 int main(int argc, char *argv[])
 {
-    QApplication app(argc, argv);
+    // Lets every renderer draw from one shared copy of the point buffers.
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+
+    const bool headless = isHeadlessRun(argc, argv);
+    QScopedPointer<QCoreApplication> app(headless ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
 
     // Set up OpenGL format
     QSurfaceFormat format;
@@ -14,8 +126,170 @@ int main(int argc, char *argv[])
     format.setDepthBufferSize(24);
     QSurfaceFormat::setDefaultFormat(format);
 
+    // Exports need a GL context but no display; on machines without one,
+    // run with QT_QPA_PLATFORM=offscreen.
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Point cloud viewer");
+    parser.addHelpOption();
+    QCommandLineOption exportOption("export-viewports",
+                                    "Render the viewports saved in <file> to PNG images and exit.", "file");
+    QCommandLineOption outputOption("output", "Directory for exported images or converted clouds.", "directory", ".");
+    QCommandLineOption sizeOption("size", "Size of exported images.", "WIDTHxHEIGHT", "3840x2160");
+    QCommandLineOption batchOption("batch", "Filter and convert the given clouds without a window, then exit.");
+    QCommandLineOption formatOption("format", "Batch output format, ply (binary) or pts; generated files may also "
+                                    "be ply-ascii.", "format", "ply");
+    QCommandLineOption cropOption("crop", "Batch: keep the points inside a box.", "minX,minY,minZ,maxX,maxY,maxZ");
+    QCommandLineOption decimateOption("decimate", "Batch: keep this fraction of the points.", "fraction", "1");
+    QCommandLineOption sorOption("sor", "Batch: statistical outlier removal.", "neighbours,stddevs");
+    QCommandLineOption radiusOption("radius-outlier", "Batch: radius outlier removal.", "radius,neighbours");
+    QCommandLineOption jobsOption("jobs", "Batch: files processed at once.", "count",
+                                  QString::number(BatchProcessor::Options().jobs));
+    QCommandLineOption timingsOption("timings", "Batch: write per-file timings as JSON.", "file");
+    QCommandLineOption generateOption("generate", "Write a synthetic point cloud to <file> and exit.", "file");
+    QCommandLineOption shapeOption("shape", "Generated shape: plane, terrain or clutter.", "shape", "terrain");
+    QCommandLineOption pointsOption("points", "Generated or benchmarked point count, e.g. 1K, 10M, 1B.", "count",
+                                    "1M");
+    QCommandLineOption seedOption("seed", "Generator seed.", "seed", "1");
+    QCommandLineOption benchmarkOption("benchmark", "Time loading, filtering and picking synthetic clouds, then exit.");
+    QCommandLineOption repetitionsOption("repetitions", "Benchmark: timed runs per case.", "count", "5");
+    QCommandLineOption baselineOption("baseline", "Benchmark: compare against a saved baseline.", "file");
+    QCommandLineOption saveBaselineOption("save-baseline", "Benchmark: save the results as a baseline.", "file");
+    QCommandLineOption thresholdOption("threshold", "Benchmark: slowdown that fails the comparison.", "percent", "10");
+    parser.addOption(exportOption);
+    parser.addOption(outputOption);
+    parser.addOption(sizeOption);
+    parser.addOption(batchOption);
+    parser.addOption(formatOption);
+    parser.addOption(cropOption);
+    parser.addOption(decimateOption);
+    parser.addOption(sorOption);
+    parser.addOption(radiusOption);
+    parser.addOption(jobsOption);
+    parser.addOption(timingsOption);
+    parser.addOption(generateOption);
+    parser.addOption(shapeOption);
+    parser.addOption(pointsOption);
+    parser.addOption(seedOption);
+    parser.addOption(benchmarkOption);
+    parser.addOption(repetitionsOption);
+    parser.addOption(baselineOption);
+    parser.addOption(saveBaselineOption);
+    parser.addOption(thresholdOption);
+    parser.addPositionalArgument("clouds", "Point cloud files (.pts, .ply) to export from or convert.", "[clouds...]");
+    parser.process(*app);
+
+    if (parser.isSet(generateOption)) {
+        const QString filename = parser.value(generateOption);
+        SyntheticCloudGenerator::Shape shape;
+        qint64 count = 0;
+        bool ok = SyntheticCloudGenerator::parseShape(parser.value(shapeOption), shape)
+                  && parsePointCount(parser.value(pointsOption), count);
+        bool seedOk = false;
+        const quint64 seed = parser.value(seedOption).toULongLong(&seedOk);
+        ok = ok && seedOk;
+        const QString format = parser.isSet(formatOption) ? parser.value(formatOption).toLower()
+                               : filename.endsWith(".pts", Qt::CaseInsensitive) ? "pts" : "ply";
+        SyntheticCloudGenerator::Format fileFormat = SyntheticCloudGenerator::Format::BinaryPly;
+        if (format == "pts") {
+            fileFormat = SyntheticCloudGenerator::Format::Pts;
+        } else if (format == "ply-ascii") {
+            fileFormat = SyntheticCloudGenerator::Format::AsciiPly;
+        } else if (format != "ply") {
+            ok = false;
+        }
+        if (!ok) {
+            qDebug() << "Invalid generator options; see --help";
+            return 1;
+        }
+        return SyntheticCloudGenerator::writeFile(filename, shape, count, fileFormat, seed) ? 0 : 1;
+    }
+
+    if (parser.isSet(benchmarkOption)) {
+        BenchmarkSuite::Options options;
+        qint64 count = 0;
+        bool ok = parsePointCount(parser.value(pointsOption), count) && count <= 50000000;
+        options.pointCount = int(count);
+        bool repetitionsOk = false;
+        options.repetitions = parser.value(repetitionsOption).toInt(&repetitionsOk);
+        bool thresholdOk = false;
+        const double threshold = parser.value(thresholdOption).toDouble(&thresholdOk);
+        if (!ok || !repetitionsOk || options.repetitions < 1 || !thresholdOk) {
+            qDebug() << "Invalid benchmark options; see --help";
+            return 1;
+        }
+
+        BenchmarkSuite suite(options);
+        bool success = suite.run();
+        if (success && parser.isSet(saveBaselineOption)) {
+            success = suite.saveBaseline(parser.value(saveBaselineOption));
+        }
+        if (success && parser.isSet(baselineOption)) {
+            success = suite.compareWithBaseline(parser.value(baselineOption), threshold);
+        }
+        return success ? 0 : 1;
+    }
+
+    if (parser.isSet(batchOption)) {
+        BatchProcessor::Options options;
+        options.outputDirectory = parser.value(outputOption);
+        options.format = parser.value(formatOption).toLower();
+        bool ok = options.format == "ply" || options.format == "pts";
+        QVector<double> values;
+        if (ok && parser.isSet(cropOption)) {
+            ok = parseNumbers(parser.value(cropOption), 6, values);
+            if (ok) {
+                options.crop = true;
+                options.cropMin = QVector3D(float(values[0]), float(values[1]), float(values[2]));
+                options.cropMax = QVector3D(float(values[3]), float(values[4]), float(values[5]));
+            }
+        }
+        if (ok) {
+            options.decimateFraction = parser.value(decimateOption).toDouble(&ok);
+            ok = ok && options.decimateFraction > 0.0 && options.decimateFraction <= 1.0;
+        }
+        if (ok && parser.isSet(sorOption)) {
+            ok = parseNumbers(parser.value(sorOption), 2, values) && isCount(values[0]) && values[1] >= 0.0;
+            if (ok) {
+                options.sorNeighbors = int(values[0]);
+                options.sorStdDevMultiplier = values[1];
+            }
+        }
+        if (ok && parser.isSet(radiusOption)) {
+            ok = parseNumbers(parser.value(radiusOption), 2, values) && values[0] > 0.0 && isCount(values[1]);
+            if (ok) {
+                options.radius = float(values[0]);
+                options.radiusMinNeighbors = int(values[1]);
+            }
+        }
+        if (ok) {
+            options.jobs = parser.value(jobsOption).toInt(&ok);
+            ok = ok && options.jobs > 0;
+        }
+        if (!ok) {
+            qDebug() << "Invalid batch options; see --help";
+            return 1;
+        }
+
+        BatchProcessor processor(options);
+        bool success = processor.run(parser.positionalArguments());
+        if (parser.isSet(timingsOption)) {
+            success = processor.saveTimings(parser.value(timingsOption)) && success;
+        }
+        return success ? 0 : 1;
+    }
+
+    if (parser.isSet(exportOption)) {
+        const QSize imageSize = ViewportExporter::parseImageSize(parser.value(sizeOption));
+        if (imageSize.isEmpty()) {
+            qDebug() << "Invalid image size:" << parser.value(sizeOption);
+            return 1;
+        }
+        return exportViewports(parser.value(exportOption), parser.positionalArguments(),
+                               parser.value(outputOption), imageSize);
+    }
+
     MainWindow mainWindow;
     mainWindow.show();
 
-    return app.exec();
+    return app->exec();
 }
@@ -1,12 +1,29 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include <QInputDialog>
+#include <QGridLayout>
+#include <QActionGroup>
+#include <QApplication>
+#include <QFont>
+#include <QLineEdit>
+#include <QtMath>
+#include <cmath>
+#include "compressedpointstore.h"
+#include "normalestimator.h"
+#include "syntheticpointsource.h"
+#include "viewportexporter.h"
 
 static unsigned s_viewportIndex = 0;
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , m_layoutContainer(nullptr)
+    , m_syntheticSource(nullptr)
+    , m_normalEstimator(nullptr)
+    , m_colorMenu(nullptr)
+    , m_colorGroup(nullptr)
+    , m_sceneItem(nullptr)
 {
     ui->setupUi(this);
 
@@ -15,14 +32,22 @@ MainWindow::MainWindow(QWidget *parent)
     m_dbTreeWidget = ui->dbTreeWidget;
     m_dbTreeWidget->setHeaderHidden(true);
     addDockWidget(Qt::LeftDockWidgetArea, m_dbDockWidget);
+    m_sceneItem = new QTreeWidgetItem(m_dbTreeWidget);
+    m_sceneItem->setText(0, "Scene");
     setupActions();
 
     connect(m_dbTreeWidget, &QTreeWidget::itemDoubleClicked,
             this, &MainWindow::onTreeWidgetItemDoubleClicked);
+    connect(m_dbTreeWidget, &QTreeWidget::itemClicked,
+            this, &MainWindow::onTreeWidgetItemClicked);
+    connect(m_dbTreeWidget, &QTreeWidget::itemChanged,
+            this, &MainWindow::onTreeWidgetItemChanged);
 }
 
 MainWindow::~MainWindow()
 {
+    setSyntheticStreamEnabled(false);
+    cancelNormalEstimation();
     qDeleteAll(m_viewportList);
     delete ui;
 }
@@ -30,10 +55,88 @@ MainWindow::~MainWindow()
 void MainWindow::setupActions()
 {
     connect(ui->actionOpen, &QAction::triggered, this, &MainWindow::openPointCloudFile);
+    connect(ui->actionAddPointCloud, &QAction::triggered, this, &MainWindow::addPointCloudFile);
+    connect(ui->actionSaveAs, &QAction::triggered, this, &MainWindow::savePointCloudFile);
     connect(ui->actionResetView, &QAction::triggered, this, &MainWindow::resetView);
+    connect(ui->actionMultiViewportLayout, &QAction::toggled, this, &MainWindow::setMultiViewportLayout);
+    connect(ui->actionSurfaceShading, &QAction::toggled, this, &MainWindow::setSurfaceShading);
+    connect(ui->actionOrthographic, &QAction::toggled, this, &MainWindow::setOrthographic);
+    connect(ui->actionSyntheticStream, &QAction::toggled, this, &MainWindow::setSyntheticStreamEnabled);
+    connect(ui->actionSortSpatiallyOnLoad, &QAction::toggled, m_renderer, &PointCloudRenderer::setSpatialSortOnLoad);
+    connect(ui->actionCompressOnLoad, &QAction::toggled, m_renderer, &PointCloudRenderer::setCompressOnLoad);
     connect(ui->actionExit, &QAction::triggered, this, &QMainWindow::close);
     connect(ui->actionSave_Viewport_As_Object, &QAction::triggered, this, &MainWindow::doActionSaveViewportAsObject);
     connect(ui->actionSave_Viewport_with_User_defined_co_ords, &QAction::triggered, this, &MainWindow::doActionSaveViewportWithUserCoords);
+    connect(ui->actionSaveViewports, &QAction::triggered, this, &MainWindow::saveViewports);
+    connect(ui->actionLoadViewports, &QAction::triggered, this, &MainWindow::loadViewports);
+    connect(ui->actionExportViewportImages, &QAction::triggered, this, &MainWindow::exportViewportImages);
+
+    // Measure and selection tools exclude each other, but may all be off.
+    const QPair<QAction *, PointCloudRenderer::MeasureMode> measureActions[] = {
+        { ui->actionMeasureDistance, PointCloudRenderer::MeasureMode::Distance },
+        { ui->actionMeasurePolyline, PointCloudRenderer::MeasureMode::Polyline },
+        { ui->actionMeasureArea, PointCloudRenderer::MeasureMode::Area },
+        { ui->actionMeasureVolume, PointCloudRenderer::MeasureMode::Volume }
+    };
+    for (const auto &entry : measureActions) {
+        m_measureActions.append(entry.first);
+        QAction *action = entry.first;
+        const PointCloudRenderer::MeasureMode mode = entry.second;
+        connect(action, &QAction::toggled, this, [this, action, mode](bool checked) {
+            if (checked) {
+                for (QAction *other : m_measureActions + m_selectionActions) {
+                    if (other != action) {
+                        other->setChecked(false);
+                    }
+                }
+                m_renderer->setMeasureMode(mode);
+            } else if (m_renderer->measureMode() == mode) {
+                m_renderer->setMeasureMode(PointCloudRenderer::MeasureMode::None);
+            }
+        });
+    }
+    connect(ui->actionPickPoint, &QAction::toggled, m_renderer, &PointCloudRenderer::enablePickPointTool);
+    connect(ui->actionClearMeasurement, &QAction::triggered, m_renderer, &PointCloudRenderer::clearMeasurement);
+    connect(m_renderer, &PointCloudRenderer::measurementChanged, this, &MainWindow::showMeasurement);
+
+    const QPair<QAction *, PointCloudRenderer::SelectionMode> selectionActions[] = {
+        { ui->actionSelectBox, PointCloudRenderer::SelectionMode::Box },
+        { ui->actionSelectLasso, PointCloudRenderer::SelectionMode::Lasso }
+    };
+    for (const auto &entry : selectionActions) {
+        m_selectionActions.append(entry.first);
+        QAction *action = entry.first;
+        const PointCloudRenderer::SelectionMode mode = entry.second;
+        connect(action, &QAction::toggled, this, [this, action, mode](bool checked) {
+            if (checked) {
+                for (QAction *other : m_measureActions + m_selectionActions) {
+                    if (other != action) {
+                        other->setChecked(false);
+                    }
+                }
+                m_renderer->setSelectionMode(mode);
+            } else if (m_renderer->selectionMode() == mode) {
+                m_renderer->setSelectionMode(PointCloudRenderer::SelectionMode::None);
+            }
+        });
+    }
+    connect(ui->actionCropToSelection, &QAction::triggered, this, &MainWindow::cropToSelection);
+    connect(ui->actionDeleteSelection, &QAction::triggered, this, &MainWindow::deleteSelection);
+    connect(ui->actionExportSelection, &QAction::triggered, this, &MainWindow::exportSelection);
+    connect(ui->actionClearSelection, &QAction::triggered, m_renderer, &PointCloudRenderer::clearSelection);
+    connect(m_renderer, &PointCloudRenderer::selectionChanged, this, &MainWindow::showSelection);
+
+    connect(ui->actionPassThroughFilter, &QAction::triggered, this, &MainWindow::applyPassThroughFilter);
+    connect(ui->actionStatisticalOutlierFilter, &QAction::triggered, this, &MainWindow::applyStatisticalOutlierFilter);
+    connect(ui->actionRadiusOutlierFilter, &QAction::triggered, this, &MainWindow::applyRadiusOutlierFilter);
+    connect(ui->actionResetFilters, &QAction::triggered, this, &MainWindow::resetFilters);
+    connect(ui->actionCloudTransform, &QAction::triggered, this, &MainWindow::setCloudTransform);
+    connect(ui->actionRemoveCloud, &QAction::triggered, this, &MainWindow::removeCloud);
+
+    m_colorMenu = ui->menuView->addMenu("Color By");
+    m_colorGroup = new QActionGroup(this);
+    connect(m_colorGroup, &QActionGroup::triggered, this, &MainWindow::onColorActionTriggered);
+    updateColorMenu();
 
     m_openAction = ui->actionOpen;
     m_resetViewAction = ui->actionResetView;
@@ -42,10 +145,20 @@ void MainWindow::setupActions()
 }
 
 void MainWindow::openPointCloudFile()
+{
+    loadPointCloudFile(false);
+}
+
+void MainWindow::addPointCloudFile()
+{
+    loadPointCloudFile(true);
+}
+
+void MainWindow::loadPointCloudFile(bool addToScene)
 {
     QString filename = QFileDialog::getOpenFileName(
         this,
-        "Open Point Cloud File",
+        addToScene ? "Add Point Cloud File" : "Open Point Cloud File",
         QString(),
         "Point Cloud Files (*.pts *.ply);;All Files (*.*)"
         );
@@ -57,9 +170,9 @@ void MainWindow::openPointCloudFile()
     bool success = false;
 
     if (filename.endsWith(".pts", Qt::CaseInsensitive)) {
-        success = m_renderer->loadPtsFile(filename);
+        success = m_renderer->loadPtsFile(filename, addToScene);
     } else if (filename.endsWith(".ply", Qt::CaseInsensitive)) {
-        success = m_renderer->loadPlyFile(filename);
+        success = m_renderer->loadPlyFile(filename, addToScene);
     } else {
         QMessageBox::warning(this, "Unsupported Format", "The selected file format is not supported.");
         return;
@@ -68,16 +181,408 @@ void MainWindow::openPointCloudFile()
     if (!success) {
         QMessageBox::warning(this, "Load Error", "Failed to load the point cloud file.");
     } else {
+        syncLayoutRenderers(true);
+        updateColorMenu();
+        updateSceneTree();
         m_renderer->update();
+
+        QSharedPointer<const CompressedPointStore> store = m_renderer->pointCloud()->compressedStore();
+        if (store) {
+            statusBar()->showMessage(QString("Compressed %1 MB to %2 MB (%3:1)")
+                                         .arg(store->uncompressedBytes() / (1024 * 1024))
+                                         .arg(store->compressedBytes() / (1024 * 1024))
+                                         .arg(store->compressionRatio(), 0, 'f', 1), 5000);
+        }
+
+        cancelNormalEstimation();
+        if (ui->actionSurfaceShading->isChecked()) {
+            startNormalEstimation();
+        }
+    }
+}
+
+void MainWindow::showMeasurement(const QString &text)
+{
+    if (text.isEmpty()) {
+        statusBar()->clearMessage();
+    } else {
+        statusBar()->showMessage(text);
+    }
+}
+
+void MainWindow::savePointCloudFile()
+{
+    if (m_renderer->getPointCount() == 0) {
+        return;
+    }
+
+    QString filename = QFileDialog::getSaveFileName(
+        this,
+        "Save Point Cloud File",
+        QString(),
+        "PLY Files (*.ply);;PTS Files (*.pts)"
+        );
+
+    if (filename.isEmpty()) {
+        return;
+    }
+
+    const bool success = filename.endsWith(".pts", Qt::CaseInsensitive)
+                             ? m_renderer->savePtsFile(filename)
+                             : m_renderer->savePlyFile(filename);
+    if (!success) {
+        QMessageBox::warning(this, "Save Error", "Failed to save the point cloud file.");
+    }
+}
+
+void MainWindow::cropToSelection()
+{
+    if (m_renderer->cropToSelection()) {
+        syncLayoutRenderers();
+        statusBar()->showMessage(QString("Kept %1 points").arg(m_renderer->getPointCount()), 5000);
+    }
+}
+
+void MainWindow::deleteSelection()
+{
+    if (m_renderer->deleteSelection()) {
+        syncLayoutRenderers();
+        statusBar()->showMessage(QString("%1 points left").arg(m_renderer->getPointCount()), 5000);
+    }
+}
+
+void MainWindow::exportSelection()
+{
+    if (m_renderer->selection().isEmpty()) {
+        return;
+    }
+
+    QString filename = QFileDialog::getSaveFileName(
+        this,
+        "Export Selection",
+        QString(),
+        "PLY Files (*.ply);;PTS Files (*.pts)"
+        );
+
+    if (filename.isEmpty()) {
+        return;
+    }
+
+    if (!m_renderer->exportSelection(filename)) {
+        QMessageBox::warning(this, "Export Error", "Failed to export the selected points.");
+    } else {
+        statusBar()->showMessage(QString("Exported %1 points").arg(m_renderer->selection().selectedCount()), 5000);
+    }
+}
+
+void MainWindow::showSelection(int selectedCount)
+{
+    if (selectedCount == 0) {
+        statusBar()->clearMessage();
+    } else {
+        statusBar()->showMessage(QString("%1 points selected").arg(selectedCount));
     }
 }
 
+void MainWindow::applyPassThroughFilter()
+{
+    if (m_renderer->getPointCount() == 0) {
+        return;
+    }
+
+    bool ok;
+    const QStringList axes = { "X", "Y", "Z" };
+    const QString axisName = QInputDialog::getItem(this, "Pass-Through Filter", "Axis:", axes, 2, false, &ok);
+    if (!ok) return;
+    const int axis = axes.indexOf(axisName);
+
+    const QSharedPointer<PointCloudData> cloud = m_renderer->pointCloud();
+    const double low = cloud->getBoundingBoxMin()[axis];
+    const double high = cloud->getBoundingBoxMax()[axis];
+    const double minValue = QInputDialog::getDouble(this, "Pass-Through Filter", "Keep from:", low, -1e9, 1e9, 3, &ok);
+    if (!ok) return;
+    const double maxValue = QInputDialog::getDouble(this, "Pass-Through Filter", "Keep up to:", high, -1e9, 1e9, 3, &ok);
+    if (!ok) return;
+
+    const int previousCount = m_renderer->getPointCount();
+    if (m_renderer->applyPassThroughFilter(axis, float(minValue), float(maxValue))) {
+        filterApplied(previousCount);
+    }
+}
+
+void MainWindow::applyStatisticalOutlierFilter()
+{
+    if (m_renderer->getPointCount() == 0) {
+        return;
+    }
+
+    bool ok;
+    const int neighbors = QInputDialog::getInt(this, "Statistical Outlier Removal", "Neighbours:", 16, 1, 256, 1, &ok);
+    if (!ok) return;
+    const double multiplier = QInputDialog::getDouble(this, "Statistical Outlier Removal",
+                                                      "Standard deviation multiplier:", 1.0, 0.0, 100.0, 2, &ok);
+    if (!ok) return;
+
+    const int previousCount = m_renderer->getPointCount();
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    const bool success = m_renderer->applyStatisticalOutlierFilter(neighbors, multiplier);
+    QApplication::restoreOverrideCursor();
+    if (success) {
+        filterApplied(previousCount);
+    }
+}
+
+void MainWindow::applyRadiusOutlierFilter()
+{
+    if (m_renderer->getPointCount() == 0) {
+        return;
+    }
+
+    // Default radius: a fraction of the diagonal, about a point spacing
+    // for a scan of a few million points.
+    const double defaultRadius = m_renderer->getBoundingBoxSize().length() * 0.002;
+    bool ok;
+    const double radius = QInputDialog::getDouble(this, "Radius Outlier Removal", "Radius:", defaultRadius, 0.0,
+                                                  1e9, 4, &ok);
+    if (!ok) return;
+    const int minNeighbors = QInputDialog::getInt(this, "Radius Outlier Removal", "Minimum neighbours:", 4, 1, 1000,
+                                                  1, &ok);
+    if (!ok) return;
+
+    const int previousCount = m_renderer->getPointCount();
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    const bool success = m_renderer->applyRadiusOutlierFilter(float(radius), minNeighbors);
+    QApplication::restoreOverrideCursor();
+    if (success) {
+        filterApplied(previousCount);
+    }
+}
+
+void MainWindow::resetFilters()
+{
+    if (!m_renderer->hasFilters()) {
+        return;
+    }
+    m_renderer->resetFilters();
+    syncLayoutRenderers(true);
+    statusBar()->showMessage(QString("Restored %1 points").arg(m_renderer->getPointCount()), 5000);
+}
+
+void MainWindow::filterApplied(int previousCount)
+{
+    syncLayoutRenderers(true);
+    statusBar()->showMessage(QString("Removed %1 points, %2 left")
+                                 .arg(previousCount - m_renderer->getPointCount())
+                                 .arg(m_renderer->getPointCount()), 5000);
+}
+
 void MainWindow::resetView()
 {
     m_renderer->resetView();
     m_renderer->update();
 }
 
+void MainWindow::setMultiViewportLayout(bool enabled)
+{
+    if (enabled == (m_layoutContainer != nullptr)) {
+        return;
+    }
+
+    if (enabled) {
+        // Top/Front/Side companions around the main (custom) renderer. They
+        // share the main renderer's cloud, so no data is duplicated.
+        m_layoutContainer = new QWidget(ui->centralwidget);
+        QGridLayout* grid = new QGridLayout(m_layoutContainer);
+        grid->setContentsMargins(0, 0, 0, 0);
+        grid->setSpacing(2);
+
+        const PointCloudRenderer::ViewOrientation orientations[] = {
+            PointCloudRenderer::ViewOrientation::Top,
+            PointCloudRenderer::ViewOrientation::Front,
+            PointCloudRenderer::ViewOrientation::Side
+        };
+        for (int i = 0; i < 3; ++i) {
+            PointCloudRenderer* renderer = new PointCloudRenderer(m_layoutContainer);
+            renderer->setViewOrientation(orientations[i]);
+            grid->addWidget(renderer, i / 2, i % 2);
+            m_layoutRenderers.append(renderer);
+        }
+
+        ui->verticalLayout->removeWidget(m_renderer);
+        grid->addWidget(m_renderer, 1, 1);
+        ui->verticalLayout->addWidget(m_layoutContainer);
+
+        syncLayoutRenderers();
+    } else {
+        m_layoutContainer->layout()->removeWidget(m_renderer);
+        m_renderer->setParent(ui->centralwidget);
+        ui->verticalLayout->addWidget(m_renderer);
+
+        m_layoutRenderers.clear();
+        delete m_layoutContainer;
+        m_layoutContainer = nullptr;
+    }
+}
+
+void MainWindow::syncLayoutRenderers(bool reframe)
+{
+    for (PointCloudRenderer* renderer : m_layoutRenderers) {
+        renderer->setScene(m_renderer->scene());
+        renderer->setActiveCloud(m_renderer->activeCloud());
+        if (reframe) {
+            renderer->frameScene();
+        }
+        renderer->setPointStream(m_renderer->pointStream());
+        renderer->setSurfaceShading(m_renderer->isSurfaceShadingEnabled());
+        renderer->setPerspectiveMode(m_renderer->isPerspectiveModeEnabled());
+        renderer->setColorMode(m_renderer->getColorMode());
+        renderer->update();
+    }
+}
+
+// Color modes keep their enum value as action data; scalar attributes are
+// stored after them, offset by ScalarActionBase.
+static const int ScalarActionBase = 1000;
+
+void MainWindow::updateColorMenu()
+{
+    m_colorMenu->clear();
+    qDeleteAll(m_colorGroup->actions());
+
+    auto addColorAction = [this](const QString &text, int data, bool checked) {
+        QAction *action = m_colorMenu->addAction(text);
+        action->setCheckable(true);
+        action->setChecked(checked);
+        action->setData(data);
+        m_colorGroup->addAction(action);
+    };
+
+    const PointCloudRenderer::ColorMode mode = m_renderer->getColorMode();
+    const QPair<QString, PointCloudRenderer::ColorMode> modes[] = {
+        qMakePair(QString("Original"), PointCloudRenderer::ColorMode::Original),
+        qMakePair(QString("Single Color"), PointCloudRenderer::ColorMode::Unicolor),
+        qMakePair(QString("X Gradient"), PointCloudRenderer::ColorMode::XGradient),
+        qMakePair(QString("Y Gradient"), PointCloudRenderer::ColorMode::YGradient),
+        qMakePair(QString("Z Gradient"), PointCloudRenderer::ColorMode::ZGradient)
+    };
+    for (const auto &entry : modes) {
+        addColorAction(entry.first, int(entry.second), mode == entry.second);
+    }
+
+    QSharedPointer<PointCloudData> cloud = m_renderer->pointCloud();
+    if (cloud && cloud->scalarAttributeCount() > 0) {
+        m_colorMenu->addSeparator();
+        for (int i = 0; i < cloud->scalarAttributeCount(); ++i) {
+            addColorAction(cloud->scalarAttribute(i).name(), ScalarActionBase + i,
+                           mode == PointCloudRenderer::ColorMode::Scalar && cloud->displayedScalar() == i);
+        }
+    }
+}
+
+void MainWindow::onColorActionTriggered(QAction *action)
+{
+    const int data = action->data().toInt();
+    if (data >= ScalarActionBase) {
+        // First selection of a binary attribute decodes it from the file.
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        const bool loaded = m_renderer->setScalarColoring(data - ScalarActionBase);
+        QApplication::restoreOverrideCursor();
+        if (!loaded) {
+            QMessageBox::warning(this, "Attribute Error", "Failed to read the attribute from the point cloud file.");
+            updateColorMenu();
+            return;
+        }
+    } else {
+        m_renderer->setColorMode(PointCloudRenderer::ColorMode(data));
+    }
+    syncLayoutRenderers();
+}
+
+void MainWindow::setSurfaceShading(bool enabled)
+{
+    m_renderer->setSurfaceShading(enabled);
+    syncLayoutRenderers();
+
+    if (enabled) {
+        startNormalEstimation();
+    }
+}
+
+void MainWindow::setOrthographic(bool enabled)
+{
+    m_renderer->setPerspectiveMode(!enabled);
+    syncLayoutRenderers();
+}
+
+void MainWindow::startNormalEstimation()
+{
+    QSharedPointer<PointCloudData> cloud = m_renderer->pointCloud();
+    if (!cloud || cloud->isEmpty() || cloud->hasNormals() || m_normalEstimator) {
+        return;
+    }
+
+    m_normalEstimator = new NormalEstimator(cloud, 16, this);
+    connect(m_normalEstimator, &NormalEstimator::progressChanged, this, [this](int percent) {
+        statusBar()->showMessage(QString("Estimating normals... %1%").arg(percent));
+    });
+    connect(m_normalEstimator, &QThread::finished, this, &MainWindow::onNormalEstimationFinished);
+    statusBar()->showMessage("Estimating normals...");
+    m_normalEstimator->start(QThread::LowPriority);
+}
+
+void MainWindow::cancelNormalEstimation()
+{
+    if (!m_normalEstimator) {
+        return;
+    }
+
+    disconnect(m_normalEstimator, nullptr, this, nullptr);
+    m_normalEstimator->cancel();
+    delete m_normalEstimator;
+    m_normalEstimator = nullptr;
+    statusBar()->clearMessage();
+}
+
+void MainWindow::onNormalEstimationFinished()
+{
+    NormalEstimator *estimator = m_normalEstimator;
+    m_normalEstimator = nullptr;
+    if (!estimator) {
+        return;
+    }
+
+    if (estimator->apply()) {
+        statusBar()->showMessage("Normals estimated", 3000);
+        m_renderer->update();
+        for (PointCloudRenderer* renderer : m_layoutRenderers) {
+            renderer->update();
+        }
+    } else {
+        statusBar()->clearMessage();
+    }
+    estimator->deleteLater();
+}
+
+void MainWindow::setSyntheticStreamEnabled(bool enabled)
+{
+    if (enabled == (m_syntheticSource != nullptr)) {
+        return;
+    }
+
+    if (enabled) {
+        QSharedPointer<PointStream> stream(new PointStream);
+        m_renderer->setPointStream(stream);
+        m_syntheticSource = new SyntheticPointSource(stream, 300000, 20, this);
+        m_syntheticSource->start();
+    } else {
+        m_syntheticSource->stop();
+        delete m_syntheticSource;
+        m_syntheticSource = nullptr;
+        m_renderer->setPointStream(QSharedPointer<PointStream>());
+    }
+    syncLayoutRenderers();
+}
+
 void MainWindow::doActionSaveViewportAsObject()
 {
     if (!m_renderer || m_renderer->getPointCount() == 0) {
@@ -143,6 +648,77 @@ void MainWindow::doActionSaveViewportWithUserCoords()
     addToDB(viewportObject);
 }
 
+void MainWindow::saveViewports()
+{
+    if (m_viewportList.isEmpty()) {
+        QMessageBox::warning(this, "Warning", "No viewports saved.");
+        return;
+    }
+
+    QString filename = QFileDialog::getSaveFileName(this, "Save Viewports", QString(), "Viewport Files (*.json)");
+    if (filename.isEmpty()) {
+        return;
+    }
+    if (!ViewportObject::saveViewports(filename, m_viewportList)) {
+        QMessageBox::warning(this, "Save Error", "Failed to save the viewports.");
+    }
+}
+
+void MainWindow::loadViewports()
+{
+    QString filename = QFileDialog::getOpenFileName(this, "Load Viewports", QString(), "Viewport Files (*.json)");
+    if (filename.isEmpty()) {
+        return;
+    }
+
+    QList<ViewportObject*> viewports;
+    if (!ViewportObject::loadViewports(filename, viewports)) {
+        QMessageBox::warning(this, "Load Error", "Failed to load the viewports.");
+        return;
+    }
+    for (ViewportObject *viewport : viewports) {
+        viewport->setDisplay(m_renderer);
+        addToDB(viewport);
+    }
+}
+
+void MainWindow::exportViewportImages()
+{
+    if (m_viewportList.isEmpty() || m_renderer->getPointCount() == 0) {
+        QMessageBox::warning(this, "Warning", "No viewports or point cloud to export.");
+        return;
+    }
+
+    bool ok;
+    const QString sizeText = QInputDialog::getText(this, "Export Viewport Images", "Image size (width x height):",
+                                                   QLineEdit::Normal, "3840x2160", &ok);
+    if (!ok) {
+        return;
+    }
+    const QSize imageSize = ViewportExporter::parseImageSize(sizeText);
+    if (imageSize.isEmpty()) {
+        QMessageBox::warning(this, "Export Error", "Invalid image size.");
+        return;
+    }
+
+    const QString directory = QFileDialog::getExistingDirectory(this, "Export Viewport Images");
+    if (directory.isEmpty()) {
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    ViewportExporter exporter(m_renderer->scene());
+    exporter.setImageSize(imageSize);
+    const bool success = exporter.exportViewports(m_viewportList, directory);
+    QApplication::restoreOverrideCursor();
+
+    m_renderer->update();
+    syncLayoutRenderers();
+    if (!success) {
+        QMessageBox::warning(this, "Export Error", "Failed to export some of the viewport images.");
+    }
+}
+
 void MainWindow::addToDB(ViewportObject* viewport)
 {
     m_viewportList.append(viewport);
@@ -164,7 +740,107 @@ void MainWindow::onTreeWidgetItemDoubleClicked(QTreeWidgetItem* item, int column
     if (itemData.isValid()) {
         ViewportObject* viewport = itemData.value<ViewportObject*>();
         if (viewport) {
+            // Also restores the clouds' transforms, visibility and colors.
             viewport->applyViewport(m_renderer);
+            ui->actionOrthographic->setChecked(!m_renderer->isPerspectiveModeEnabled());
+            syncLayoutRenderers();
+            updateColorMenu();
+            updateSceneTree();
+        }
+    }
+}
+
+// Cloud items hold their scene index under Qt::UserRole + 1; the active
+// cloud is shown in bold.
+void MainWindow::updateSceneTree()
+{
+    const QSignalBlocker blocker(m_dbTreeWidget);
+    qDeleteAll(m_sceneItem->takeChildren());
+
+    const QSharedPointer<PointCloudScene> scene = m_renderer->scene();
+    for (int i = 0; i < scene->cloudCount(); ++i) {
+        const PointCloudScene::Node &node = scene->node(i);
+        QTreeWidgetItem* item = new QTreeWidgetItem(m_sceneItem);
+        item->setText(0, node.name.isEmpty() ? QString("Cloud %1").arg(i + 1) : node.name);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(0, node.visible ? Qt::Checked : Qt::Unchecked);
+        item->setData(0, Qt::UserRole + 1, i);
+        if (i == m_renderer->activeCloud()) {
+            QFont font = item->font(0);
+            font.setBold(true);
+            item->setFont(0, font);
         }
     }
+    m_dbTreeWidget->expandAll();
+}
+
+void MainWindow::onTreeWidgetItemClicked(QTreeWidgetItem* item, int column)
+{
+    if (item->parent() != m_sceneItem) {
+        return;
+    }
+    const int index = item->data(0, Qt::UserRole + 1).toInt();
+    if (index == m_renderer->activeCloud()) {
+        return;
+    }
+    m_renderer->setActiveCloud(index);
+    syncLayoutRenderers();
+    updateColorMenu();
+    updateSceneTree();
+
+    if (ui->actionSurfaceShading->isChecked()) {
+        startNormalEstimation();
+    }
+}
+
+void MainWindow::onTreeWidgetItemChanged(QTreeWidgetItem* item, int column)
+{
+    if (item->parent() != m_sceneItem) {
+        return;
+    }
+    m_renderer->setCloudVisible(item->data(0, Qt::UserRole + 1).toInt(), item->checkState(0) == Qt::Checked);
+    syncLayoutRenderers();
+}
+
+// Places the active cloud by an offset and a rotation about the vertical
+// (Y) axis, the usual registration of scans from levelled stations.
+void MainWindow::setCloudTransform()
+{
+    const int index = m_renderer->activeCloud();
+    if (index < 0) {
+        return;
+    }
+
+    const QMatrix4x4 current = m_renderer->scene()->node(index).transform;
+    const QVector3D offset = current.column(3).toVector3D();
+    const double currentAngle = qRadiansToDegrees(std::atan2(current(0, 2), current(0, 0)));
+
+    bool ok;
+    const double x = QInputDialog::getDouble(this, "Cloud Transform", "Offset X:", offset.x(), -1e9, 1e9, 3, &ok);
+    if (!ok) return;
+    const double y = QInputDialog::getDouble(this, "Cloud Transform", "Offset Y:", offset.y(), -1e9, 1e9, 3, &ok);
+    if (!ok) return;
+    const double z = QInputDialog::getDouble(this, "Cloud Transform", "Offset Z:", offset.z(), -1e9, 1e9, 3, &ok);
+    if (!ok) return;
+    const double angle = QInputDialog::getDouble(this, "Cloud Transform", "Rotation about Y (degrees):",
+                                                 currentAngle, -360.0, 360.0, 3, &ok);
+    if (!ok) return;
+
+    QMatrix4x4 transform;
+    transform.translate(float(x), float(y), float(z));
+    transform.rotate(float(angle), 0.0f, 1.0f, 0.0f);
+    m_renderer->setCloudTransform(index, transform);
+    syncLayoutRenderers();
+}
+
+void MainWindow::removeCloud()
+{
+    const int index = m_renderer->activeCloud();
+    if (index < 0) {
+        return;
+    }
+    m_renderer->removeCloud(index);
+    syncLayoutRenderers();
+    updateColorMenu();
+    updateSceneTree();
 }
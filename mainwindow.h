@@ -13,6 +13,9 @@
 #include "pointcloudrenderer.h"
 #include "viewportobject.h"
 
+class NormalEstimator;
+class SyntheticPointSource;
+
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
 QT_END_NAMESPACE
@@ -27,15 +30,48 @@ public:
 
 private slots:
     void openPointCloudFile();
+    void addPointCloudFile();
     void resetView();
+    void setMultiViewportLayout(bool enabled);
+    void setSyntheticStreamEnabled(bool enabled);
+    void setSurfaceShading(bool enabled);
+    void setOrthographic(bool enabled);
+    void onNormalEstimationFinished();
+    void onColorActionTriggered(QAction *action);
     void doActionSaveViewportAsObject();
     void doActionSaveViewportWithUserCoords();
+    void saveViewports();
+    void loadViewports();
+    void exportViewportImages();
     void onTreeWidgetItemDoubleClicked(QTreeWidgetItem* item, int column);
+    void onTreeWidgetItemClicked(QTreeWidgetItem* item, int column);
+    void onTreeWidgetItemChanged(QTreeWidgetItem* item, int column);
+    void setCloudTransform();
+    void removeCloud();
+    void showMeasurement(const QString &text);
+    void savePointCloudFile();
+    void cropToSelection();
+    void deleteSelection();
+    void exportSelection();
+    void showSelection(int selectedCount);
+    void applyPassThroughFilter();
+    void applyStatisticalOutlierFilter();
+    void applyRadiusOutlierFilter();
+    void resetFilters();
 
 private:
     void setupActions();
     void addToDB(ViewportObject* viewport);
     void updateTreeWidget(ViewportObject* viewport);
+    void updateSceneTree();
+    void loadPointCloudFile(bool addToScene);
+    // Companions share the main renderer's scene; reframe them after the
+    // scene's extent changed.
+    void syncLayoutRenderers(bool reframe = false);
+    void startNormalEstimation();
+    void cancelNormalEstimation();
+    void updateColorMenu();
+    void filterApplied(int previousCount);
 
     Ui::MainWindow *ui;
     PointCloudRenderer *m_renderer;
@@ -44,7 +80,17 @@ private:
     QAction *m_saveViewportAction;
     QAction *m_saveViewportWithCoordsAction;
     QList<ViewportObject*> m_viewportList;
+    QWidget *m_layoutContainer;
+    QList<PointCloudRenderer*> m_layoutRenderers;
+    SyntheticPointSource *m_syntheticSource;
+    NormalEstimator *m_normalEstimator;
+    QMenu *m_colorMenu;
+    QActionGroup *m_colorGroup;
+    QList<QAction*> m_measureActions;
+    QList<QAction*> m_selectionActions;
     QTreeWidget *m_dbTreeWidget;
+    // Parent of one checkable item per cloud in the scene.
+    QTreeWidgetItem *m_sceneItem;
     QDockWidget *m_dbDockWidget;
 };
 
@@ -0,0 +1,424 @@
+#include "measurementengine.h"
+#include "allocationcounter.h"
+#include "compressedpointstore.h"
+#include "normalestimator.h"
+#include "parallelfor.h"
+#include <QElapsedTimer>
+#include <QPointF>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+// Two unit vectors spanning the plane with the given unit normal.
+static void planeBasis(const QVector3D &normal, QVector3D &u, QVector3D &v)
+{
+    const QVector3D helper = std::abs(normal.x()) < 0.9f ? QVector3D(1.0f, 0.0f, 0.0f) : QVector3D(0.0f, 1.0f, 0.0f);
+    u = QVector3D::crossProduct(normal, helper).normalized();
+    v = QVector3D::crossProduct(normal, u);
+}
+
+// Maps a float to an unsigned integer of the same order, so the highest
+// point of a cell can be kept with an integer compare-and-swap. No finite
+// height maps to 0, which marks an empty cell.
+static quint32 heightKey(float height)
+{
+    quint32 bits;
+    std::memcpy(&bits, &height, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+static float keyHeight(quint32 key)
+{
+    const quint32 bits = (key & 0x80000000u) ? (key & 0x7fffffffu) : ~key;
+    float height;
+    std::memcpy(&height, &bits, sizeof(height));
+    return height;
+}
+
+// Slab test; entry distance clamped to the ray's origin.
+static bool rayEntersBox(const QVector3D &origin, const QVector3D &direction, const QVector3D &boundsMin,
+                         const QVector3D &boundsMax, float &entry)
+{
+    float tEnter = 0.0f;
+    float tExit = std::numeric_limits<float>::max();
+    for (int axis = 0; axis < 3; ++axis) {
+        if (direction[axis] == 0.0f) {
+            if (origin[axis] < boundsMin[axis] || origin[axis] > boundsMax[axis]) {
+                return false;
+            }
+            continue;
+        }
+        const float inverse = 1.0f / direction[axis];
+        float t0 = (boundsMin[axis] - origin[axis]) * inverse;
+        float t1 = (boundsMax[axis] - origin[axis]) * inverse;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        tEnter = std::max(tEnter, t0);
+        tExit = std::min(tExit, t1);
+        if (tEnter > tExit) {
+            return false;
+        }
+    }
+    entry = tEnter;
+    return true;
+}
+
+// Even-odd rule.
+static bool polygonContains(const QVector<QPointF> &polygon, double x, double y)
+{
+    bool inside = false;
+    for (int i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+        const QPointF &a = polygon[i];
+        const QPointF &b = polygon[j];
+        if ((a.y() > y) != (b.y() > y) && x < (b.x() - a.x()) * (y - a.y()) / (b.y() - a.y()) + a.x()) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+MeasurementEngine::MeasurementEngine()
+{
+}
+
+bool MeasurementEngine::pickAlongRay(const QVector3D &origin, const QVector3D &direction, float radius,
+                                     QVector3D &point) const
+{
+    COUNT_ALLOCATIONS("pickAlongRay");
+
+    if (!m_cloud || m_cloud->isEmpty() || direction.isNull()) {
+        return false;
+    }
+
+    // Chunks the ray passes within radius of, by where it enters them.
+    const QVector3D ray = direction.normalized();
+    const QVector3D margin(radius, radius, radius);
+    const QVector<PointCloudData::Chunk> &chunks = m_cloud->chunks();
+    QVector<QPair<float, int>> candidates;
+    candidates.reserve(chunks.size());
+    for (int i = 0; i < chunks.size(); ++i) {
+        float entry = 0.0f;
+        if (rayEntersBox(origin, ray, chunks[i].boundsMin - margin, chunks[i].boundsMax + margin, entry)) {
+            candidates.append(qMakePair(entry, i));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    QSharedPointer<const CompressedPointStore> store = m_cloud->compressedStore();
+    const QVector<Vertex> vertices = store ? QVector<Vertex>() : m_cloud->vertices();
+    const float radiusSquared = radius * radius;
+
+    // Workers take the chunks in entry order, so the search starts its
+    // threads once however many chunks it visits; a chunk entered beyond
+    // the best hit so far cannot hold a nearer one, which ends it.
+    const int workers = parallelBlockCount(candidates.size(), 1);
+    QVector<float> workerDistance(workers, std::numeric_limits<float>::max());
+    QVector<QVector3D> workerPoint(workers);
+    std::atomic<int> nextCandidate(0);
+    std::atomic<float> bestDistance(std::numeric_limits<float>::max());
+    parallelForBlocks(workers, workers, [&](int worker, qint64, qint64) {
+        QVector<Vertex> decoded;
+        for (int k = nextCandidate++; k < candidates.size(); k = nextCandidate++) {
+            float nearest = bestDistance.load(std::memory_order_relaxed);
+            if (candidates[k].first > nearest) {
+                break;
+            }
+
+            const int c = candidates[k].second;
+            const PointCloudData::Chunk &chunk = chunks[c];
+            const Vertex *points = nullptr;
+            if (store) {
+                decoded.resize(chunk.count);
+                store->decodeChunk(c, decoded.data());
+                points = decoded.constData();
+            } else {
+                points = vertices.constData() + chunk.first;
+            }
+
+            bool hit = false;
+            for (int i = 0; i < chunk.count; ++i) {
+                const QVector3D offset = points[i].position - origin;
+                const float along = QVector3D::dotProduct(offset, ray);
+                if (along < 0.0f || along >= nearest) {
+                    continue;
+                }
+                if (offset.lengthSquared() - along * along <= radiusSquared) {
+                    nearest = along;
+                    workerPoint[worker] = points[i].position;
+                    hit = true;
+                }
+            }
+            if (hit) {
+                workerDistance[worker] = nearest;
+                float best = bestDistance.load(std::memory_order_relaxed);
+                while (nearest < best && !bestDistance.compare_exchange_weak(best, nearest, std::memory_order_relaxed)) {
+                }
+            }
+        }
+    });
+
+    bool found = false;
+    float best = std::numeric_limits<float>::max();
+    for (int w = 0; w < workers; ++w) {
+        if (workerDistance[w] < best) {
+            best = workerDistance[w];
+            point = workerPoint[w];
+            found = true;
+        }
+    }
+    return found;
+}
+
+double MeasurementEngine::polylineLength(const QVector<QVector3D> &points, bool closed)
+{
+    double length = 0.0;
+    for (int i = 1; i < points.size(); ++i) {
+        length += (points[i] - points[i - 1]).length();
+    }
+    if (closed && points.size() > 2) {
+        length += (points.first() - points.last()).length();
+    }
+    return length;
+}
+
+double MeasurementEngine::projectedArea(const QVector<QVector3D> &polygon, const QVector3D &normal)
+{
+    if (polygon.size() < 3) {
+        return 0.0;
+    }
+
+    QVector3D planeNormal = normal.normalized();
+    if (planeNormal.isNull()) {
+        QVector3D origin;
+        fitPlane(polygon, origin, planeNormal);
+    }
+    QVector3D u, v;
+    planeBasis(planeNormal, u, v);
+
+    // Shoelace formula in plane coordinates relative to the first vertex.
+    double twiceArea = 0.0;
+    const QVector3D &base = polygon.first();
+    for (int i = 0; i < polygon.size(); ++i) {
+        const QVector3D p = polygon[i] - base;
+        const QVector3D q = polygon[(i + 1) % polygon.size()] - base;
+        twiceArea += double(QVector3D::dotProduct(p, u)) * QVector3D::dotProduct(q, v)
+                     - double(QVector3D::dotProduct(q, u)) * QVector3D::dotProduct(p, v);
+    }
+    return std::abs(twiceArea) * 0.5;
+}
+
+bool MeasurementEngine::fitPlane(const QVector<QVector3D> &points, QVector3D &origin, QVector3D &normal)
+{
+    if (points.size() < 3) {
+        return false;
+    }
+
+    double cx = 0.0, cy = 0.0, cz = 0.0;
+    for (const QVector3D &p : points) {
+        cx += p.x();
+        cy += p.y();
+        cz += p.z();
+    }
+    cx /= points.size();
+    cy /= points.size();
+    cz /= points.size();
+
+    double c00 = 0.0, c01 = 0.0, c02 = 0.0, c11 = 0.0, c12 = 0.0, c22 = 0.0;
+    for (const QVector3D &p : points) {
+        const double x = p.x() - cx, y = p.y() - cy, z = p.z() - cz;
+        c00 += x * x;
+        c01 += x * y;
+        c02 += x * z;
+        c11 += y * y;
+        c12 += y * z;
+        c22 += z * z;
+    }
+
+    origin = QVector3D(float(cx), float(cy), float(cz));
+    normal = NormalEstimator::smallestEigenvector(c00, c01, c02, c11, c12, c22).normalized();
+    return true;
+}
+
+MeasurementEngine::VolumeResult MeasurementEngine::volume(const QVector3D &planeOrigin, const QVector3D &planeNormal,
+                                                          const QVector<QVector3D> &boundary, float cellSize) const
+{
+    VolumeResult result = { 0.0, 0.0, 0.0, 0.0f, 0, 0 };
+    if (!m_cloud || m_cloud->isEmpty() || planeNormal.isNull()) {
+        return result;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QVector3D n = planeNormal.normalized();
+    QVector3D u, v;
+    planeBasis(n, u, v);
+
+    // Region in plane coordinates: the boundary's, or the whole cloud's.
+    float aMin = std::numeric_limits<float>::max(), aMax = -aMin;
+    float bMin = aMin, bMax = -aMin;
+    const auto extend = [&](const QVector3D &p) {
+        const QVector3D d = p - planeOrigin;
+        const float a = QVector3D::dotProduct(d, u);
+        const float b = QVector3D::dotProduct(d, v);
+        aMin = std::min(aMin, a);
+        aMax = std::max(aMax, a);
+        bMin = std::min(bMin, b);
+        bMax = std::max(bMax, b);
+        return QPointF(a, b);
+    };
+
+    QVector<QPointF> polygon;
+    if (boundary.size() >= 3) {
+        for (const QVector3D &p : boundary) {
+            polygon.append(extend(p));
+        }
+    } else {
+        const QVector3D lo = m_cloud->getBoundingBoxMin();
+        const QVector3D hi = m_cloud->getBoundingBoxMax();
+        for (int corner = 0; corner < 8; ++corner) {
+            extend(QVector3D(corner & 1 ? hi.x() : lo.x(), corner & 2 ? hi.y() : lo.y(), corner & 4 ? hi.z() : lo.z()));
+        }
+    }
+    if (aMax <= aMin || bMax <= bMin) {
+        return result;
+    }
+
+    float cell = cellSize > 0.0f ? cellSize : std::max(aMax - aMin, bMax - bMin) / VolumeGridResolution;
+    cell = std::max(cell, float(std::sqrt(double(aMax - aMin) * double(bMax - bMin) / double(MaxVolumeCells))));
+    const int columns = std::max(1, int(std::ceil((aMax - aMin) / cell)));
+    const int rows = std::max(1, int(std::ceil((bMax - bMin) / cell)));
+    const qint64 cellCount = qint64(columns) * rows;
+    const float inverseCell = 1.0f / cell;
+
+    // Highest point per cell. Cells are shared between workers, so the
+    // maximum is an atomic compare-and-swap on heightKey()s; each cell sees
+    // only a handful of successful updates.
+    std::unique_ptr<std::atomic<quint32>[]> top(new std::atomic<quint32>[cellCount]);
+    std::atomic<quint32> *topData = top.get();
+    parallelFor(cellCount, [topData](qint64 begin, qint64 end) {
+        for (qint64 i = begin; i < end; ++i) {
+            topData[i].store(0, std::memory_order_relaxed);
+        }
+    });
+
+    const QVector<PointCloudData::Chunk> &chunks = m_cloud->chunks();
+    QSharedPointer<const CompressedPointStore> store = m_cloud->compressedStore();
+    const QVector<Vertex> vertices = store ? QVector<Vertex>() : m_cloud->vertices();
+    const PointCloudData::Chunk *chunkData = chunks.constData();
+    parallelFor(chunks.size(), [&](qint64 begin, qint64 end) {
+        QVector<Vertex> decoded;
+        for (qint64 c = begin; c < end; ++c) {
+            const PointCloudData::Chunk &chunk = chunkData[c];
+
+            // Skip chunks whose bounds project outside the region.
+            float lowA = std::numeric_limits<float>::max(), highA = -lowA;
+            float lowB = lowA, highB = -lowA;
+            for (int corner = 0; corner < 8; ++corner) {
+                const QVector3D d = QVector3D(corner & 1 ? chunk.boundsMax.x() : chunk.boundsMin.x(),
+                                              corner & 2 ? chunk.boundsMax.y() : chunk.boundsMin.y(),
+                                              corner & 4 ? chunk.boundsMax.z() : chunk.boundsMin.z()) - planeOrigin;
+                const float a = QVector3D::dotProduct(d, u);
+                const float b = QVector3D::dotProduct(d, v);
+                lowA = std::min(lowA, a);
+                highA = std::max(highA, a);
+                lowB = std::min(lowB, b);
+                highB = std::max(highB, b);
+            }
+            if (highA < aMin || lowA > aMax || highB < bMin || lowB > bMax) {
+                continue;
+            }
+
+            const Vertex *points = nullptr;
+            if (store) {
+                decoded.resize(chunk.count);
+                store->decodeChunk(int(c), decoded.data());
+                points = decoded.constData();
+            } else {
+                points = vertices.constData() + chunk.first;
+            }
+
+            for (int i = 0; i < chunk.count; ++i) {
+                const QVector3D d = points[i].position - planeOrigin;
+                const float a = (QVector3D::dotProduct(d, u) - aMin) * inverseCell;
+                const float b = (QVector3D::dotProduct(d, v) - bMin) * inverseCell;
+                if (a < 0.0f || b < 0.0f || a >= columns || b >= rows) {
+                    continue;
+                }
+                std::atomic<quint32> &slot = topData[qint64(b) * columns + qint64(a)];
+                const quint32 key = heightKey(QVector3D::dotProduct(d, n));
+                quint32 current = slot.load(std::memory_order_relaxed);
+                while (key > current && !slot.compare_exchange_weak(current, key, std::memory_order_relaxed)) {
+                }
+            }
+        }
+    }, 1);
+
+    // Integrate row blocks in parallel. Cells inside the region with no
+    // point take the mean of their occupied neighbours when at least half
+    // of them are occupied, which closes scan gaps without inventing
+    // material past the pile's edge.
+    const float cellArea = cell * cell;
+    const int blockCount = parallelBlockCount(rows, 16);
+    QVector<VolumeResult> partial(blockCount, result);
+    VolumeResult *partialData = partial.data();
+    parallelForBlocks(rows, blockCount, [&](int block, qint64 begin, qint64 end) {
+        VolumeResult &sum = partialData[block];
+        for (qint64 row = begin; row < end; ++row) {
+            const double b = bMin + (row + 0.5) * cell;
+            for (int column = 0; column < columns; ++column) {
+                if (!polygon.isEmpty() && !polygonContains(polygon, aMin + (column + 0.5) * cell, b)) {
+                    continue;
+                }
+
+                float height = 0.0f;
+                const quint32 key = topData[row * columns + column].load(std::memory_order_relaxed);
+                if (key != 0) {
+                    height = keyHeight(key);
+                } else {
+                    int neighbors = 0;
+                    double total = 0.0;
+                    for (qint64 y = std::max<qint64>(0, row - 1); y <= std::min<qint64>(rows - 1, row + 1); ++y) {
+                        for (int x = std::max(0, column - 1); x <= std::min(columns - 1, column + 1); ++x) {
+                            const quint32 neighbor = topData[y * columns + x].load(std::memory_order_relaxed);
+                            if (neighbor != 0) {
+                                total += keyHeight(neighbor);
+                                ++neighbors;
+                            }
+                        }
+                    }
+                    if (neighbors < 4) {
+                        continue;
+                    }
+                    height = float(total / neighbors);
+                    ++sum.filledCells;
+                }
+
+                ++sum.cells;
+                if (height > 0.0f) {
+                    sum.cut += double(height) * cellArea;
+                } else {
+                    sum.fill -= double(height) * cellArea;
+                }
+            }
+        }
+    });
+
+    for (const VolumeResult &sum : partial) {
+        result.cut += sum.cut;
+        result.fill += sum.fill;
+        result.cells += sum.cells;
+        result.filledCells += sum.filledCells;
+    }
+    result.area = double(result.cells) * cellArea;
+    result.cellSize = cell;
+
+    qDebug() << "Measured volume over" << result.cells << "cells of" << cell << "(" << result.filledCells
+             << "interpolated ) in" << timer.elapsed() << "ms";
+    return result;
+}
@@ -0,0 +1,66 @@
+#ifndef MEASUREMENTENGINE_H
+#define MEASUREMENTENGINE_H
+
+#include <QVector3D>
+#include <QVector>
+#include <QSharedPointer>
+#include "pointclouddata.h"
+
+// Distances, areas and volumes over a point cloud.
+//
+// Picking snaps to actual cloud points. The chunk bounds serve as the
+// spatial index: only chunks the ray passes through are scanned, nearest
+// first, and scanning stops once the next chunk starts beyond the best hit.
+// Volumes rasterize the cloud into a 2.5D height grid over a base plane on
+// all cores, again skipping chunks outside the region, so even very large
+// clouds measure in well under a second.
+class MeasurementEngine
+{
+public:
+    struct VolumeResult {
+        // Material above the base plane, and missing material below it.
+        double cut;
+        double fill;
+        // Plan area covered by measured cells.
+        double area;
+        float cellSize;
+        int cells;
+        // Empty cells interpolated from their neighbours.
+        int filledCells;
+    };
+
+    MeasurementEngine();
+
+    void setPointCloud(const QSharedPointer<PointCloudData> &cloud) { m_cloud = cloud; }
+    QSharedPointer<PointCloudData> pointCloud() const { return m_cloud; }
+
+    // First cloud point within radius of the ray; direction need not be
+    // normalized. Returns false if the ray misses the cloud.
+    bool pickAlongRay(const QVector3D &origin, const QVector3D &direction, float radius, QVector3D &point) const;
+
+    static double polylineLength(const QVector<QVector3D> &points, bool closed = false);
+    // Area of the polygon projected onto the plane with the given normal;
+    // a null normal uses the polygon's best-fit plane.
+    static double projectedArea(const QVector<QVector3D> &polygon, const QVector3D &normal = QVector3D());
+    // Least-squares plane through the points. Returns false for fewer than
+    // three points.
+    static bool fitPlane(const QVector<QVector3D> &points, QVector3D &origin, QVector3D &normal);
+
+    // Cut and fill between the cloud's top surface and the plane through
+    // planeOrigin, on the side planeNormal points to, inside boundary
+    // (projected onto the plane; the whole cloud when it has fewer than
+    // three points). A cellSize of 0 splits the region into about 1024
+    // cells a side.
+    VolumeResult volume(const QVector3D &planeOrigin, const QVector3D &planeNormal,
+                        const QVector<QVector3D> &boundary, float cellSize = 0.0f) const;
+
+private:
+    typedef PointCloudData::Vertex Vertex;
+
+    static const int VolumeGridResolution = 1024;
+    static const qint64 MaxVolumeCells = qint64(16) * 1024 * 1024;
+
+    QSharedPointer<PointCloudData> m_cloud;
+};
+
+#endif // MEASUREMENTENGINE_H
@@ -0,0 +1,125 @@
+#include "mortoncode.h"
+#include "parallelfor.h"
+#include <algorithm>
+#include <vector>
+
+// Inserts two zero bits between each of the low 21 bits of v.
+static quint64 spreadBits(quint32 v)
+{
+    quint64 x = v & 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+static quint32 quantize(float value, float minValue, float maxValue)
+{
+    const float maxCell = float((1u << MortonCode::BitsPerAxis) - 1);
+    const float extent = maxValue - minValue;
+    if (!(extent > 0.0f)) {
+        return 0;
+    }
+    const float cell = (value - minValue) / extent * maxCell;
+    return quint32(std::min(std::max(cell, 0.0f), maxCell));
+}
+
+quint64 MortonCode::encode(quint32 x, quint32 y, quint32 z)
+{
+    return spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+}
+
+quint64 MortonCode::encode(const QVector3D &position, const QVector3D &boundsMin, const QVector3D &boundsMax)
+{
+    return encode(quantize(position.x(), boundsMin.x(), boundsMax.x()),
+                  quantize(position.y(), boundsMin.y(), boundsMax.y()),
+                  quantize(position.z(), boundsMin.z(), boundsMax.z()));
+}
+
+quint64 MortonCode::nodeBegin(quint64 code, int level)
+{
+    const int shift = 3 * (Levels - level);
+    return shift >= 64 ? 0 : (code >> shift) << shift;
+}
+
+quint64 MortonCode::nodeEnd(quint64 code, int level)
+{
+    const int shift = 3 * (Levels - level);
+    return nodeBegin(code, level) + (quint64(1) << shift);
+}
+
+void MortonCode::radixSort(QVector<quint64> &codes, QVector<quint32> &indices)
+{
+    const qint64 size = codes.size();
+    if (size < 2) {
+        return;
+    }
+
+    const int DigitBits = 11;
+    const int Buckets = 1 << DigitBits;
+    const int blocks = parallelBlockCount(size, 1 << 16);
+
+    QVector<quint64> codeScratch(static_cast<int>(size));
+    QVector<quint32> indexScratch(static_cast<int>(size));
+    quint64 *srcCodes = codes.data();
+    quint32 *srcIndices = indices.data();
+    quint64 *dstCodes = codeScratch.data();
+    quint32 *dstIndices = indexScratch.data();
+
+    // One histogram per block; after the prefix pass each entry becomes the
+    // block's write cursor for that digit.
+    std::vector<qint64> histograms(size_t(blocks) * Buckets);
+
+    for (int shift = 0; shift < 3 * Levels; shift += DigitBits) {
+        std::fill(histograms.begin(), histograms.end(), 0);
+
+        parallelForBlocks(size, blocks, [&](int block, qint64 begin, qint64 end) {
+            qint64 *histogram = &histograms[size_t(block) * Buckets];
+            for (qint64 i = begin; i < end; ++i) {
+                ++histogram[(srcCodes[i] >> shift) & (Buckets - 1)];
+            }
+        });
+
+        bool trivialPass = false;
+        qint64 offset = 0;
+        for (int digit = 0; digit < Buckets && !trivialPass; ++digit) {
+            qint64 total = 0;
+            for (int block = 0; block < blocks; ++block) {
+                total += histograms[size_t(block) * Buckets + digit];
+            }
+            trivialPass = total == size;
+        }
+        if (trivialPass) {
+            continue;
+        }
+
+        for (int digit = 0; digit < Buckets; ++digit) {
+            for (int block = 0; block < blocks; ++block) {
+                qint64 &entry = histograms[size_t(block) * Buckets + digit];
+                const qint64 count = entry;
+                entry = offset;
+                offset += count;
+            }
+        }
+
+        parallelForBlocks(size, blocks, [&](int block, qint64 begin, qint64 end) {
+            qint64 *cursor = &histograms[size_t(block) * Buckets];
+            for (qint64 i = begin; i < end; ++i) {
+                const quint64 code = srcCodes[i];
+                const qint64 dst = cursor[(code >> shift) & (Buckets - 1)]++;
+                dstCodes[dst] = code;
+                dstIndices[dst] = srcIndices[i];
+            }
+        });
+
+        std::swap(srcCodes, dstCodes);
+        std::swap(srcIndices, dstIndices);
+    }
+
+    if (srcCodes != codes.data()) {
+        codes.swap(codeScratch);
+        indices.swap(indexScratch);
+    }
+}
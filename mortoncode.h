@@ -0,0 +1,31 @@
+#ifndef MORTONCODE_H
+#define MORTONCODE_H
+
+#include <QVector3D>
+#include <QVector>
+
+// 63-bit Morton (Z-order) codes: 21 bits per axis, interleaved z/y/x from the
+// most significant bit down. Points sorted by code are grouped by octree
+// node at every level, so any node is a contiguous run of the sorted array.
+class MortonCode
+{
+public:
+    static constexpr int BitsPerAxis = 21;
+    static constexpr int Levels = BitsPerAxis;
+
+    static quint64 encode(quint32 x, quint32 y, quint32 z);
+
+    // Quantizes a position inside [boundsMin, boundsMax] onto the 2^21 grid.
+    static quint64 encode(const QVector3D &position, const QVector3D &boundsMin, const QVector3D &boundsMax);
+
+    // First code past the octree node at the given level containing code.
+    static quint64 nodeEnd(quint64 code, int level);
+    static quint64 nodeBegin(quint64 code, int level);
+
+    // Sorts codes ascending and applies the same permutation to indices with
+    // a parallel, stable LSD radix sort (11-bit digits, 6 passes; passes in
+    // which every code has the same digit are skipped).
+    static void radixSort(QVector<quint64> &codes, QVector<quint32> &indices);
+};
+
+#endif // MORTONCODE_H
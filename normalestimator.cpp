@@ -0,0 +1,170 @@
+#include "normalestimator.h"
+#include "spatialindex.h"
+#include "parallelfor.h"
+#include <QElapsedTimer>
+#include <QDebug>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+
+NormalEstimator::NormalEstimator(const QSharedPointer<PointCloudData> &cloud, int neighbors, QObject *parent)
+    : QThread(parent),
+    m_cloud(cloud),
+    m_vertices(cloud->vertices()),
+    m_revision(cloud->revision()),
+    m_neighbors(std::max(3, neighbors)),
+    m_complete(false)
+{
+}
+
+NormalEstimator::~NormalEstimator()
+{
+    cancel();
+}
+
+void NormalEstimator::cancel()
+{
+    requestInterruption();
+    wait();
+}
+
+bool NormalEstimator::apply()
+{
+    if (!m_complete || m_cloud->revision() != m_revision) {
+        return false;
+    }
+    m_cloud->setNormals(m_normals);
+    return true;
+}
+
+// Eigenvector of the smallest eigenvalue of the symmetric matrix
+// [a00 a01 a02; a01 a11 a12; a02 a12 a22], with the eigenvalue in closed
+// form (Smith 1961).
+QVector3D NormalEstimator::smallestEigenvector(double a00, double a01, double a02, double a11, double a12, double a22)
+{
+    const double offDiagonal = a01 * a01 + a02 * a02 + a12 * a12;
+    if (offDiagonal <= 0.0) {
+        if (a00 <= a11 && a00 <= a22) return QVector3D(1.0f, 0.0f, 0.0f);
+        if (a11 <= a22) return QVector3D(0.0f, 1.0f, 0.0f);
+        return QVector3D(0.0f, 0.0f, 1.0f);
+    }
+
+    const double q = (a00 + a11 + a22) / 3.0;
+    const double b00 = a00 - q, b11 = a11 - q, b22 = a22 - q;
+    const double p = std::sqrt((b00 * b00 + b11 * b11 + b22 * b22 + 2.0 * offDiagonal) / 6.0);
+    const double det = b00 * (b11 * b22 - a12 * a12) - a01 * (a01 * b22 - a12 * a02) + a02 * (a01 * a12 - b11 * a02);
+    const double r = std::clamp(det / (2.0 * p * p * p), -1.0, 1.0);
+    const double phi = std::acos(r) / 3.0;
+    const double lambda = q + 2.0 * p * std::cos(phi + 2.0 * M_PI / 3.0);
+
+    // The eigenvector is orthogonal to the rows of A - lambda * I; take the
+    // best conditioned cross product of two rows.
+    const double rows[3][3] = {
+        { a00 - lambda, a01, a02 },
+        { a01, a11 - lambda, a12 },
+        { a02, a12, a22 - lambda }
+    };
+    double best[3] = { 0.0, 0.0, 0.0 };
+    double bestLength = 0.0;
+    for (int i = 0; i < 3; ++i) {
+        const double *u = rows[i];
+        const double *v = rows[(i + 1) % 3];
+        const double c[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+        const double length = c[0] * c[0] + c[1] * c[1] + c[2] * c[2];
+        if (length > bestLength) {
+            bestLength = length;
+            std::copy(c, c + 3, best);
+        }
+    }
+
+    if (bestLength <= 0.0) {
+        // Rank one: points on a line, any direction across it will do.
+        const double *u = rows[0];
+        if (u[0] == 0.0 && u[1] == 0.0 && u[2] == 0.0) {
+            u = rows[1][0] != 0.0 || rows[1][1] != 0.0 || rows[1][2] != 0.0 ? rows[1] : rows[2];
+        }
+        const QVector3D row(static_cast<float>(u[0]), static_cast<float>(u[1]), static_cast<float>(u[2]));
+        if (row.isNull()) {
+            return QVector3D();
+        }
+        const QVector3D axis = std::abs(row.x()) < std::abs(row.y()) ? QVector3D(1.0f, 0.0f, 0.0f)
+                                                                     : QVector3D(0.0f, 1.0f, 0.0f);
+        return QVector3D::crossProduct(row, axis).normalized();
+    }
+
+    const double scale = 1.0 / std::sqrt(bestLength);
+    return QVector3D(float(best[0] * scale), float(best[1] * scale), float(best[2] * scale));
+}
+
+void NormalEstimator::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const int count = m_vertices.size();
+    SpatialIndex index;
+    index.build(m_vertices);
+    if (count == 0 || isInterruptionRequested()) {
+        return;
+    }
+
+    m_normals.resize(count);
+    const PointCloudData::Vertex *vertices = m_vertices.constData();
+    QVector3D *normals = m_normals.data();
+    const int k = m_neighbors;
+
+    // One chunk per core per step keeps cancellation and progress responsive
+    // without starving the workers.
+    const int step = PointCloudData::ChunkSize * std::max(1, QThread::idealThreadCount());
+    for (int first = 0; first < count; first += step) {
+        const int last = std::min(count, first + step);
+
+        parallelFor(last - first, [&](qint64 begin, qint64 end) {
+            QVector<QPair<float, int>> neighbors;
+            neighbors.reserve(k);
+            for (qint64 i = first + begin; i < first + end; ++i) {
+                const QVector3D &origin = vertices[i].position;
+                index.kNearest(origin, k, neighbors);
+
+                // Centred on the query point so large coordinates keep
+                // their precision.
+                double mean[3] = { 0.0, 0.0, 0.0 };
+                for (const QPair<float, int> &neighbor : neighbors) {
+                    const QVector3D d = vertices[neighbor.second].position - origin;
+                    mean[0] += d.x();
+                    mean[1] += d.y();
+                    mean[2] += d.z();
+                }
+                const double n = double(neighbors.size());
+                mean[0] /= n;
+                mean[1] /= n;
+                mean[2] /= n;
+
+                double c00 = 0.0, c01 = 0.0, c02 = 0.0, c11 = 0.0, c12 = 0.0, c22 = 0.0;
+                for (const QPair<float, int> &neighbor : neighbors) {
+                    const QVector3D d = vertices[neighbor.second].position - origin;
+                    const double x = d.x() - mean[0];
+                    const double y = d.y() - mean[1];
+                    const double z = d.z() - mean[2];
+                    c00 += x * x;
+                    c01 += x * y;
+                    c02 += x * z;
+                    c11 += y * y;
+                    c12 += y * z;
+                    c22 += z * z;
+                }
+
+                normals[i] = neighbors.size() < 3 ? QVector3D() : smallestEigenvector(c00, c01, c02, c11, c12, c22);
+            }
+        }, 1024);
+
+        if (isInterruptionRequested()) {
+            qDebug() << "Normal estimation cancelled after" << last << "of" << count << "points";
+            return;
+        }
+        emit progressChanged(int(qint64(last) * 100 / count));
+    }
+
+    m_complete = true;
+    qDebug() << "Estimated" << count << "normals in" << timer.elapsed() << "ms";
+}
@@ -0,0 +1,57 @@
+#ifndef NORMALESTIMATOR_H
+#define NORMALESTIMATOR_H
+
+#include <QThread>
+#include <QSharedPointer>
+#include <QVector3D>
+#include <QVector>
+#include "pointclouddata.h"
+
+// Background per-point normal estimation: each normal is the direction of
+// least variance (PCA) of the point's k nearest neighbours. Works on a
+// snapshot of the cloud taken at construction, in blocks of points spread
+// over all cores; progressChanged() is emitted after each block and
+// cancel() takes effect at the next block boundary.
+//
+// The normals' sign is arbitrary; shading treats them as two-sided.
+class NormalEstimator : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit NormalEstimator(const QSharedPointer<PointCloudData> &cloud, int neighbors = 16,
+                             QObject *parent = nullptr);
+    ~NormalEstimator();
+
+    // Requests interruption and joins the thread.
+    void cancel();
+
+    QSharedPointer<PointCloudData> cloud() const { return m_cloud; }
+
+    // True once run() finished without being cancelled.
+    bool isComplete() const { return m_complete; }
+
+    // Copies the result into the cloud unless the cloud changed since the
+    // snapshot was taken. Call from the thread owning the cloud.
+    bool apply();
+
+    // Unit eigenvector of the smallest eigenvalue of the symmetric matrix
+    // [a00 a01 a02; a01 a11 a12; a02 a12 a22]: the normal of a covariance.
+    static QVector3D smallestEigenvector(double a00, double a01, double a02, double a11, double a12, double a22);
+
+signals:
+    void progressChanged(int percent);
+
+protected:
+    void run() override;
+
+private:
+    QSharedPointer<PointCloudData> m_cloud;
+    QVector<PointCloudData::Vertex> m_vertices;
+    quint64 m_revision;
+    int m_neighbors;
+    QVector<QVector3D> m_normals;
+    bool m_complete;
+};
+
+#endif // NORMALESTIMATOR_H
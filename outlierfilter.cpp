@@ -0,0 +1,213 @@
+#include "outlierfilter.h"
+#include "allocationcounter.h"
+#include "arena.h"
+#include "compressedpointstore.h"
+#include "parallelfor.h"
+#include "spatialindex.h"
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+// Neighbourhood queries run in blocks of this many tree positions, handed
+// out dynamically: dense regions cost more per query than sparse ones.
+static const int QueryBlock = 4096;
+
+bool OutlierFilter::passThroughMask(const PointCloudData &cloud, int axis, float minValue, float maxValue,
+                                    QVector<quint8> &keep)
+{
+    COUNT_ALLOCATIONS("passThroughMask");
+
+    if (axis < 0 || axis > 2) {
+        qDebug() << "Invalid pass-through axis" << axis;
+        return false;
+    }
+
+    keep = QVector<quint8>(cloud.pointCount(), 0);
+    quint8 *flags = keep.data();
+    const QVector<PointCloudData::Chunk> &chunks = cloud.chunks();
+    QSharedPointer<const CompressedPointStore> store = cloud.compressedStore();
+    const QVector<PointCloudData::Vertex> vertices = store ? QVector<PointCloudData::Vertex>() : cloud.vertices();
+
+    parallelFor(chunks.size(), [&](qint64 begin, qint64 end) {
+        Arena &arena = Arena::scratch();
+        const Arena::Scope scope(arena);
+        PointCloudData::Vertex *decoded = store ? arena.allocateArray<PointCloudData::Vertex>(PointCloudData::ChunkSize)
+                                                : nullptr;
+
+        for (qint64 c = begin; c < end; ++c) {
+            const PointCloudData::Chunk &chunk = chunks[int(c)];
+            quint8 *chunkFlags = flags + chunk.first;
+            if (chunk.boundsMin[axis] >= minValue && chunk.boundsMax[axis] <= maxValue) {
+                std::memset(chunkFlags, 1, size_t(chunk.count));
+                continue;
+            }
+            if (chunk.boundsMax[axis] < minValue || chunk.boundsMin[axis] > maxValue) {
+                continue;
+            }
+
+            const PointCloudData::Vertex *points = vertices.constData() + chunk.first;
+            if (store) {
+                store->decodeChunk(int(c), decoded);
+                points = decoded;
+            }
+            for (int i = 0; i < chunk.count; ++i) {
+                const float value = points[i].position[axis];
+                chunkFlags[i] = value >= minValue && value <= maxValue ? 1 : 0;
+            }
+        }
+    }, 1);
+    return true;
+}
+
+bool OutlierFilter::decimationMask(const PointCloudData &cloud, double fraction, QVector<quint8> &keep)
+{
+    COUNT_ALLOCATIONS("decimationMask");
+
+    if (!(fraction > 0.0 && fraction <= 1.0)) {
+        qDebug() << "Invalid decimation fraction" << fraction;
+        return false;
+    }
+
+    keep = QVector<quint8>(cloud.pointCount(), 0);
+    quint8 *flags = keep.data();
+    if (cloud.isSpatiallySorted()) {
+        for (const PointCloudData::Chunk &chunk : cloud.chunks()) {
+            const int kept = std::min(chunk.count, int(std::ceil(chunk.count * fraction)));
+            std::memset(flags + chunk.first, 1, size_t(kept));
+        }
+        return true;
+    }
+
+    double carry = 0.0;
+    for (int i = 0; i < keep.size(); ++i) {
+        carry += fraction;
+        if (carry >= 1.0) {
+            flags[i] = 1;
+            carry -= 1.0;
+        }
+    }
+    return true;
+}
+
+bool OutlierFilter::statisticalMask(const PointCloudData &cloud, int k, double stdDevMultiplier,
+                                    QVector<quint8> &keep)
+{
+    COUNT_ALLOCATIONS("statisticalMask");
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QVector<PointCloudData::Vertex> vertices = cloud.vertices();
+    const int count = vertices.size();
+    if (count == 0 || k < 1) {
+        keep = QVector<quint8>(count, 1);
+        return true;
+    }
+
+    SpatialIndex index;
+    index.build(vertices);
+    const qint64 buildTime = timer.elapsed();
+
+    // Mean distance of every point to its k nearest neighbours, itself
+    // excluded (it is the first of the k + 1 found).
+    QVector<float> meanDistances(count);
+    float *means = meanDistances.data();
+    const PointCloudData::Vertex *vertexData = vertices.constData();
+    std::atomic<int> nextBlock(0);
+    parallelFor(parallelBlockCount(count, QueryBlock), [&](qint64, qint64) {
+        QVector<QPair<float, int>> neighbors;
+        neighbors.reserve(k + 1);
+        for (int first = nextBlock++ * QueryBlock; first < count; first = nextBlock++ * QueryBlock) {
+            const int last = std::min(count, first + QueryBlock);
+            for (int t = first; t < last; ++t) {
+                const int v = index.treeOrderIndex(t);
+                index.kNearest(vertexData[v].position, k + 1, neighbors);
+                double sum = 0.0;
+                for (int n = 1; n < neighbors.size(); ++n) {
+                    sum += std::sqrt(double(neighbors[n].first));
+                }
+                means[v] = neighbors.size() > 1 ? float(sum / (neighbors.size() - 1)) : 0.0f;
+            }
+        }
+    }, 1);
+
+    // Mean and standard deviation, from per-block partial sums.
+    const int blocks = parallelBlockCount(count);
+    QVector<double> partialSums(2 * blocks, 0.0);
+    double *partials = partialSums.data();
+    parallelForBlocks(count, blocks, [means, partials](int block, qint64 begin, qint64 end) {
+        double sum = 0.0;
+        double sumSquares = 0.0;
+        for (qint64 i = begin; i < end; ++i) {
+            sum += means[i];
+            sumSquares += double(means[i]) * means[i];
+        }
+        partials[2 * block] = sum;
+        partials[2 * block + 1] = sumSquares;
+    });
+    double sum = 0.0;
+    double sumSquares = 0.0;
+    for (int block = 0; block < blocks; ++block) {
+        sum += partials[2 * block];
+        sumSquares += partials[2 * block + 1];
+    }
+    const double mean = sum / count;
+    const double variance = std::max(0.0, sumSquares / count - mean * mean);
+    const float threshold = float(mean + stdDevMultiplier * std::sqrt(variance));
+
+    keep = QVector<quint8>(count);
+    quint8 *flags = keep.data();
+    parallelFor(count, [means, flags, threshold](qint64 begin, qint64 end) {
+        for (qint64 i = begin; i < end; ++i) {
+            flags[i] = means[i] <= threshold ? 1 : 0;
+        }
+    });
+
+    qDebug() << "Statistical outlier pass over" << count << "points in" << timer.elapsed() << "ms (index"
+             << buildTime << "ms), mean neighbour distance" << mean << "threshold" << threshold;
+    return true;
+}
+
+bool OutlierFilter::radiusMask(const PointCloudData &cloud, float radius, int minNeighbors, QVector<quint8> &keep)
+{
+    COUNT_ALLOCATIONS("radiusMask");
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QVector<PointCloudData::Vertex> vertices = cloud.vertices();
+    const int count = vertices.size();
+    if (count == 0 || minNeighbors < 1) {
+        keep = QVector<quint8>(count, 1);
+        return true;
+    }
+    if (radius <= 0.0f) {
+        qDebug() << "Invalid outlier search radius" << radius;
+        return false;
+    }
+
+    SpatialIndex index;
+    index.build(vertices);
+
+    // The point itself is within the radius too, hence the + 1.
+    keep = QVector<quint8>(count);
+    quint8 *flags = keep.data();
+    const PointCloudData::Vertex *vertexData = vertices.constData();
+    const int limit = minNeighbors + 1;
+    std::atomic<int> nextBlock(0);
+    parallelFor(parallelBlockCount(count, QueryBlock), [&](qint64, qint64) {
+        for (int first = nextBlock++ * QueryBlock; first < count; first = nextBlock++ * QueryBlock) {
+            const int last = std::min(count, first + QueryBlock);
+            for (int t = first; t < last; ++t) {
+                const int v = index.treeOrderIndex(t);
+                flags[v] = index.countWithin(vertexData[v].position, radius, limit) >= limit ? 1 : 0;
+            }
+        }
+    }, 1);
+
+    qDebug() << "Radius outlier pass over" << count << "points in" << timer.elapsed() << "ms";
+    return true;
+}
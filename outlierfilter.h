@@ -0,0 +1,39 @@
+#ifndef OUTLIERFILTER_H
+#define OUTLIERFILTER_H
+
+#include <QVector>
+#include "pointclouddata.h"
+
+// Point filters for cleaning up scans. Each produces a keep mask, one byte
+// per vertex in the cloud's current order, for
+// PointCloudData::filterVertices(); masks of several filters combine with
+// a bytewise AND.
+//
+// The neighbourhood filters query a SpatialIndex built over the cloud, from
+// all cores, walking the tree's order so consecutive queries touch the
+// same nodes. Stray returns ("flying pixels") sit far from any surface and
+// fail both.
+class OutlierFilter
+{
+public:
+    // Keeps points with axis coordinate (0 x, 1 y, 2 z) in [minValue,
+    // maxValue]. Chunks entirely on one side are decided from their bounds.
+    static bool passThroughMask(const PointCloudData &cloud, int axis, float minValue, float maxValue,
+                                QVector<quint8> &keep);
+
+    // Keeps about fraction (in (0, 1]) of the points, evenly spread: the
+    // leading part of every chunk of a spatially sorted cloud, which is an
+    // even subsample of the chunk, or every 1/fraction-th point otherwise.
+    static bool decimationMask(const PointCloudData &cloud, double fraction, QVector<quint8> &keep);
+
+    // Statistical outlier removal: keeps points whose mean distance to
+    // their k nearest neighbours is at most the cloud-wide mean of that
+    // distance plus stdDevMultiplier standard deviations.
+    static bool statisticalMask(const PointCloudData &cloud, int k, double stdDevMultiplier,
+                                QVector<quint8> &keep);
+
+    // Keeps points with at least minNeighbors other points within radius.
+    static bool radiusMask(const PointCloudData &cloud, float radius, int minNeighbors, QVector<quint8> &keep);
+};
+
+#endif // OUTLIERFILTER_H
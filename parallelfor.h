@@ -0,0 +1,98 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <QThread>
+#include "allocationcounter.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// The calling thread's cap on parallelThreadCount(), 0 for none.
+inline int &parallelThreadLimit()
+{
+    static thread_local int limit = 0;
+    return limit;
+}
+
+// Threads the loops below may use from the calling thread: one per
+// hardware thread, unless a ParallelThreadLimit lowers it.
+inline int parallelThreadCount()
+{
+    const int threads = std::max(1, QThread::idealThreadCount());
+    const int limit = parallelThreadLimit();
+    return limit > 0 ? std::min(threads, limit) : threads;
+}
+
+// Caps parallelThreadCount() on the calling thread, and in the loops it
+// starts, while alive. For callers that already run several loops side by
+// side, so they share the cores instead of each claiming all of them.
+class ParallelThreadLimit
+{
+public:
+    explicit ParallelThreadLimit(int threads)
+        : m_previous(parallelThreadLimit())
+    {
+        parallelThreadLimit() = std::max(1, threads);
+    }
+    ~ParallelThreadLimit() { parallelThreadLimit() = m_previous; }
+
+private:
+    int m_previous;
+};
+
+// Number of blocks parallelFor() splits a range of the given size into: one
+// per available thread, but never blocks smaller than minBlockSize.
+inline int parallelBlockCount(qint64 size, qint64 minBlockSize = 16384)
+{
+    const qint64 byThreads = parallelThreadCount();
+    const qint64 bySize = std::max<qint64>(1, size / std::max<qint64>(1, minBlockSize));
+    return int(std::min(byThreads, bySize));
+}
+
+// Runs body(block, begin, end) for blockCount contiguous, equally sized
+// blocks of [0, size). Block b always covers the same range for the same
+// arguments, which multi-pass algorithms (histogram, then scatter) rely on.
+// The calling thread runs the last block itself; the workers inherit its
+// ParallelThreadLimit and AllocationScope.
+template <typename Body>
+void parallelForBlocks(qint64 size, int blockCount, Body body)
+{
+    if (size <= 0) {
+        return;
+    }
+    if (blockCount <= 1) {
+        body(0, qint64(0), size);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(blockCount - 1);
+    const int limit = parallelThreadLimit();
+    std::atomic<quint64> *allocationSink = AllocationCounter::sink();
+    for (int block = 0; block < blockCount; ++block) {
+        const qint64 begin = size * block / blockCount;
+        const qint64 end = size * (block + 1) / blockCount;
+        if (block == blockCount - 1) {
+            body(block, begin, end);
+        } else {
+            workers.emplace_back([&body, block, begin, end, limit, allocationSink]() {
+                parallelThreadLimit() = limit;
+                AllocationCounter::setSink(allocationSink);
+                body(block, begin, end);
+            });
+        }
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+// Convenience form for independent per-element work.
+template <typename Body>
+void parallelFor(qint64 size, Body body, qint64 minBlockSize = 16384)
+{
+    parallelForBlocks(size, parallelBlockCount(size, minBlockSize),
+                      [&body](int, qint64 begin, qint64 end) { body(begin, end); });
+}
+
+#endif // PARALLELFOR_H
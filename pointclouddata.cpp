@@ -0,0 +1,1327 @@
+#include "pointclouddata.h"
+#include "allocationcounter.h"
+#include "arena.h"
+#include "compressedpointstore.h"
+#include "mortoncode.h"
+#include "parallelfor.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QtEndian>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <limits>
+
+PointCloudData::PointCloudData()
+    : m_displayedScalar(-1),
+    m_spatiallySorted(false),
+    m_boundingBoxMin(0.0f, 0.0f, 0.0f),
+    m_boundingBoxMax(0.0f, 0.0f, 0.0f),
+    m_gpuRevision(0),
+    m_revision(0),
+    m_vertexRevision(0),
+    m_normalRevision(0),
+    m_scalarRevision(0)
+{
+}
+
+PointCloudData::~PointCloudData()
+{
+    // Pending uploads reference this object; the buffers themselves go back
+    // to the pool for the next cloud.
+    releaseGpuResources();
+}
+
+QVector<PointCloudData::Vertex> PointCloudData::vertices() const
+{
+    if (!m_compressed) {
+        return m_vertices;
+    }
+
+    QVector<Vertex> decoded(m_compressed->pointCount());
+    m_compressed->decodeAll(decoded.data());
+    return decoded;
+}
+
+int PointCloudData::pointCount() const
+{
+    return m_compressed ? m_compressed->pointCount() : int(m_vertices.size());
+}
+
+void PointCloudData::setVertices(const QVector<Vertex> &vertices)
+{
+    m_vertices = vertices;
+    m_compressed.reset();
+    m_normals.clear();
+    m_scalarAttributes.clear();
+    m_displayedScalar = -1;
+    m_sourceIndices.clear();
+    m_spatiallySorted = false;
+    updateBoundingBox();
+    buildChunks();
+    verticesChanged();
+}
+
+void PointCloudData::setNormals(const QVector<QVector3D> &normals)
+{
+    // Compressed clouds hold no host vertices; count the store's points.
+    if (!normals.isEmpty() && normals.size() != pointCount()) {
+        qDebug() << "Ignoring" << normals.size() << "normals for" << pointCount() << "points";
+        return;
+    }
+
+    m_normals = normals;
+    ++m_revision;
+    m_normalRevision = m_revision;
+}
+
+bool PointCloudData::setDisplayedScalar(int index)
+{
+    if (index < 0 || index >= m_scalarAttributes.size()) {
+        index = -1;
+    }
+    if (index == m_displayedScalar) {
+        return true;
+    }
+
+    if (index >= 0) {
+        QElapsedTimer timer;
+        timer.start();
+        if (!m_scalarAttributes[index].load()) {
+            return false;
+        }
+        qDebug() << "Loaded attribute" << m_scalarAttributes[index].name() << "in" << timer.elapsed() << "ms";
+    }
+
+    m_displayedScalar = index;
+    ++m_revision;
+    m_scalarRevision = m_revision;
+    return true;
+}
+
+void PointCloudData::verticesChanged()
+{
+    ++m_revision;
+    m_vertexRevision = m_revision;
+    m_normalRevision = m_revision;
+    m_scalarRevision = m_revision;
+}
+
+void PointCloudData::updateBoundingBox()
+{
+    if (m_vertices.isEmpty()) {
+        m_boundingBoxMin = QVector3D(0.0f, 0.0f, 0.0f);
+        m_boundingBoxMax = QVector3D(0.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    m_boundingBoxMin = QVector3D(std::numeric_limits<float>::max(),
+                                 std::numeric_limits<float>::max(),
+                                 std::numeric_limits<float>::max());
+    m_boundingBoxMax = QVector3D(std::numeric_limits<float>::lowest(),
+                                 std::numeric_limits<float>::lowest(),
+                                 std::numeric_limits<float>::lowest());
+
+    for (const Vertex &vertex : m_vertices) {
+        const QVector3D &p = vertex.position;
+        m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), p.x()));
+        m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), p.y()));
+        m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), p.z()));
+
+        m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), p.x()));
+        m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), p.y()));
+        m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), p.z()));
+    }
+}
+
+void PointCloudData::buildChunks()
+{
+    m_chunks.clear();
+    m_chunks.reserve((m_vertices.size() + ChunkSize - 1) / ChunkSize);
+
+    for (int first = 0; first < m_vertices.size(); first += ChunkSize) {
+        Chunk chunk;
+        chunk.first = first;
+        chunk.count = std::min(ChunkSize, int(m_vertices.size()) - first);
+        chunk.mortonBegin = 0;
+        chunk.mortonEnd = 0;
+        m_chunks.append(chunk);
+    }
+
+    updateChunkBounds();
+}
+
+void PointCloudData::updateChunkBounds()
+{
+    const Vertex *vertices = m_vertices.constData();
+    Chunk *chunks = m_chunks.data();
+
+    parallelFor(m_chunks.size(), [vertices, chunks](qint64 begin, qint64 end) {
+        for (qint64 c = begin; c < end; ++c) {
+            Chunk &chunk = chunks[c];
+            chunk.boundsMin = vertices[chunk.first].position;
+            chunk.boundsMax = vertices[chunk.first].position;
+
+            for (int i = chunk.first + 1; i < chunk.first + chunk.count; ++i) {
+                const QVector3D &p = vertices[i].position;
+                chunk.boundsMin.setX(std::min(chunk.boundsMin.x(), p.x()));
+                chunk.boundsMin.setY(std::min(chunk.boundsMin.y(), p.y()));
+                chunk.boundsMin.setZ(std::min(chunk.boundsMin.z(), p.z()));
+
+                chunk.boundsMax.setX(std::max(chunk.boundsMax.x(), p.x()));
+                chunk.boundsMax.setY(std::max(chunk.boundsMax.y(), p.y()));
+                chunk.boundsMax.setZ(std::max(chunk.boundsMax.z(), p.z()));
+            }
+        }
+    }, 1);
+}
+
+// Collects the octree leaves of the sorted range [begin, end) in Morton order,
+// descending until a node fits in a chunk. A finest cell holding more than
+// a chunk (duplicates, or a cloud without extent) is split into chunk-sized
+// leaves sharing its code range; its points coincide, so any split is as
+// even as another.
+static void collectOctreeLeaves(const quint64 *codes, int begin, int end, quint64 nodeBegin, int level,
+                                QVector<PointCloudData::Chunk> &leaves)
+{
+    const quint64 nodeEnd = MortonCode::nodeEnd(nodeBegin, level);
+    if (end - begin <= PointCloudData::ChunkSize || level == MortonCode::Levels) {
+        for (int first = begin; first < end; first += PointCloudData::ChunkSize) {
+            PointCloudData::Chunk leaf;
+            leaf.first = first;
+            leaf.count = std::min(end - first, PointCloudData::ChunkSize);
+            leaf.mortonBegin = nodeBegin;
+            leaf.mortonEnd = nodeEnd;
+            leaves.append(leaf);
+        }
+        return;
+    }
+
+    const quint64 childSize = (nodeEnd - nodeBegin) / 8;
+    int childFirst = begin;
+    for (int child = 0; child < 8; ++child) {
+        const quint64 childBegin = nodeBegin + child * childSize;
+        const int childEnd = child == 7 ? end
+            : int(std::lower_bound(codes + childFirst, codes + end, childBegin + childSize) - codes);
+        if (childEnd > childFirst) {
+            collectOctreeLeaves(codes, childFirst, childEnd, childBegin, level + 1, leaves);
+        }
+        childFirst = childEnd;
+    }
+}
+
+// Bit-reversed visiting order of a full chunk. Any prefix of a Morton-sorted
+// chunk taken in this order is spread evenly over the chunk, which keeps the
+// level-of-detail prefixes drawn by the renderer spatially uniform.
+static const QVector<quint16> &lodPermutation()
+{
+    static const QVector<quint16> permutation = []() {
+        static_assert(PointCloudData::ChunkSize == 65536, "permutation assumes 16-bit chunk indices");
+        QVector<quint16> result(PointCloudData::ChunkSize);
+        for (int i = 0; i < PointCloudData::ChunkSize; ++i) {
+            quint32 reversed = 0;
+            for (int bit = 0; bit < 16; ++bit) {
+                reversed |= ((quint32(i) >> bit) & 1u) << (15 - bit);
+            }
+            result[i] = quint16(reversed);
+        }
+        return result;
+    }();
+    return permutation;
+}
+
+void PointCloudData::compress(float quantizationStep)
+{
+    if (m_compressed || m_vertices.isEmpty()) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QSharedPointer<CompressedPointStore> store(new CompressedPointStore);
+    store->build(m_vertices, m_chunks, m_boundingBoxMin, m_boundingBoxMax, quantizationStep);
+    m_compressed = store;
+    m_vertices = QVector<Vertex>();
+
+    // Quantization moved the points; the GPU copy must match the host.
+    ++m_revision;
+    m_vertexRevision = m_revision;
+
+    qDebug() << "Compressed" << store->pointCount() << "points from"
+             << store->uncompressedBytes() / (1024 * 1024) << "MB to"
+             << store->compressedBytes() / (1024 * 1024) << "MB, ratio" << store->compressionRatio()
+             << "at step" << store->quantizationStep() << "in" << timer.elapsed() << "ms";
+}
+
+void PointCloudData::decompress()
+{
+    if (!m_compressed) {
+        return;
+    }
+
+    m_vertices.resize(m_compressed->pointCount());
+    m_compressed->decodeAll(m_vertices.data());
+    m_compressed.reset();
+}
+
+bool PointCloudData::filterVertices(const QVector<quint8> &keep)
+{
+    if (keep.size() != pointCount()) {
+        qDebug() << "Ignoring a mask of" << keep.size() << "entries for" << pointCount() << "points";
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int chunkCount = m_chunks.size();
+    QVector<int> kept(chunkCount);
+    {
+        const quint8 *keepData = keep.constData();
+        const Chunk *chunks = m_chunks.constData();
+        int *keptData = kept.data();
+        parallelFor(chunkCount, [=](qint64 begin, qint64 end) {
+            for (qint64 c = begin; c < end; ++c) {
+                int count = 0;
+                for (int i = chunks[c].first; i < chunks[c].first + chunks[c].count; ++i) {
+                    count += keepData[i] != 0;
+                }
+                keptData[c] = count;
+            }
+        }, 1);
+    }
+
+    int total = 0;
+    QVector<int> destination(chunkCount);
+    for (int c = 0; c < chunkCount; ++c) {
+        destination[c] = total;
+        total += kept[c];
+    }
+    if (total == pointCount()) {
+        return true;
+    }
+
+    // Positions are already quantized; re-encoding at the same step keeps
+    // them where they are.
+    const bool wasCompressed = isCompressed();
+    const float step = wasCompressed ? m_compressed->quantizationStep() : 0.0f;
+    decompress();
+
+    // Each chunk compacts into its own destination range, so chunks keep
+    // their spatial meaning (and Morton range) and only shrink.
+    QVector<Vertex> vertices(total);
+    QVector<QVector3D> normals(m_normals.isEmpty() ? 0 : total);
+    QVector<quint32> sourceIndices(total);
+    {
+        const quint8 *keepData = keep.constData();
+        const Vertex *oldVertices = m_vertices.constData();
+        const QVector3D *oldNormals = m_normals.isEmpty() ? nullptr : m_normals.constData();
+        const quint32 *oldSource = m_sourceIndices.isEmpty() ? nullptr : m_sourceIndices.constData();
+        const Chunk *chunks = m_chunks.constData();
+        const int *destinationData = destination.constData();
+        Vertex *vertexData = vertices.data();
+        QVector3D *normalData = normals.data();
+        quint32 *sourceData = sourceIndices.data();
+        parallelFor(chunkCount, [=](qint64 begin, qint64 end) {
+            for (qint64 c = begin; c < end; ++c) {
+                int dst = destinationData[c];
+                for (int src = chunks[c].first; src < chunks[c].first + chunks[c].count; ++src) {
+                    if (!keepData[src]) {
+                        continue;
+                    }
+                    vertexData[dst] = oldVertices[src];
+                    if (oldNormals) {
+                        normalData[dst] = oldNormals[src];
+                    }
+                    sourceData[dst] = oldSource ? oldSource[src] : quint32(src);
+                    ++dst;
+                }
+            }
+        }, 1);
+    }
+
+    // Unsorted chunks are arbitrary ranges, so neighbours that now fit
+    // together are merged; octree chunks stay as they are.
+    QVector<Chunk> chunks;
+    for (int c = 0; c < chunkCount; ++c) {
+        if (kept[c] == 0) {
+            continue;
+        }
+        if (!m_spatiallySorted && !chunks.isEmpty() && chunks.last().count + kept[c] <= ChunkSize) {
+            chunks.last().count += kept[c];
+            continue;
+        }
+        Chunk chunk = m_chunks[c];
+        chunk.first = destination[c];
+        chunk.count = kept[c];
+        chunks.append(chunk);
+    }
+
+    const int removed = m_vertices.size() - total;
+    m_vertices = vertices;
+    m_normals = normals;
+    m_sourceIndices = sourceIndices;
+    m_chunks = chunks;
+
+    // Bounds of what is left, from the chunks rather than another pass over
+    // the points; one stray point no longer stretches them.
+    updateChunkBounds();
+    if (m_chunks.isEmpty()) {
+        m_boundingBoxMin = QVector3D(0.0f, 0.0f, 0.0f);
+        m_boundingBoxMax = QVector3D(0.0f, 0.0f, 0.0f);
+    } else {
+        m_boundingBoxMin = m_chunks.first().boundsMin;
+        m_boundingBoxMax = m_chunks.first().boundsMax;
+        for (const Chunk &chunk : m_chunks) {
+            m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), chunk.boundsMin.x()));
+            m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), chunk.boundsMin.y()));
+            m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), chunk.boundsMin.z()));
+
+            m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), chunk.boundsMax.x()));
+            m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), chunk.boundsMax.y()));
+            m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), chunk.boundsMax.z()));
+        }
+    }
+    verticesChanged();
+
+    if (wasCompressed) {
+        compress(step);
+    }
+
+    qDebug() << "Removed" << removed << "points, kept" << total << "in" << timer.elapsed() << "ms";
+    return true;
+}
+
+QSharedPointer<PointCloudData> PointCloudData::clone() const
+{
+    QSharedPointer<PointCloudData> copy(new PointCloudData);
+    copy->m_vertices = m_vertices;
+    copy->m_compressed = m_compressed;
+    copy->m_chunks = m_chunks;
+    copy->m_normals = m_normals;
+    copy->m_scalarAttributes = m_scalarAttributes;
+    copy->m_displayedScalar = m_displayedScalar;
+    copy->m_sourceIndices = m_sourceIndices;
+    copy->m_spatiallySorted = m_spatiallySorted;
+    copy->m_boundingBoxMin = m_boundingBoxMin;
+    copy->m_boundingBoxMax = m_boundingBoxMax;
+    copy->verticesChanged();
+    return copy;
+}
+
+void PointCloudData::sortSpatially()
+{
+    decompress();
+
+    const int count = m_vertices.size();
+    if (count == 0) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QVector<quint64> codes(count);
+    QVector<quint32> order(count);
+    {
+        const Vertex *vertices = m_vertices.constData();
+        quint64 *codeData = codes.data();
+        quint32 *orderData = order.data();
+        const QVector3D boundsMin = m_boundingBoxMin;
+        const QVector3D boundsMax = m_boundingBoxMax;
+        parallelFor(count, [=](qint64 begin, qint64 end) {
+            for (qint64 i = begin; i < end; ++i) {
+                codeData[i] = MortonCode::encode(vertices[i].position, boundsMin, boundsMax);
+                orderData[i] = quint32(i);
+            }
+        });
+    }
+
+    MortonCode::radixSort(codes, order);
+
+    // Octree leaves, merged greedily into chunks of up to ChunkSize points.
+    // Consecutive leaves are neighbours in Morton order, so merged chunks
+    // stay spatially compact and cover one contiguous code range.
+    QVector<Chunk> leaves;
+    collectOctreeLeaves(codes.constData(), 0, count, 0, 0, leaves);
+    codes = QVector<quint64>();
+
+    m_chunks.clear();
+    for (const Chunk &leaf : leaves) {
+        if (!m_chunks.isEmpty() && m_chunks.last().count + leaf.count <= ChunkSize) {
+            m_chunks.last().count += leaf.count;
+            m_chunks.last().mortonEnd = leaf.mortonEnd;
+        } else {
+            m_chunks.append(leaf);
+        }
+    }
+
+    QVector<Vertex> sorted(count);
+    QVector<QVector3D> sortedNormals(m_normals.size());
+    QVector<quint32> sourceIndices(count);
+    {
+        const Vertex *vertices = m_vertices.constData();
+        const QVector3D *normals = m_normals.isEmpty() ? nullptr : m_normals.constData();
+        const quint32 *previousSource = m_sourceIndices.isEmpty() ? nullptr : m_sourceIndices.constData();
+        const quint32 *orderData = order.constData();
+        const Chunk *chunks = m_chunks.constData();
+        Vertex *sortedData = sorted.data();
+        QVector3D *sortedNormalData = sortedNormals.data();
+        quint32 *sourceData = sourceIndices.data();
+        const QVector<quint16> &permutation = lodPermutation();
+
+        parallelFor(m_chunks.size(), [&](qint64 begin, qint64 end) {
+            for (qint64 c = begin; c < end; ++c) {
+                const Chunk &chunk = chunks[c];
+                // The permutation only covers ChunkSize offsets.
+                Q_ASSERT(chunk.count <= ChunkSize);
+                int dst = chunk.first;
+                for (quint16 offset : permutation) {
+                    if (offset >= chunk.count) {
+                        continue;
+                    }
+                    const quint32 src = orderData[chunk.first + offset];
+                    sortedData[dst] = vertices[src];
+                    if (normals) {
+                        sortedNormalData[dst] = normals[src];
+                    }
+                    sourceData[dst] = previousSource ? previousSource[src] : src;
+                    ++dst;
+                }
+            }
+        }, 1);
+    }
+
+    m_vertices = sorted;
+    m_normals = sortedNormals;
+    m_sourceIndices = sourceIndices;
+    updateChunkBounds();
+    m_spatiallySorted = true;
+    verticesChanged();
+
+    qDebug() << "Morton-sorted" << count << "points into" << m_chunks.size() << "chunks in"
+             << timer.elapsed() << "ms";
+}
+
+QPair<int, int> PointCloudData::mortonNodeRange(quint64 code, int level) const
+{
+    if (!m_spatiallySorted) {
+        return qMakePair(0, 0);
+    }
+
+    const quint64 nodeBegin = MortonCode::nodeBegin(code, level);
+    const quint64 nodeEnd = MortonCode::nodeEnd(code, level);
+
+    // Chunks cover ascending code ranges, disjoint except for the pieces of
+    // an over-full finest cell, which share one.
+    auto it = std::upper_bound(m_chunks.constBegin(), m_chunks.constEnd(), nodeBegin,
+                               [](quint64 value, const Chunk &chunk) { return value < chunk.mortonEnd; });
+    if (it == m_chunks.constEnd() || it->mortonBegin >= nodeEnd) {
+        return qMakePair(0, 0);
+    }
+
+    const int first = it->first;
+    int last = it->first + it->count;
+    for (++it; it != m_chunks.constEnd() && it->mortonBegin < nodeEnd; ++it) {
+        last = it->first + it->count;
+    }
+    return qMakePair(first, last);
+}
+
+void PointCloudData::uploadToGpu()
+{
+    if (!m_gpuVertices.buffer || m_gpuVertices.revision != m_vertexRevision) {
+        // Writers hold their own reference to the host data, which may be
+        // replaced before the upload finishes.
+        GpuUploadManager::Writer writer;
+        if (m_compressed) {
+            // Decode time is summed over the slices, so the reported rate
+            // leaves out the frames the upload budget spreads them over.
+            const QSharedPointer<const CompressedPointStore> store = m_compressed;
+            const QSharedPointer<qint64> decodeNs(new qint64(0));
+            writer = [store, decodeNs](void *dst, int first, int count) {
+                QElapsedTimer timer;
+                timer.start();
+                store->decodeRange(first, count, static_cast<Vertex *>(dst));
+                *decodeNs += timer.nsecsElapsed();
+                if (first + count == store->pointCount()) {
+                    qDebug() << "Decoded" << store->pointCount() << "points for upload in"
+                             << *decodeNs / 1000000 << "ms,"
+                             << qint64(store->pointCount()) * 1000 / std::max<qint64>(*decodeNs, 1) << "Mpoints/s";
+                }
+            };
+        } else {
+            const QVector<Vertex> vertices = m_vertices;
+            writer = [vertices](void *dst, int first, int count) {
+                std::memcpy(dst, vertices.constData() + first, size_t(count) * sizeof(Vertex));
+            };
+        }
+        scheduleUpload(m_gpuVertices, m_vertexRevision, pointCount(), int(sizeof(Vertex)), writer);
+    }
+
+    if (m_normals.isEmpty()) {
+        releaseGpuArray(m_gpuNormals);
+    } else if (!m_gpuNormals.buffer || m_gpuNormals.revision != m_normalRevision) {
+        const QVector<QVector3D> normals = m_normals;
+        scheduleUpload(m_gpuNormals, m_normalRevision, normals.size(), int(sizeof(QVector3D)),
+                       [normals](void *dst, int first, int count) {
+                           std::memcpy(dst, normals.constData() + first, size_t(count) * sizeof(QVector3D));
+                       });
+    }
+
+    if (m_displayedScalar < 0) {
+        releaseGpuArray(m_gpuScalars);
+    } else if (!m_gpuScalars.buffer || m_gpuScalars.revision != m_scalarRevision) {
+        // Columns are in file order; gather into vertex order straight into
+        // the staging buffer, without a host-side copy.
+        const QVector<float> values = m_scalarAttributes[m_displayedScalar].values();
+        const QVector<quint32> sourceIndices = m_sourceIndices;
+        scheduleUpload(m_gpuScalars, m_scalarRevision, pointCount(), int(sizeof(float)),
+                       [values, sourceIndices](void *dst, int first, int count) {
+                           float *out = static_cast<float *>(dst);
+                           const float *source = values.constData();
+                           const quint32 *indices = sourceIndices.isEmpty() ? nullptr : sourceIndices.constData();
+                           parallelFor(count, [=](qint64 begin, qint64 end) {
+                               for (qint64 i = begin; i < end; ++i) {
+                                   out[i] = source[indices ? indices[first + i] : first + i];
+                               }
+                           });
+                       });
+    }
+}
+
+// Reuses the array's buffer when it is large enough, so re-uploads after a
+// sort or a new normal estimate do not reallocate.
+void PointCloudData::scheduleUpload(GpuArray &array, quint64 revision, int count, int elementSize,
+                                    const GpuUploadManager::Writer &writer)
+{
+    GpuUploadManager *manager = GpuUploadManager::instance();
+    if (array.ticket) {
+        manager->cancelUpload(array.ticket);
+        array.ticket = 0;
+    }
+
+    const qint64 bytes = qint64(std::max(count, 1)) * elementSize;
+    if (array.buffer && manager->bufferCapacity(array.buffer) < bytes) {
+        manager->releaseBuffer(array.buffer);
+        array.buffer = 0;
+    }
+    if (!array.buffer) {
+        array.buffer = manager->acquireBuffer(bytes);
+    }
+
+    array.revision = revision;
+    array.count = count;
+    array.uploaded = 0;
+    ++m_gpuRevision;
+
+    if (count == 0) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    GpuArray *target = &array;
+    array.ticket = manager->upload(array.buffer, count, elementSize, writer, [this, target, timer](int uploaded) {
+        target->uploaded = uploaded;
+        if (uploaded == target->count) {
+            target->ticket = 0;
+            ++m_gpuRevision;
+            qDebug() << "Uploaded" << target->count << "elements to the GPU in" << timer.elapsed() << "ms";
+        }
+    });
+}
+
+void PointCloudData::releaseGpuArray(GpuArray &array)
+{
+    if (!array.buffer) {
+        return;
+    }
+    // Also cancels a pending upload into it.
+    GpuUploadManager::instance()->releaseBuffer(array.buffer);
+    array = GpuArray();
+    ++m_gpuRevision;
+}
+
+int PointCloudData::gpuVertexCount() const
+{
+    return m_gpuVertices.revision == m_vertexRevision ? m_gpuVertices.uploaded : 0;
+}
+
+bool PointCloudData::isNormalBufferReady() const
+{
+    return hasNormals() && m_gpuNormals.buffer && !m_gpuNormals.ticket && m_gpuNormals.revision == m_normalRevision;
+}
+
+bool PointCloudData::isScalarBufferReady() const
+{
+    return m_displayedScalar >= 0 && m_gpuScalars.buffer && !m_gpuScalars.ticket
+           && m_gpuScalars.revision == m_scalarRevision;
+}
+
+void PointCloudData::releaseGpuResources()
+{
+    releaseGpuArray(m_gpuVertices);
+    releaseGpuArray(m_gpuNormals);
+    releaseGpuArray(m_gpuScalars);
+}
+
+// Locale-independent decimal parser (strtod follows LC_NUMERIC, which
+// QApplication sets from the environment). Skips leading blanks and leaves
+// cursor after the number; returns false, with cursor unchanged, if there
+// is none. Exact for up to 19 significant digits and exponents within
+// double's exactly representable powers of ten, which covers scan data.
+static bool parseNumber(const char *&cursor, double &value)
+{
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *p = cursor;
+    while (*p == ' ' || *p == '\t' || *p == '\r') {
+        ++p;
+    }
+
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = *p == '-';
+        ++p;
+    }
+
+    quint64 mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+    for (; *p >= '0' && *p <= '9'; ++p) {
+        anyDigit = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + quint64(*p - '0');
+            if (mantissa) {
+                ++digits;
+            }
+        } else {
+            ++exponent;
+        }
+    }
+    if (*p == '.') {
+        ++p;
+        for (; *p >= '0' && *p <= '9'; ++p) {
+            anyDigit = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + quint64(*p - '0');
+                if (mantissa) {
+                    ++digits;
+                }
+                --exponent;
+            }
+        }
+    }
+    if (!anyDigit) {
+        return false;
+    }
+
+    if (*p == 'e' || *p == 'E') {
+        const char *q = p + 1;
+        bool negativeExponent = false;
+        if (*q == '-' || *q == '+') {
+            negativeExponent = *q == '-';
+            ++q;
+        }
+        if (*q >= '0' && *q <= '9') {
+            int e = 0;
+            for (; *q >= '0' && *q <= '9'; ++q) {
+                e = std::min(e * 10 + (*q - '0'), 100000);
+            }
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double result = double(mantissa);
+    if (exponent < 0) {
+        result = exponent >= -22 ? result / powersOfTen[-exponent] : result * std::pow(10.0, exponent);
+    } else if (exponent > 0) {
+        result = exponent <= 22 ? result * powersOfTen[exponent] : result * std::pow(10.0, exponent);
+    }
+
+    value = negative ? -result : result;
+    cursor = p;
+    return true;
+}
+
+bool PointCloudData::loadPtsFile(const QString &filename)
+{
+    COUNT_ALLOCATIONS("loadPtsFile");
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to open .pts file:" << filename;
+        return false;
+    }
+
+    m_vertices.clear();
+    m_compressed.reset();
+    m_normals.clear();
+    m_scalarAttributes.clear();
+    m_displayedScalar = -1;
+    m_sourceIndices.clear();
+    m_spatiallySorted = false;
+
+    m_boundingBoxMin = QVector3D(std::numeric_limits<float>::max(),
+                                 std::numeric_limits<float>::max(),
+                                 std::numeric_limits<float>::max());
+    m_boundingBoxMax = QVector3D(std::numeric_limits<float>::lowest(),
+                                 std::numeric_limits<float>::lowest(),
+                                 std::numeric_limits<float>::lowest());
+
+    // Lines are parsed in place from blocks read into the scratch arena, so
+    // there are no per-line strings or token lists; the vertex array is
+    // sized once from the line density of the first block.
+    const qint64 BlockSize = 4 * 1024 * 1024;
+    Arena &arena = Arena::scratch();
+    const Arena::Scope scope(arena);
+    char *buffer = arena.allocateArray<char>(BlockSize + 1);
+
+    const qint64 fileSize = file.size();
+    bool reserved = false;
+
+    auto parseLine = [this](const char *cursor) {
+        while (*cursor == ' ' || *cursor == '\t') {
+            ++cursor;
+        }
+        if (*cursor == '#') {
+            return;
+        }
+
+        double values[6];
+        int count = 0;
+        while (count < 6 && parseNumber(cursor, values[count])) {
+            ++count;
+        }
+        if (count < 3) {
+            return;
+        }
+
+        const float x = float(values[0]);
+        const float y = float(values[1]);
+        const float z = float(values[2]);
+
+        QVector3D color(1.0f, 1.0f, 1.0f);
+        if (count >= 6) {
+            color = QVector3D(float(values[3]), float(values[4]), float(values[5])) / 255.0f;
+        }
+
+        Vertex vertex = {QVector3D(x, y, z), color};
+        m_vertices.append(vertex);
+
+        m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), x));
+        m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), y));
+        m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), z));
+
+        m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), x));
+        m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), y));
+        m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), z));
+    };
+
+    qint64 carried = 0;
+    for (;;) {
+        const qint64 read = file.read(buffer + carried, BlockSize - carried);
+        if (read < 0) {
+            qDebug() << "Error reading .pts file:" << filename;
+            return false;
+        }
+        char *cursor = buffer;
+        char *end = buffer + carried + read;
+
+        if (!reserved && end > buffer) {
+            const qint64 lines = std::count(static_cast<const char *>(buffer), static_cast<const char *>(end), '\n');
+            // With headroom, since line lengths drift through a file and a
+            // slight underestimate would regrow the whole array.
+            const qint64 estimate = (lines + 1) * fileSize / qint64(end - buffer) + 1;
+            m_vertices.reserve(int(std::min<qint64>(estimate + estimate / 16, std::numeric_limits<int>::max() / 2)));
+            reserved = true;
+        }
+
+        while (char *newline = static_cast<char *>(std::memchr(cursor, '\n', size_t(end - cursor)))) {
+            *newline = '\0';
+            parseLine(cursor);
+            cursor = newline + 1;
+        }
+
+        // A last line without a newline, or one longer than a block, is
+        // parsed as it stands.
+        carried = end - cursor;
+        if (read == 0 || carried == BlockSize) {
+            *end = '\0';
+            if (carried > 0) {
+                parseLine(cursor);
+            }
+            if (read == 0) {
+                break;
+            }
+            carried = 0;
+        } else {
+            std::memmove(buffer, cursor, size_t(carried));
+        }
+    }
+
+    file.close();
+
+    buildChunks();
+    verticesChanged();
+
+    return true;
+}
+
+bool PointCloudData::loadPlyFile(const QString &filename)
+{
+    COUNT_ALLOCATIONS("loadPlyFile");
+
+    std::ifstream file(filename.toStdString(), std::ios::binary);
+    if (!file.is_open()) {
+        qDebug() << "Failed to open .ply file:" << filename;
+        return false;
+    }
+
+    m_vertices.clear();
+    m_compressed.reset();
+    m_normals.clear();
+    m_scalarAttributes.clear();
+    m_displayedScalar = -1;
+    m_sourceIndices.clear();
+    m_spatiallySorted = false;
+
+    m_boundingBoxMin = QVector3D(std::numeric_limits<float>::max(),
+                                 std::numeric_limits<float>::max(),
+                                 std::numeric_limits<float>::max());
+    m_boundingBoxMax = QVector3D(std::numeric_limits<float>::lowest(),
+                                 std::numeric_limits<float>::lowest(),
+                                 std::numeric_limits<float>::lowest());
+
+    std::string line;
+    int numVertices = 0;
+    bool isBinary = false;
+    bool isBigEndian = false;
+    bool headerEnd = false;
+    bool inVertexElement = false;
+    bool vertexElementSeen = false;
+    bool dataBeforeVertices = false;
+
+    struct PropertyInfo {
+        std::string name;
+        ScalarAttribute::Type type;
+        int offset; // within a binary record
+    };
+    std::vector<PropertyInfo> properties;
+    int recordSize = 0;
+    int xIndex = -1, yIndex = -1, zIndex = -1;
+    int redIndex = -1, greenIndex = -1, blueIndex = -1;
+    int nxIndex = -1, nyIndex = -1, nzIndex = -1;
+
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        std::istringstream ls(line);
+        std::string keyword;
+        ls >> keyword;
+
+        if (keyword == "end_header") {
+            headerEnd = true;
+            break;
+        } else if (keyword == "format") {
+            std::string format, version;
+            ls >> format >> version;
+            if (format == "ascii") {
+                isBinary = false;
+            } else if (format == "binary_little_endian") {
+                isBinary = true;
+                isBigEndian = false;
+            } else if (format == "binary_big_endian") {
+                isBinary = true;
+                isBigEndian = true;
+            }
+        } else if (keyword == "element") {
+            std::string elementName;
+            int count = 0;
+            ls >> elementName >> count;
+            inVertexElement = elementName == "vertex";
+            if (inVertexElement) {
+                numVertices = count;
+                vertexElementSeen = true;
+            } else if (!vertexElementSeen && count > 0) {
+                dataBeforeVertices = true;
+            }
+        } else if (keyword == "property" && inVertexElement) {
+            std::string type, name;
+            ls >> type;
+            if (type == "list") {
+                qDebug() << "List properties on PLY vertices are not supported";
+                file.close();
+                return false;
+            }
+            ls >> name;
+
+            PropertyInfo prop;
+            prop.name = name;
+            prop.offset = recordSize;
+            if (!ScalarAttribute::typeFromPlyName(type, prop.type)) {
+                qDebug() << "Unknown PLY property type:" << QString::fromStdString(type);
+                file.close();
+                return false;
+            }
+            recordSize += ScalarAttribute::typeSize(prop.type);
+
+            int propIndex = properties.size();
+            if (name == "x") xIndex = propIndex;
+            else if (name == "y") yIndex = propIndex;
+            else if (name == "z") zIndex = propIndex;
+            else if (name == "red") redIndex = propIndex;
+            else if (name == "green") greenIndex = propIndex;
+            else if (name == "blue") blueIndex = propIndex;
+            else if (name == "nx") nxIndex = propIndex;
+            else if (name == "ny") nyIndex = propIndex;
+            else if (name == "nz") nzIndex = propIndex;
+
+            properties.push_back(prop);
+        }
+    }
+
+    if (!headerEnd || xIndex == -1 || yIndex == -1 || zIndex == -1) {
+        qDebug() << "Invalid PLY file format or missing coordinate properties";
+        file.close();
+        return false;
+    }
+    if (dataBeforeVertices) {
+        qDebug() << "PLY files with elements before the vertices are not supported";
+        file.close();
+        return false;
+    }
+
+    const bool hasColors = redIndex != -1 && greenIndex != -1 && blueIndex != -1;
+    const bool hasNormals = nxIndex != -1 && nyIndex != -1 && nzIndex != -1;
+
+    // Integer colors are scaled by their type's range, float colors are
+    // taken as they are.
+    float colorScale = 1.0f;
+    if (hasColors) {
+        if (properties[redIndex].type == ScalarAttribute::Type::UInt8) {
+            colorScale = 1.0f / 255.0f;
+        } else if (properties[redIndex].type == ScalarAttribute::Type::UInt16) {
+            colorScale = 1.0f / 65535.0f;
+        }
+    }
+
+    // Properties decoded at load time; every other one is kept as a scalar
+    // attribute.
+    std::vector<int> decoded = { xIndex, yIndex, zIndex };
+    if (hasColors) {
+        decoded.insert(decoded.end(), { redIndex, greenIndex, blueIndex });
+    }
+    if (hasNormals) {
+        decoded.insert(decoded.end(), { nxIndex, nyIndex, nzIndex });
+    }
+    std::vector<int> scalarProperties;
+    for (int j = 0; j < int(properties.size()); ++j) {
+        if (std::find(decoded.begin(), decoded.end(), j) == decoded.end()) {
+            scalarProperties.push_back(j);
+            m_scalarAttributes.append(ScalarAttribute(QString::fromStdString(properties[j].name), properties[j].type));
+        }
+    }
+
+    // The header's count sizes every array once, capped by what the rest
+    // of the file can hold so a corrupt header cannot reserve gigabytes.
+    const qint64 dataOffset = file.tellg();
+    file.seekg(0, std::ios::end);
+    const qint64 dataSize = qint64(file.tellg()) - dataOffset;
+    file.seekg(dataOffset);
+    const qint64 minRecordSize = isBinary ? recordSize : 2 * qint64(properties.size());
+    const int capacity = int(std::min<qint64>(numVertices, dataSize / std::max<qint64>(1, minRecordSize)));
+
+    m_vertices.reserve(capacity);
+    if (hasNormals) {
+        m_normals.reserve(capacity);
+    }
+
+    Arena &arena = Arena::scratch();
+    const Arena::Scope scope(arena);
+    double *values = arena.allocateArray<double>(properties.size());
+    std::fill(values, values + properties.size(), 0.0);
+    auto appendVertex = [&]() {
+        const float x = float(values[xIndex]);
+        const float y = float(values[yIndex]);
+        const float z = float(values[zIndex]);
+
+        QVector3D pos(x, y, z);
+        QVector3D color(1.0f, 1.0f, 1.0f);
+        if (hasColors) {
+            color = QVector3D(float(values[redIndex]), float(values[greenIndex]), float(values[blueIndex])) * colorScale;
+        }
+
+        Vertex vertex = {pos, color};
+        m_vertices.append(vertex);
+        if (hasNormals) {
+            m_normals.append(QVector3D(float(values[nxIndex]), float(values[nyIndex]), float(values[nzIndex])));
+        }
+
+        m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), x));
+        m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), y));
+        m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), z));
+
+        m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), x));
+        m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), y));
+        m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), z));
+    };
+
+    if (!isBinary) {
+        // The text is parsed anyway, so scalar attributes are filled now.
+        for (ScalarAttribute &attribute : m_scalarAttributes) {
+            attribute.reserve(capacity);
+        }
+
+        for (int i = 0; i < numVertices; i++) {
+            if (!std::getline(file, line)) {
+                qDebug() << "Unexpected end of PLY data after" << i << "vertices";
+                file.close();
+                return false;
+            }
+
+            const char *cursor = line.c_str();
+            for (size_t j = 0; j < properties.size(); j++) {
+                if (!parseNumber(cursor, values[j])) {
+                    values[j] = 0.0;
+                }
+            }
+
+            appendVertex();
+            for (size_t s = 0; s < scalarProperties.size(); ++s) {
+                m_scalarAttributes[int(s)].appendValue(values[scalarProperties[s]]);
+            }
+        }
+    } else {
+        const int BatchRecords = 65536;
+        char *buffer = arena.allocateArray<char>(size_t(BatchRecords) * recordSize);
+
+        for (int first = 0; first < numVertices; first += BatchRecords) {
+            const int batch = std::min(BatchRecords, numVertices - first);
+            file.read(buffer, std::streamsize(batch) * recordSize);
+            if (file.fail()) {
+                qDebug() << "Error reading binary PLY data";
+                file.close();
+                return false;
+            }
+
+            for (int r = 0; r < batch; ++r) {
+                const char *record = buffer + size_t(r) * recordSize;
+                for (int j : decoded) {
+                    values[j] = ScalarAttribute::readValue(record + properties[j].offset, properties[j].type, isBigEndian);
+                }
+                appendVertex();
+            }
+        }
+
+        // Scalar attributes are decoded from the file when first selected.
+        for (size_t s = 0; s < scalarProperties.size(); ++s) {
+            m_scalarAttributes[int(s)].setFileSource(filename, dataOffset, recordSize,
+                                                     properties[scalarProperties[s]].offset, isBigEndian, numVertices);
+        }
+    }
+
+    file.close();
+
+    buildChunks();
+    verticesChanged();
+
+    return true;
+}
+
+// Visits the vertices of each chunk in order, decoding compressed chunks
+// into the scratch arena. Returns false as soon as visit does.
+template <typename Visit>
+static bool forEachChunk(const PointCloudData &cloud, Visit visit)
+{
+    typedef PointCloudData::Vertex Vertex;
+    QSharedPointer<const CompressedPointStore> store = cloud.compressedStore();
+    const QVector<Vertex> vertices = store ? QVector<Vertex>() : cloud.vertices();
+
+    Arena &arena = Arena::scratch();
+    const Arena::Scope scope(arena);
+    Vertex *decoded = store ? arena.allocateArray<Vertex>(PointCloudData::ChunkSize) : nullptr;
+
+    for (int c = 0; c < cloud.chunks().size(); ++c) {
+        const PointCloudData::Chunk &chunk = cloud.chunks()[c];
+        const Vertex *points = vertices.constData() + chunk.first;
+        if (store) {
+            store->decodeChunk(c, decoded);
+            points = decoded;
+        }
+        if (!visit(chunk, points)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int maskedCount(const QVector<quint8> &mask, int pointCount)
+{
+    if (mask.isEmpty()) {
+        return pointCount;
+    }
+    return int(std::count_if(mask.constBegin(), mask.constEnd(), [](quint8 value) { return value != 0; }));
+}
+
+bool PointCloudData::savePtsFile(const QString &filename, const QVector<quint8> &mask) const
+{
+    if (!mask.isEmpty() && mask.size() != pointCount()) {
+        qDebug() << "Mask does not match the cloud; not saving" << filename;
+        return false;
+    }
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to open .pts file for writing:" << filename;
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int count = maskedCount(mask, pointCount());
+    const QByteArray header = QByteArray::number(count) + "\n";
+    if (file.write(header) != header.size()) {
+        qDebug() << "Error writing .pts file:" << filename;
+        return false;
+    }
+
+    // A chunk's lines are formatted into one arena buffer and written at
+    // once; 9 significant digits round-trip a float.
+    const int MaxLineLength = 3 * 17 + 3 * 4 + 1;
+    Arena &arena = Arena::scratch();
+    const Arena::Scope scope(arena);
+    char *buffer = arena.allocateArray<char>(size_t(ChunkSize) * MaxLineLength);
+
+    const quint8 *keep = mask.isEmpty() ? nullptr : mask.constData();
+    const bool written = forEachChunk(*this, [&](const Chunk &chunk, const Vertex *points) {
+        char *cursor = buffer;
+        for (int i = 0; i < chunk.count; ++i) {
+            if (keep && !keep[chunk.first + i]) {
+                continue;
+            }
+            const QVector3D &p = points[i].position;
+            const QVector3D &color = points[i].color;
+            cursor += std::snprintf(cursor, MaxLineLength, "%.9g %.9g %.9g %d %d %d\n", p.x(), p.y(), p.z(),
+                                    int(std::lround(std::clamp(color.x(), 0.0f, 1.0f) * 255.0f)),
+                                    int(std::lround(std::clamp(color.y(), 0.0f, 1.0f) * 255.0f)),
+                                    int(std::lround(std::clamp(color.z(), 0.0f, 1.0f) * 255.0f)));
+        }
+        return file.write(buffer, cursor - buffer) == cursor - buffer;
+    });
+
+    if (!written || !file.commit()) {
+        qDebug() << "Error writing .pts file:" << filename;
+        return false;
+    }
+
+    qDebug() << "Saved" << count << "points to" << filename << "in" << timer.elapsed() << "ms";
+    return true;
+}
+
+bool PointCloudData::savePlyFile(const QString &filename, const QVector<quint8> &mask)
+{
+    if (!mask.isEmpty() && mask.size() != pointCount()) {
+        qDebug() << "Mask does not match the cloud; not saving" << filename;
+        return false;
+    }
+
+    // Attributes may still live in the file being overwritten; decode them
+    // first.
+    QVector<int> attributes;
+    for (int a = 0; a < m_scalarAttributes.size(); ++a) {
+        if (m_scalarAttributes[a].load()) {
+            attributes.append(a);
+        } else {
+            qDebug() << "Leaving out unreadable attribute" << m_scalarAttributes[a].name();
+        }
+    }
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to open .ply file for writing:" << filename;
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const int count = maskedCount(mask, pointCount());
+    const bool hasNormals = !m_normals.isEmpty();
+    QByteArray header = "ply\nformat binary_little_endian 1.0\n";
+    header += "element vertex " + QByteArray::number(count) + "\n";
+    header += "property float x\nproperty float y\nproperty float z\n";
+    header += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+    if (hasNormals) {
+        header += "property float nx\nproperty float ny\nproperty float nz\n";
+    }
+    for (int a : attributes) {
+        header += "property double " + m_scalarAttributes[a].name().toUtf8() + "\n";
+    }
+    header += "end_header\n";
+    if (file.write(header) != header.size()) {
+        qDebug() << "Error writing .ply file:" << filename;
+        return false;
+    }
+
+    const int recordSize = 3 * 4 + 3 + (hasNormals ? 3 * 4 : 0) + 8 * attributes.size();
+    Arena &arena = Arena::scratch();
+    const Arena::Scope scope(arena);
+    char *buffer = arena.allocateArray<char>(size_t(ChunkSize) * recordSize);
+
+    const quint8 *keep = mask.isEmpty() ? nullptr : mask.constData();
+    const bool written = forEachChunk(*this, [&](const Chunk &chunk, const Vertex *points) {
+        char *cursor = buffer;
+        for (int i = 0; i < chunk.count; ++i) {
+            const int index = chunk.first + i;
+            if (keep && !keep[index]) {
+                continue;
+            }
+            const QVector3D &p = points[i].position;
+            for (int axis = 0; axis < 3; ++axis) {
+                qToLittleEndian(p[axis], cursor);
+                cursor += 4;
+            }
+            for (int channel = 0; channel < 3; ++channel) {
+                *cursor++ = char(std::lround(std::clamp(points[i].color[channel], 0.0f, 1.0f) * 255.0f));
+            }
+            if (hasNormals) {
+                for (int axis = 0; axis < 3; ++axis) {
+                    qToLittleEndian(m_normals[index][axis], cursor);
+                    cursor += 4;
+                }
+            }
+            const int source = m_sourceIndices.isEmpty() ? index : int(m_sourceIndices[index]);
+            for (int a : attributes) {
+                const ScalarAttribute &attribute = m_scalarAttributes[a];
+                qToLittleEndian(double(attribute.values()[source]) + attribute.offset(), cursor);
+                cursor += 8;
+            }
+        }
+        return file.write(buffer, cursor - buffer) == cursor - buffer;
+    });
+
+    if (!written || !file.commit()) {
+        qDebug() << "Error writing .ply file:" << filename;
+        return false;
+    }
+
+    qDebug() << "Saved" << count << "points to" << filename << "in" << timer.elapsed() << "ms";
+    return true;
+}
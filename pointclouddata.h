@@ -0,0 +1,192 @@
+#ifndef POINTCLOUDDATA_H
+#define POINTCLOUDDATA_H
+
+#include <QVector3D>
+#include <QVector>
+#include <QPair>
+#include <QString>
+#include <QSharedPointer>
+#include "gpuuploadmanager.h"
+#include "scalarattribute.h"
+
+class CompressedPointStore;
+
+// Point cloud shared between renderers.
+//
+// Host data lives here once and is handed around as a
+// QSharedPointer<PointCloudData>, so every PointCloudRenderer showing the same
+// cloud references the same vertices. GPU buffers come from the
+// GpuUploadManager pool, filled by whichever context uploads first; with
+// Qt::AA_ShareOpenGLContexts all renderer contexts belong to one share group,
+// so the buffers are visible to all of them. Vertex array objects are not
+// shareable and stay per renderer.
+class PointCloudData
+{
+public:
+    struct Vertex {
+        QVector3D position;
+        QVector3D color;
+    };
+
+    // Contiguous range of vertices with its bounds; the unit of culling,
+    // level-of-detail selection and draw command generation. After
+    // sortSpatially() a chunk also covers the Morton code range
+    // [mortonBegin, mortonEnd); otherwise both are 0.
+    struct Chunk {
+        int first;
+        int count;
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+        quint64 mortonBegin;
+        quint64 mortonEnd;
+    };
+
+    static constexpr int ChunkSize = 65536;
+
+    PointCloudData();
+    ~PointCloudData();
+
+    bool loadPtsFile(const QString &filename);
+    bool loadPlyFile(const QString &filename);
+
+    // Write the vertices whose mask byte is nonzero, or all of them for an
+    // empty mask. PTS gets "x y z r g b" lines as loadPtsFile() reads them;
+    // PLY is binary and also carries normals and every scalar attribute
+    // (loading those not yet decoded).
+    bool savePtsFile(const QString &filename, const QVector<quint8> &mask = QVector<quint8>()) const;
+    bool savePlyFile(const QString &filename, const QVector<quint8> &mask = QVector<quint8>());
+
+    // Decodes the whole cloud when it is compressed; prefer chunk-wise
+    // access through compressedStore() for large clouds.
+    QVector<Vertex> vertices() const;
+    void setVertices(const QVector<Vertex> &vertices);
+    int pointCount() const;
+    bool isEmpty() const { return pointCount() == 0; }
+
+    QVector3D getBoundingBoxMin() const { return m_boundingBoxMin; }
+    QVector3D getBoundingBoxMax() const { return m_boundingBoxMax; }
+    QVector3D getCenter() const { return (m_boundingBoxMin + m_boundingBoxMax) * 0.5f; }
+
+    const QVector<Chunk> &chunks() const { return m_chunks; }
+
+    // Optional unit normal per vertex, in vertex order; read from PLY
+    // nx/ny/nz or set from NormalEstimator. A zero normal means unknown.
+    bool hasNormals() const { return !m_normals.isEmpty(); }
+    const QVector<QVector3D> &normals() const { return m_normals; }
+    void setNormals(const QVector<QVector3D> &normals);
+
+    // Per-point properties of the loaded file other than position, color
+    // and normal (intensity, classification, ...), in file order.
+    int scalarAttributeCount() const { return m_scalarAttributes.size(); }
+    const ScalarAttribute &scalarAttribute(int index) const { return m_scalarAttributes[index]; }
+
+    // Attribute the renderers colormap, or -1. Selecting one decodes it if
+    // needed; only the displayed attribute is kept on the GPU. Returns false
+    // if the attribute could not be read.
+    bool setDisplayedScalar(int index);
+    int displayedScalar() const { return m_displayedScalar; }
+
+    // Drops every vertex whose keep byte is 0 (crop, delete, outlier
+    // removal), preserving order, normals and scalar attributes; chunks
+    // shrink in place and a compressed cloud is re-encoded. Returns false
+    // if keep does not match the point count.
+    bool filterVertices(const QVector<quint8> &keep);
+
+    // Copy of the host data, sharing the arrays until either side changes
+    // them; GPU buffers are not copied. Filters work on a copy so the
+    // original can be restored.
+    QSharedPointer<PointCloudData> clone() const;
+
+    // Reorders the vertices along a Morton curve over the bounding box.
+    // Chunks become octree nodes (merged up to ChunkSize points), and within
+    // a chunk points are laid out so every prefix is an even subsample.
+    void sortSpatially();
+    bool isSpatiallySorted() const { return m_spatiallySorted; }
+
+    // Vertex range [first, second) holding the octree node at the given
+    // level (see MortonCode) around code. Chunk granular: a node smaller
+    // than a chunk yields its whole chunk. Empty unless sorted.
+    QPair<int, int> mortonNodeRange(quint64 code, int level) const;
+
+    // Replaces the host vertices with a CompressedPointStore, quantizing
+    // positions to the given step (0 picks one from the bounds). Uploads
+    // decode straight into the mapped vertex buffer. Reports the ratio.
+    void compress(float quantizationStep = 0.0f);
+    void decompress();
+    bool isCompressed() const { return !m_compressed.isNull(); }
+    QSharedPointer<const CompressedPointStore> compressedStore() const { return m_compressed; }
+
+    // Index in the loaded file of every vertex, once reordering made it
+    // differ from the vertex index; empty otherwise.
+    const QVector<quint32> &sourceIndices() const { return m_sourceIndices; }
+
+    // Bumped on every host-side change; renderers compare it against the
+    // revision their VAO was built for.
+    quint64 revision() const { return m_revision; }
+    // Bumped only when positions, colors or vertex order change; per-vertex
+    // data kept elsewhere (a selection) is valid while it stays the same.
+    quint64 vertexRevision() const { return m_vertexRevision; }
+
+    // Queues uploads of the vertices, and of normals and the displayed
+    // scalar into buffers of their own, where the GPU copy is stale. The
+    // data arrives over the next frames as GpuUploadManager processes it.
+    // Requires a current context from the shared group.
+    void uploadToGpu();
+    GLuint vertexBuffer() const { return m_gpuVertices.buffer; }
+    GLuint normalBuffer() const { return m_gpuNormals.buffer; }
+    GLuint scalarBuffer() const { return m_gpuScalars.buffer; }
+    // Leading vertices already on the GPU; chunks past it cannot be drawn
+    // yet. Normals and the scalar are only usable once complete.
+    int gpuVertexCount() const;
+    bool isNormalBufferReady() const;
+    bool isScalarBufferReady() const;
+    // Bumped when a buffer is swapped or an attribute finishes uploading;
+    // renderers rebuild their VAO when it changes.
+    quint64 gpuRevision() const { return m_gpuRevision; }
+    // Returns the buffers to the pool; needs no current context.
+    void releaseGpuResources();
+
+private:
+    void updateBoundingBox();
+    void buildChunks();
+    void updateChunkBounds();
+    // GPU copy of one host array, filled a slice at a time.
+    struct GpuArray {
+        GLuint buffer = 0;
+        // Host revision the buffer holds, or is being filled with.
+        quint64 revision = 0;
+        // Pending upload, 0 once complete.
+        quint64 ticket = 0;
+        int count = 0;
+        int uploaded = 0;
+    };
+
+    void verticesChanged();
+    void scheduleUpload(GpuArray &array, quint64 revision, int count, int elementSize,
+                        const GpuUploadManager::Writer &writer);
+    void releaseGpuArray(GpuArray &array);
+
+    QVector<Vertex> m_vertices;
+    QSharedPointer<const CompressedPointStore> m_compressed;
+    QVector<Chunk> m_chunks;
+    QVector<QVector3D> m_normals;
+    QVector<ScalarAttribute> m_scalarAttributes;
+    int m_displayedScalar;
+    QVector<quint32> m_sourceIndices;
+    bool m_spatiallySorted;
+    QVector3D m_boundingBoxMin;
+    QVector3D m_boundingBoxMax;
+
+    GpuArray m_gpuVertices;
+    GpuArray m_gpuNormals;
+    GpuArray m_gpuScalars;
+    quint64 m_gpuRevision;
+    quint64 m_revision;
+    // Normals and the displayed scalar change after load; track them
+    // separately so updating one does not re-upload the others.
+    quint64 m_vertexRevision;
+    quint64 m_normalRevision;
+    quint64 m_scalarRevision;
+};
+
+#endif // POINTCLOUDDATA_H
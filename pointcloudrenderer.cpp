@@ -1,35 +1,175 @@
 #include "pointcloudrenderer.h"
+#include "outlierfilter.h"
+#include "parallelfor.h"
 #include <QFile>
+#include <QFileInfo>
 #include <QTextStream>
 #include <QDebug>
 #include <QRegularExpression>
 #include <QPaintEvent>
+#include <QPolygonF>
+#include <QStringList>
+#include <QOpenGLContext>
+#include <QtMath>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <limits>
 
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_DEPTH_COMPONENT32F
+#define GL_DEPTH_COMPONENT32F 0x8CAC
+#endif
+#ifndef GL_LOWER_LEFT
+#define GL_LOWER_LEFT 0x8CA1
+#endif
+#ifndef GL_NEGATIVE_ONE_TO_ONE
+#define GL_NEGATIVE_ONE_TO_ONE 0x935E
+#endif
+#ifndef GL_ZERO_TO_ONE
+#define GL_ZERO_TO_ONE 0x935F
+#endif
+
+// Screen-space density the level-of-detail selection aims for, in points per
+// covered point footprint. Anything above ~1 is overdraw.
+static const float LodOverdraw = 4.0f;
+// Chunks are re-sorted front-to-back once the view direction drifts further
+// than this (cosine of ~30 degrees) from the one they were sorted for.
+static const float ResortDirectionCos = 0.866f;
+// Vertical field of view in perspective; orthographic views are scaled to
+// match it at the orbit distance.
+static const float FieldOfView = 45.0f;
+// Near and far sit this fraction outside the visible depth range.
+static const float DepthSlack = 0.01f;
+// Smallest near/far ratio in perspective, for 24-bit fixed-point depth and
+// for reversed-Z floating-point depth, whose precision is nearly uniform
+// in relative terms and so tolerates a far smaller near plane.
+static const float NearFarRatio = 1e-4f;
+static const float ReversedNearFarRatio = 1e-6f;
+// Wheel zoom keeps the orbit distance within these multiples of the scene's
+// bounding-box diagonal; frameScene() starts at 1.5.
+static const float MinZoomDistance = 1e-3f;
+static const float MaxZoomDistance = 100.0f;
+// Points up to this size in pixels are drawn square, see setupShaders().
+static const float SquarePointSize = 2.0f;
+
+// Gribb/Hartmann plane extraction: each frustum plane is a sum or difference
+// of rows of the clip matrix, with inside where dot(plane, (p, 1)) >= 0.
+// Only the four side planes: near and far are fitted to the chunks that
+// pass them (see fitDepthRange()). In perspective they also reject
+// everything behind the eye.
+static void extractFrustumPlanes(const QMatrix4x4 &clip, QVector4D planes[4])
+{
+    const QVector4D r0 = clip.row(0);
+    const QVector4D r1 = clip.row(1);
+    const QVector4D r3 = clip.row(3);
+
+    planes[0] = r3 + r0;
+    planes[1] = r3 - r0;
+    planes[2] = r3 + r1;
+    planes[3] = r3 - r1;
+}
+
+static bool boxInFrustum(const QVector4D planes[4], const QVector3D &boundsMin, const QVector3D &boundsMax)
+{
+    for (int i = 0; i < 4; ++i) {
+        // Only the corner furthest along the plane normal needs testing.
+        const QVector4D &plane = planes[i];
+        const float x = plane.x() >= 0.0f ? boundsMax.x() : boundsMin.x();
+        const float y = plane.y() >= 0.0f ? boundsMax.y() : boundsMin.y();
+        const float z = plane.z() >= 0.0f ? boundsMax.z() : boundsMin.z();
+        if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Widens [nearDepth, farDepth] to the view depths a box spans: its centre's
+// depth plus or minus the half extent projected on the view axis.
+static void extendDepthRange(const QMatrix4x4 &modelView, const QVector3D &boundsMin, const QVector3D &boundsMax,
+                             float &nearDepth, float &farDepth)
+{
+    const QVector4D axis = -modelView.row(2);
+    const QVector3D center = (boundsMin + boundsMax) * 0.5f;
+    const QVector3D halfSize = (boundsMax - boundsMin) * 0.5f;
+    const float depth = axis.x() * center.x() + axis.y() * center.y() + axis.z() * center.z() + axis.w();
+    const float extent = std::abs(axis.x()) * halfSize.x() + std::abs(axis.y()) * halfSize.y()
+                         + std::abs(axis.z()) * halfSize.z();
+    nearDepth = std::min(nearDepth, depth - extent);
+    farDepth = std::max(farDepth, depth + extent);
+}
+
 PointCloudRenderer::PointCloudRenderer(QWidget *parent)
     : QOpenGLWidget(parent),
-    m_vbo(QOpenGLBuffer::VertexBuffer),
+    m_program(&m_roundProgram),
+    m_scene(new PointCloudScene),
+    m_sceneRevision(0),
+    m_activeCloud(-1),
+    m_spatialSortOnLoad(true),
+    m_compressOnLoad(false),
+    m_lodEnabled(true),
+    m_indirectBuffer(0),
+    m_glMultiDrawArrays(nullptr),
+    m_glMultiDrawArraysIndirect(nullptr),
+    m_streamFramed(false),
+    m_surfaceShading(false),
+    m_nearPlane(0.01f),
+    m_farPlane(1000.0f),
+    m_reversedDepth(false),
+    m_glClipControl(nullptr),
+    m_depthFramebuffer(0),
+    m_depthRenderbuffer(0),
+    m_depthTargetSource(0),
+    m_depthTargetReady(false),
     m_distance(5.0f),
-    m_pointSize(2.0f),
     m_rotation(0.0f, 0.0f, 0.0f),
+    m_perspectiveMode(true),
+    m_pointSize(2.0f),
     m_boundingBoxMin(0.0f, 0.0f, 0.0f),
     m_boundingBoxMax(0.0f, 0.0f, 0.0f),
-    m_backgroundColor(0.1f, 0.2f, 0.3f, 1.0f)
+    m_colorMode(ColorMode::Original),
+    m_backgroundColor(0.1f, 0.2f, 0.3f, 1.0f),
+    m_viewOrientation(ViewOrientation::Custom),
+    m_measureMode(MeasureMode::None),
+    m_measureComplete(false),
+    m_volume(),
+    m_pickPointToolEnabled(false),
+    m_hasPickedPoint(false),
+    m_measuredDistance(0.0f),
+    m_selectionMode(SelectionMode::None),
+    m_selecting(false),
+    m_selectionBuffer(0),
+    m_selectionTicket(0),
+    m_selectionBufferRevision(0),
+    m_selectionBufferReady(false)
 {
     setMouseTracking(true);
+
+    // Live streams are drained on paint; poll at display rate.
+    m_streamTimer.setInterval(16);
+    connect(&m_streamTimer, &QTimer::timeout, this, QOverload<>::of(&PointCloudRenderer::update));
 }
 
 PointCloudRenderer::~PointCloudRenderer()
 {
     makeCurrent();
-    m_vbo.destroy();
-    m_vao.destroy();
-    m_program.deleteLater();
+    releaseSelectionBuffer();
+    m_cloudDraws.clear();
+    m_cloud.reset();
+    m_stream.reset();
+    m_streamVao.destroy();
+    if (m_indirectBuffer) {
+        glDeleteBuffers(1, &m_indirectBuffer);
+    }
+    releaseDepthTarget();
+    m_roundProgram.deleteLater();
+    m_squareProgram.deleteLater();
     doneCurrent();
 }
 
@@ -41,8 +181,23 @@ void PointCloudRenderer::initializeGL()
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_PROGRAM_POINT_SIZE);
 
+    // Both are core in the 3.3 context we ask for, but come through the
+    // context so GLES or older drivers fall back to per-chunk glDrawArrays.
+    QOpenGLContext *ctx = context();
+    m_glMultiDrawArrays = reinterpret_cast<MultiDrawArraysProc>(ctx->getProcAddress("glMultiDrawArrays"));
+    const QSurfaceFormat fmt = ctx->format();
+    if ((fmt.majorVersion() > 4 || (fmt.majorVersion() == 4 && fmt.minorVersion() >= 3))
+        || ctx->hasExtension("GL_ARB_multi_draw_indirect")) {
+        m_glMultiDrawArraysIndirect = reinterpret_cast<MultiDrawArraysIndirectProc>(ctx->getProcAddress("glMultiDrawArraysIndirect"));
+    }
+    // Reversed-Z needs depth in [0, 1] rather than [-1, 1]; without it the
+    // float depth buffer gains nothing and the default one is used.
+    if ((fmt.majorVersion() > 4 || (fmt.majorVersion() == 4 && fmt.minorVersion() >= 5))
+        || ctx->hasExtension("GL_ARB_clip_control")) {
+        m_glClipControl = reinterpret_cast<ClipControlProc>(ctx->getProcAddress("glClipControl"));
+    }
+
     setupShaders();
-    setupVertexBuffers();
 
     resetView();
 }
@@ -53,18 +208,59 @@ void PointCloudRenderer::setupShaders()
         #version 330 core
         layout (location = 0) in vec3 position;
         layout (location = 1) in vec3 color;
+        layout (location = 2) in vec3 normal;
+        layout (location = 3) in float scalar;
+        // Normalized selection mask byte; 0 when no selection is bound.
+        layout (location = 4) in float selected;
 
         uniform mat4 projection;
+        // The cloud's transform, and the view times it.
+        uniform mat4 model;
         uniform mat4 modelView;
         uniform float pointSize;
+        uniform bool surfaceShading;
+        // ColorMode: 0 original, 1 unicolor, 2-4 X/Y/Z gradient, 5 scalar.
+        // Gradients run over the scene, so clouds placed side by side
+        // share one ramp.
+        uniform int colorMode;
+        uniform vec2 colorRange;
 
         out vec3 vertexColor;
 
+        vec3 colormap(float t)
+        {
+            t = clamp(t, 0.0, 1.0);
+            return clamp(vec3(1.5 - abs(4.0 * t - 3.0), 1.5 - abs(4.0 * t - 2.0), 1.5 - abs(4.0 * t - 1.0)), 0.0, 1.0);
+        }
+
         void main()
         {
             gl_Position = projection * modelView * vec4(position, 1.0);
             gl_PointSize = pointSize;
-            vertexColor = color;
+
+            float rangeLength = max(colorRange.y - colorRange.x, 1e-20);
+            if (colorMode == 1) {
+                vertexColor = vec3(1.0);
+            } else if (colorMode >= 2 && colorMode <= 4) {
+                vec3 scenePosition = (model * vec4(position, 1.0)).xyz;
+                vertexColor = colormap((scenePosition[colorMode - 2] - colorRange.x) / rangeLength);
+            } else if (colorMode == 5) {
+                vertexColor = colormap((scalar - colorRange.x) / rangeLength);
+            } else {
+                vertexColor = color;
+            }
+
+            // Lambert with a headlight. Normals from PCA have no consistent
+            // sign, so both sides are lit; a zero normal (none bound, or
+            // not estimable) leaves the color as is.
+            if (surfaceShading && dot(normal, normal) > 0.0) {
+                vec3 viewNormal = normalize(mat3(modelView) * normal);
+                vertexColor *= 0.25 + 0.75 * abs(viewNormal.z);
+            }
+
+            if (selected > 0.5) {
+                vertexColor = mix(vertexColor, vec3(1.0, 0.3, 0.1), 0.7);
+            }
         }
     )";
 
@@ -83,69 +279,707 @@ void PointCloudRenderer::setupShaders()
         }
     )";
 
-    if (!m_program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource)) {
-        qDebug() << "Failed to compile vertex shader";
+    // A shader that may discard has its depth test deferred until after
+    // shading, which defeats the front-to-back chunk order. Points up to
+    // two pixels cover the same pixels round or square, so they use this
+    // variant and hidden points are rejected before shading.
+    const char* squareFragmentShaderSource = R"(
+        #version 330 core
+        in vec3 vertexColor;
+        out vec4 fragColor;
+
+        void main()
+        {
+            fragColor = vec4(vertexColor, 1.0);
+        }
+    )";
+
+    const QPair<QOpenGLShaderProgram *, const char *> programs[] = {
+        qMakePair(&m_roundProgram, fragmentShaderSource),
+        qMakePair(&m_squareProgram, squareFragmentShaderSource)
+    };
+    for (const auto &entry : programs) {
+        QOpenGLShaderProgram *program = entry.first;
+        if (!program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShaderSource)) {
+            qDebug() << "Failed to compile vertex shader";
+        }
+
+        if (!program->addShaderFromSourceCode(QOpenGLShader::Fragment, entry.second)) {
+            qDebug() << "Failed to compile fragment shader";
+        }
+
+        if (!program->link()) {
+            qDebug() << "Failed to link shader program";
+        }
     }
+}
 
-    if (!m_program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShaderSource)) {
-        qDebug() << "Failed to compile fragment shader";
+// Keeps one VAO per scene node, created and destroyed with this renderer's
+// context current; only the bindings follow the clouds' buffers.
+void PointCloudRenderer::syncCloudDraws()
+{
+    if (m_sceneRevision != m_scene->revision()) {
+        m_sceneRevision = m_scene->revision();
+        m_boundingBoxMin = m_scene->boundsMin();
+        m_boundingBoxMax = m_scene->boundsMax();
+        m_drawSelection.clear();
+
+        // Another renderer sharing the scene may have removed or replaced
+        // the active cloud.
+        const int active = std::min(m_activeCloud, m_scene->cloudCount() - 1);
+        if (active != m_activeCloud || (active >= 0 && m_scene->node(active).cloud != m_cloud)) {
+            setActiveCloud(active);
+        }
     }
 
-    if (!m_program.link()) {
-        qDebug() << "Failed to link shader program";
+    m_cloudDraws.resize(m_scene->cloudCount());
+    for (int i = 0; i < m_cloudDraws.size(); ++i) {
+        CloudDraw &draw = m_cloudDraws[i];
+        const QSharedPointer<PointCloudData> &cloud = m_scene->node(i).cloud;
+        if (draw.cloud != cloud) {
+            draw.cloud = cloud;
+            draw.revision = 0;
+            draw.gpuRevision = 0;
+        }
+        if (!cloud) {
+            continue;
+        }
+
+        if (draw.revision != cloud->revision()) {
+            draw.revision = cloud->revision();
+            m_drawSelection.clear();
+        }
+        // The selection mask belongs to the active cloud only.
+        const bool withSelection = i == m_activeCloud && m_selectionBufferReady;
+        if (draw.gpuRevision != cloud->gpuRevision() || draw.selectionBound != withSelection) {
+            setupCloudVao(draw, withSelection);
+        }
     }
 }
 
-void PointCloudRenderer::setupVertexBuffers()
+void PointCloudRenderer::setupCloudVao(CloudDraw &draw, bool withSelection)
 {
-    m_vao.create();
-    m_vao.bind();
+    if (!draw.vao) {
+        draw.vao.reset(new QOpenGLVertexArrayObject);
+        draw.vao->create();
+    }
+    draw.vao->bind();
+    m_program->bind();
+
+    const PointCloudData *cloud = draw.cloud.data();
+    glBindBuffer(GL_ARRAY_BUFFER, cloud->vertexBuffer());
+    m_program->enableAttributeArray(0);
+    m_program->setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(Vertex));
+    m_program->enableAttributeArray(1);
+    m_program->setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 3, sizeof(Vertex));
+
+    // Attributes still uploading stay unbound: no normal leaves points
+    // unshaded, and updateColorUniforms() falls back to original colors.
+    if (cloud->isNormalBufferReady()) {
+        glBindBuffer(GL_ARRAY_BUFFER, cloud->normalBuffer());
+        m_program->enableAttributeArray(2);
+        m_program->setAttributeBuffer(2, GL_FLOAT, 0, 3, sizeof(QVector3D));
+    } else {
+        m_program->disableAttributeArray(2);
+    }
 
-    m_vbo.create();
-    m_vbo.bind();
-    m_vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    if (cloud->isScalarBufferReady()) {
+        glBindBuffer(GL_ARRAY_BUFFER, cloud->scalarBuffer());
+        m_program->enableAttributeArray(3);
+        m_program->setAttributeBuffer(3, GL_FLOAT, 0, 1, sizeof(float));
+    } else {
+        m_program->disableAttributeArray(3);
+    }
 
-    if (!m_vertices.isEmpty()) {
-        m_vbo.allocate(m_vertices.constData(), m_vertices.size() * sizeof(Vertex));
+    if (withSelection) {
+        glBindBuffer(GL_ARRAY_BUFFER, m_selectionBuffer);
+        m_program->enableAttributeArray(4);
+        glVertexAttribPointer(4, 1, GL_UNSIGNED_BYTE, GL_TRUE, 1, nullptr);
+    } else {
+        m_program->disableAttributeArray(4);
     }
 
-    m_program.bind();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_program->release();
+    draw.vao->release();
 
-    m_program.enableAttributeArray(0);
-    m_program.setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(Vertex));
+    draw.gpuRevision = cloud->gpuRevision();
+    draw.selectionBound = withSelection;
+}
 
-    m_program.enableAttributeArray(1);
-    m_program.setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 3, sizeof(Vertex));
+void PointCloudRenderer::resizeGL(int w, int h)
+{
+    Q_UNUSED(w);
+    Q_UNUSED(h);
+    // The widget's framebuffer was recreated along with its color buffer.
+    m_depthTargetSize = QSize();
+    updateProjection();
+}
 
-    m_program.release();
-    m_vao.release();
+void PointCloudRenderer::setPerspectiveMode(bool enabled)
+{
+    m_perspectiveMode = enabled;
+    updateProjection();
+    update();
 }
 
-void PointCloudRenderer::resizeGL(int w, int h)
+// Perspective, or orthographic with the extent perspective shows at the
+// orbit distance; near and far come from fitDepthRange(). With reversed-Z
+// the depth row maps near to 1 and far to 0 for a [0, 1] depth range, so
+// floating-point depth keeps its precision at the far end, where a
+// perspective projection crowds its depth values.
+void PointCloudRenderer::updateProjection()
 {
+    const bool capturing = !m_captureImageSize.isEmpty();
+    const float aspect = capturing ? float(m_captureImageSize.width()) / float(m_captureImageSize.height())
+                                   : float(std::max(1, width())) / float(std::max(1, height()));
+    const float n = m_nearPlane;
+    const float f = m_farPlane;
+
     m_projection.setToIdentity();
-    m_projection.perspective(45.0f, float(w) / float(h), 0.01f, 1000.0f);
+    if (m_perspectiveMode) {
+        m_projection.perspective(FieldOfView, aspect, n, f);
+    } else {
+        const float halfHeight = m_distance * std::tan(qDegreesToRadians(FieldOfView * 0.5f));
+        m_projection.ortho(-halfHeight * aspect, halfHeight * aspect, -halfHeight, halfHeight, n, f);
+    }
+
+    if (m_reversedDepth) {
+        if (m_perspectiveMode) {
+            m_projection.setRow(2, QVector4D(0.0f, 0.0f, n / (f - n), f * n / (f - n)));
+        } else {
+            m_projection.setRow(2, QVector4D(0.0f, 0.0f, 1.0f / (f - n), f / (f - n)));
+        }
+    }
+
+    if (capturing) {
+        // Scales the tile's part of the image's clip space up to the whole
+        // of it. Image rows count from the top, GL's from the bottom.
+        const float imageWidth = m_captureImageSize.width();
+        const float imageHeight = m_captureImageSize.height();
+        const float tileWidth = std::max(1.0f, float(width() * devicePixelRatioF()));
+        const float tileHeight = std::max(1.0f, float(height() * devicePixelRatioF()));
+        const float originX = m_captureOrigin.x();
+        const float originY = imageHeight - m_captureOrigin.y() - tileHeight;
+
+        QMatrix4x4 tile;
+        tile(0, 0) = imageWidth / tileWidth;
+        tile(0, 3) = (imageWidth - 2.0f * originX - tileWidth) / tileWidth;
+        tile(1, 1) = imageHeight / tileHeight;
+        tile(1, 3) = (imageHeight - 2.0f * originY - tileHeight) / tileHeight;
+        m_projection = tile * m_projection;
+    }
+}
+
+void PointCloudRenderer::setCaptureTile(const QSize &imageSize, const QPoint &origin)
+{
+    m_captureImageSize = imageSize;
+    m_captureOrigin = origin;
+    updateProjection();
+    update();
+}
+
+void PointCloudRenderer::finishUploads()
+{
+    makeCurrent();
+    for (int i = 0; i < m_scene->cloudCount(); ++i) {
+        const PointCloudScene::Node &node = m_scene->node(i);
+        if (node.visible && node.cloud) {
+            node.cloud->uploadToGpu();
+        }
+    }
+    GpuUploadManager::instance()->finishPendingUploads();
+    doneCurrent();
+}
+
+// Fits near and far around the visible geometry, so depth precision is
+// spent where the points are, whatever the scene's scale. In perspective,
+// near stays a fixed fraction of far: geometry reaching the eye would
+// otherwise collapse the usable range. Nothing visible keeps the last
+// frame's planes.
+void PointCloudRenderer::fitDepthRange(float nearDepth, float farDepth)
+{
+    if (nearDepth > farDepth) {
+        return;
+    }
+
+    if (m_perspectiveMode) {
+        if (farDepth <= 0.0f) {
+            return;
+        }
+        m_farPlane = farDepth * (1.0f + DepthSlack);
+        const float minNear = m_farPlane * (m_reversedDepth ? ReversedNearFarRatio : NearFarRatio);
+        m_nearPlane = std::max(nearDepth * (1.0f - DepthSlack), minNear);
+    } else {
+        // Orthographic depth is linear, so near may lie behind the eye.
+        const float scale = std::max(std::max(std::abs(nearDepth), std::abs(farDepth)), 1.0f);
+        const float slack = std::max((farDepth - nearDepth) * DepthSlack, scale * 1e-6f);
+        m_nearPlane = nearDepth - slack;
+        m_farPlane = farDepth + slack;
+    }
+    updateProjection();
+}
+
+// Builds a framebuffer sharing the widget's color buffer with a float depth
+// buffer of its own, at the same sample count; the widget's default depth
+// buffer is 24-bit fixed point, which reversed-Z cannot improve. Returns
+// false, using the default framebuffer, where that is not possible.
+bool PointCloudRenderer::updateDepthTarget()
+{
+    if (!m_glClipControl) {
+        return false;
+    }
+
+    const QSize targetSize(int(width() * devicePixelRatioF()), int(height() * devicePixelRatioF()));
+    if (m_depthTargetSource == defaultFramebufferObject() && m_depthTargetSize == targetSize) {
+        return m_depthTargetReady;
+    }
+
+    releaseDepthTarget();
+    m_depthTargetSource = defaultFramebufferObject();
+    m_depthTargetSize = targetSize;
+
+    GLint type = GL_NONE;
+    GLint name = 0;
+    GLint samples = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                          GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                          GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+    glGetIntegerv(GL_SAMPLES, &samples);
+    if (type != GL_RENDERBUFFER && type != GL_TEXTURE) {
+        qDebug() << "Reversed depth unavailable: unexpected color attachment";
+        return false;
+    }
+
+    glGenRenderbuffers(1, &m_depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depthRenderbuffer);
+    context()->extraFunctions()->glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT32F,
+                                                                  targetSize.width(), targetSize.height());
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &m_depthFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_depthFramebuffer);
+    if (type == GL_RENDERBUFFER) {
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, GLuint(name));
+    } else {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, GLuint(name), 0);
+    }
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthRenderbuffer);
+    m_depthTargetReady = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    if (!m_depthTargetReady) {
+        qDebug() << "Reversed depth unavailable: incomplete framebuffer";
+    }
+    return m_depthTargetReady;
+}
+
+void PointCloudRenderer::releaseDepthTarget()
+{
+    if (m_depthFramebuffer) {
+        glDeleteFramebuffers(1, &m_depthFramebuffer);
+        m_depthFramebuffer = 0;
+    }
+    if (m_depthRenderbuffer) {
+        glDeleteRenderbuffers(1, &m_depthRenderbuffer);
+        m_depthRenderbuffer = 0;
+    }
+    m_depthTargetReady = false;
 }
 
 void PointCloudRenderer::paintGL()
 {
+    const bool hasCloud = m_scene->pointCount() > 0;
+    if (!hasCloud && !m_stream) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        return;
+    }
+
+    // Reversed-Z: the depth test keeps the larger value and is cleared to
+    // 0 (far). The GL defaults are restored below for QPainter overlays.
+    m_reversedDepth = updateDepthTarget();
+    if (m_reversedDepth) {
+        glBindFramebuffer(GL_FRAMEBUFFER, m_depthFramebuffer);
+        m_glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepthf(0.0f);
+        glDepthFunc(GL_GREATER);
+    }
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_program = m_pointSize <= SquarePointSize ? &m_squareProgram : &m_roundProgram;
+
+    // Queues whatever the visible clouds changed since the last frame, then
+    // moves this frame's share of pending uploads; the clouds fill in over
+    // the following frames.
+    GpuUploadManager *uploads = GpuUploadManager::instance();
+    if (hasCloud) {
+        for (int i = 0; i < m_scene->cloudCount(); ++i) {
+            const PointCloudScene::Node &node = m_scene->node(i);
+            if (node.visible && node.cloud) {
+                node.cloud->uploadToGpu();
+            }
+        }
+        updateSelectionBuffer();
+    }
+    uploads->processPendingUploads();
+
+    if (hasCloud) {
+        syncCloudDraws();
+    }
+
+    m_program->bind();
+
+    updateModelViewMatrix();
+    updateProjection();
+
+    float nearDepth = std::numeric_limits<float>::max();
+    float farDepth = std::numeric_limits<float>::lowest();
+    if (hasCloud) {
+        updateDrawCommands(nearDepth, farDepth);
+    }
+    if (m_stream && m_stream->hasBounds()) {
+        extendDepthRange(m_modelView, m_stream->getBoundingBoxMin(), m_stream->getBoundingBoxMax(),
+                         nearDepth, farDepth);
+    }
+    fitDepthRange(nearDepth, farDepth);
+
+    m_program->setUniformValue("projection", m_projection);
+    m_program->setUniformValue("pointSize", m_pointSize);
+    m_program->setUniformValue("surfaceShading", m_surfaceShading);
+
+    if (hasCloud) {
+        drawClouds();
+    }
+
+    if (m_stream) {
+        drawStream();
+    }
+
+    m_program->release();
+
+    if (m_reversedDepth) {
+        m_glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+        glClearDepthf(1.0f);
+        glDepthFunc(GL_LESS);
+        glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    }
+
+    if (uploads->hasPendingUploads()) {
+        update();
+    }
+}
+
+void PointCloudRenderer::setLodEnabled(bool enabled)
+{
+    m_lodEnabled = enabled;
+    update();
+}
+
+// Also widens [nearDepth, farDepth] to the view depths of the chunks drawn.
+// Chunks are tested in the cloud's coordinates, against the frustum carried
+// back through its transform. Chunks past the uploaded prefix are clipped to
+// it; a sorted chunk's prefix is an even subsample, so a cloud still
+// uploading fills in.
+void PointCloudRenderer::selectChunks(const QVector<PointCloudData::Chunk> &chunks, int uploaded,
+                                      const QMatrix4x4 &projection, const QMatrix4x4 &modelView, bool perspective,
+                                      float pixelsPerUnit, float footprint, bool thin, QVector<int> &counts,
+                                      float &nearDepth, float &farDepth)
+{
+    QVector4D planes[4];
+    extractFrustumPlanes(projection * modelView, planes);
+
+    for (const PointCloudData::Chunk &chunk : chunks) {
+        if (!boxInFrustum(planes, chunk.boundsMin, chunk.boundsMax)) {
+            counts.append(0);
+            continue;
+        }
+
+        int count = std::min(chunk.count, std::max(0, uploaded - chunk.first));
+        if (thin) {
+            const QVector3D center = (chunk.boundsMin + chunk.boundsMax) * 0.5f;
+            const float radius = (chunk.boundsMax - chunk.boundsMin).length() * 0.5f;
+            const float depth = perspective ? -modelView.map(center).z() : 1.0f;
+            if (!perspective || depth > radius) {
+                const float screenRadius = radius * pixelsPerUnit / depth;
+                const float target = float(M_PI) * screenRadius * screenRadius * LodOverdraw / footprint;
+                count = std::min(count, std::max(int(target), std::min(chunk.count, 256)));
+            }
+        }
+        if (count > 0) {
+            extendDepthRange(modelView, chunk.boundsMin, chunk.boundsMax, nearDepth, farDepth);
+        }
+        counts.append(count);
+    }
+}
+
+void PointCloudRenderer::updateDrawCommands(float &nearDepth, float &farDepth)
+{
+    // Pixels covered by one world unit at view depth 1 in perspective, or
+    // at any depth in orthographic views.
+    const float pixelsPerUnit = 0.5f * height() * devicePixelRatioF() * m_projection(1, 1);
+    const float footprint = std::max(m_pointSize * m_pointSize, 1.0f);
+
+    // Point count drawn from each chunk of each visible cloud, in scene
+    // order, 0 when culled.
+    m_chunkSelection.clear();
+    for (int c = 0; c < m_scene->cloudCount(); ++c) {
+        const PointCloudScene::Node &node = m_scene->node(c);
+        if (!node.visible || !node.cloud) {
+            continue;
+        }
+        // Only a sorted chunk's prefix thins it evenly; in file order it is
+        // a strip (a scan line or tile) and would drop whole regions.
+        const bool thin = m_lodEnabled && node.cloud->isSpatiallySorted();
+        selectChunks(node.cloud->chunks(), node.cloud->gpuVertexCount(), m_projection, m_modelView * node.transform,
+                     m_perspectiveMode, pixelsPerUnit, footprint, thin, m_chunkSelection, nearDepth, farDepth);
+    }
+
+    const QVector3D viewDirection = -m_modelView.row(2).toVector3D();
+    const bool resort = QVector3D::dotProduct(viewDirection, m_drawSortDirection) < ResortDirectionCos;
+    if (m_chunkSelection == m_drawSelection && !resort) {
+        return;
+    }
+    m_drawSelection = m_chunkSelection;
+    m_drawSortDirection = viewDirection;
+
+    // Front-to-back by chunk centre within each cloud, so dense scans
+    // reject hidden points early. Each cloud draws a contiguous range of
+    // the list, since its VAO differs.
+    m_drawFirst.clear();
+    m_drawCount.clear();
+    int selection = 0;
+    for (int c = 0; c < m_cloudDraws.size(); ++c) {
+        CloudDraw &draw = m_cloudDraws[c];
+        const PointCloudScene::Node &node = m_scene->node(c);
+        draw.firstCommand = m_drawFirst.size();
+        draw.commandCount = 0;
+        if (!node.visible || !node.cloud) {
+            continue;
+        }
+
+        const QMatrix4x4 modelView = m_modelView * node.transform;
+        const QVector<PointCloudData::Chunk> &chunks = node.cloud->chunks();
+        m_drawOrder.clear();
+        for (int i = 0; i < chunks.size(); ++i) {
+            if (m_drawSelection[selection + i] > 0) {
+                const QVector3D center = (chunks[i].boundsMin + chunks[i].boundsMax) * 0.5f;
+                m_drawOrder.append(qMakePair(-modelView.map(center).z(), i));
+            }
+        }
+        std::sort(m_drawOrder.begin(), m_drawOrder.end());
+
+        for (const QPair<float, int> &entry : m_drawOrder) {
+            m_drawFirst.append(chunks[entry.second].first);
+            m_drawCount.append(m_drawSelection[selection + entry.second]);
+        }
+        draw.commandCount = m_drawFirst.size() - draw.firstCommand;
+        selection += chunks.size();
+    }
+
+    if (m_glMultiDrawArraysIndirect) {
+        QVector<DrawArraysIndirectCommand> commands(m_drawFirst.size());
+        for (int i = 0; i < commands.size(); ++i) {
+            commands[i].count = GLuint(m_drawCount[i]);
+            commands[i].instanceCount = 1;
+            commands[i].first = GLuint(m_drawFirst[i]);
+            commands[i].baseInstance = 0;
+        }
+
+        if (!m_indirectBuffer) {
+            glGenBuffers(1, &m_indirectBuffer);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawArraysIndirectCommand),
+                     commands.constData(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
+
+// One multi-draw per visible cloud, from its range of the shared command
+// list; only the transform, color uniforms and VAO change in between.
+void PointCloudRenderer::drawClouds()
+{
+    if (m_drawFirst.isEmpty()) {
+        return;
+    }
+
+    if (m_glMultiDrawArraysIndirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+    }
+    for (int c = 0; c < m_cloudDraws.size(); ++c) {
+        const CloudDraw &draw = m_cloudDraws[c];
+        if (draw.commandCount == 0 || !draw.vao) {
+            continue;
+        }
+
+        const PointCloudScene::Node &node = m_scene->node(c);
+        m_program->setUniformValue("model", node.transform);
+        m_program->setUniformValue("modelView", m_modelView * node.transform);
+        updateColorUniforms(node.colorMode, node.cloud.data());
+
+        const GLsizei drawCount = static_cast<GLsizei>(draw.commandCount);
+        draw.vao->bind();
+        if (m_glMultiDrawArraysIndirect) {
+            const qintptr offset = qintptr(draw.firstCommand) * qintptr(sizeof(DrawArraysIndirectCommand));
+            m_glMultiDrawArraysIndirect(GL_POINTS, reinterpret_cast<const void *>(offset), drawCount, 0);
+        } else if (m_glMultiDrawArrays) {
+            m_glMultiDrawArrays(GL_POINTS, m_drawFirst.constData() + draw.firstCommand,
+                                m_drawCount.constData() + draw.firstCommand, drawCount);
+        } else {
+            for (int i = draw.firstCommand; i < draw.firstCommand + draw.commandCount; ++i) {
+                glDrawArrays(GL_POINTS, m_drawFirst[i], m_drawCount[i]);
+            }
+        }
+        draw.vao->release();
+    }
+    if (m_glMultiDrawArraysIndirect) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+}
+
+void PointCloudRenderer::setColorMode(ColorMode mode)
+{
+    m_colorMode = mode;
+    if (m_activeCloud >= 0) {
+        m_scene->setColorMode(m_activeCloud, mode);
+    }
+    update();
+}
+
+PointCloudRenderer::ColorMode PointCloudRenderer::getColorMode() const
+{
+    return m_activeCloud >= 0 ? m_scene->node(m_activeCloud).colorMode : m_colorMode;
+}
+
+bool PointCloudRenderer::setScalarColoring(int attribute)
+{
+    if (!m_cloud || !m_cloud->setDisplayedScalar(attribute)) {
+        return false;
+    }
+    setColorMode(attribute >= 0 ? ColorMode::Scalar : ColorMode::Original);
+    return true;
+}
+
+// Gradients span the scene bounds; cloud is null for live points.
+void PointCloudRenderer::updateColorUniforms(ColorMode mode, const PointCloudData *cloud)
+{
+    QVector2D range(0.0f, 1.0f);
+
+    switch (mode) {
+    case ColorMode::XGradient:
+    case ColorMode::YGradient:
+    case ColorMode::ZGradient: {
+        const int axis = int(mode) - int(ColorMode::XGradient);
+        range = QVector2D(m_boundingBoxMin[axis], m_boundingBoxMax[axis]);
+        break;
+    }
+    case ColorMode::Scalar:
+        if (cloud && cloud->isScalarBufferReady()) {
+            // Shader values are relative to the attribute's offset.
+            const ScalarAttribute &attribute = cloud->scalarAttribute(cloud->displayedScalar());
+            range = QVector2D(float(attribute.statistics().low - attribute.offset()),
+                              float(attribute.statistics().high - attribute.offset()));
+        } else {
+            mode = ColorMode::Original;
+        }
+        break;
+    default:
+        break;
+    }
+
+    m_program->setUniformValue("colorMode", int(mode));
+    m_program->setUniformValue("colorRange", range);
+}
+
+void PointCloudRenderer::setSurfaceShading(bool enabled)
+{
+    if (m_surfaceShading == enabled) {
+        return;
+    }
+    m_surfaceShading = enabled;
+    update();
+}
+
+void PointCloudRenderer::setPointStream(const QSharedPointer<PointStream> &stream)
+{
+    if (m_stream == stream) {
+        return;
+    }
+
+    if (isValid()) {
+        makeCurrent();
+        m_streamVao.destroy();
+        m_stream = stream;
+        doneCurrent();
+    } else {
+        m_stream = stream;
+    }
+    m_streamFramed = false;
+
+    if (m_stream) {
+        m_streamTimer.start();
+    } else {
+        m_streamTimer.stop();
+    }
+    update();
+}
+
+void PointCloudRenderer::drawStream()
+{
+    QOpenGLExtraFunctions *gl = context()->extraFunctions();
 
-    if (!m_vertices.isEmpty()) {
-        m_program.bind();
-        m_vao.bind();
+    // Frame the live points once, unless loaded clouds already did.
+    if (m_stream->update(gl) && !m_streamFramed && m_stream->hasBounds() && m_scene->pointCount() == 0) {
+        m_boundingBoxMin = m_stream->getBoundingBoxMin();
+        m_boundingBoxMax = m_stream->getBoundingBoxMax();
+        m_modelCenter = (m_boundingBoxMin + m_boundingBoxMax) * 0.5f;
+        m_distance = (m_boundingBoxMax - m_boundingBoxMin).length() * 1.5f;
+        m_streamFramed = true;
 
         updateModelViewMatrix();
+    }
+
+    if (!m_streamVao.isCreated()) {
+        m_streamVao.create();
+        m_streamVao.bind();
+        m_stream->vertexBuffer().bind();
+
+        m_program->enableAttributeArray(0);
+        m_program->setAttributeBuffer(0, GL_FLOAT, 0, 3, sizeof(Vertex));
 
-        m_program.setUniformValue("projection", m_projection);
-        m_program.setUniformValue("modelView", m_modelView);
-        m_program.setUniformValue("pointSize", m_pointSize);
+        m_program->enableAttributeArray(1);
+        m_program->setAttributeBuffer(1, GL_FLOAT, 3 * sizeof(float), 3, sizeof(Vertex));
 
-        glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(m_vertices.size()));
+        m_stream->vertexBuffer().release();
+        m_streamVao.release();
+    }
+
+    m_streamFirst.clear();
+    m_streamCount.clear();
+    m_stream->appendDrawRanges(m_streamFirst, m_streamCount);
+    if (m_streamFirst.isEmpty()) {
+        return;
+    }
+
+    // Live points are in scene coordinates and carry no scalar attributes,
+    // so Scalar falls back to original colors.
+    m_program->setUniformValue("model", QMatrix4x4());
+    m_program->setUniformValue("modelView", m_modelView);
+    updateColorUniforms(m_colorMode, nullptr);
 
-        m_vao.release();
-        m_program.release();
+    m_streamVao.bind();
+    if (m_glMultiDrawArrays) {
+        m_glMultiDrawArrays(GL_POINTS, m_streamFirst.constData(), m_streamCount.constData(),
+                            static_cast<GLsizei>(m_streamFirst.size()));
+    } else {
+        for (int i = 0; i < m_streamFirst.size(); ++i) {
+            glDrawArrays(GL_POINTS, m_streamFirst[i], m_streamCount[i]);
+        }
     }
+    m_streamVao.release();
+
+    m_stream->markDrawn(gl);
 }
 
 void PointCloudRenderer::paintEvent(QPaintEvent *event)
@@ -157,6 +991,15 @@ void PointCloudRenderer::paintEvent(QPaintEvent *event)
     if (m_showCoordinateSystem) {
         drawCoordinateSystem(painter);
     }
+    if (!m_measurePoints.isEmpty()) {
+        drawMeasurementLine(painter);
+    }
+    if (m_pickPointToolEnabled && m_hasPickedPoint) {
+        drawPickedPointInfo(painter);
+    }
+    if (m_selecting) {
+        drawSelectionPath(painter);
+    }
 }
 
 void PointCloudRenderer::drawCoordinateSystem(QPainter &painter)
@@ -225,322 +1068,324 @@ void PointCloudRenderer::drawCoordinateSystem(QPainter &painter)
     painter.drawText(xPos + 10 + scaleLength / 2 - 10, scaleY - 5, "0.2");
 }
 
-bool PointCloudRenderer::loadPtsFile(const QString &filename)
+bool PointCloudRenderer::loadPtsFile(const QString &filename, bool addToScene)
 {
-    QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        qDebug() << "Failed to open .pts file:" << filename;
+    QSharedPointer<PointCloudData> cloud(new PointCloudData);
+    if (!cloud->loadPtsFile(filename)) {
         return false;
     }
+    if (m_spatialSortOnLoad) {
+        cloud->sortSpatially();
+    }
+    if (m_compressOnLoad) {
+        cloud->compress();
+    }
 
-    m_vertices.clear();
-
-    m_boundingBoxMin = QVector3D(std::numeric_limits<float>::max(),
-                                 std::numeric_limits<float>::max(),
-                                 std::numeric_limits<float>::max());
-    m_boundingBoxMax = QVector3D(std::numeric_limits<float>::lowest(),
-                                 std::numeric_limits<float>::lowest(),
-                                 std::numeric_limits<float>::lowest());
+    const QString name = QFileInfo(filename).fileName();
+    if (addToScene) {
+        addPointCloud(cloud, name);
+    } else {
+        setPointCloud(cloud, name);
+    }
 
-    QTextStream in(&file);
-    while (!in.atEnd()) {
-        QString line = in.readLine().trimmed();
-        if (line.isEmpty() || line.startsWith('#')) {
-            continue;
-        }
+    qDebug() << "Loaded" << cloud->pointCount() << "points from .pts file";
+    return true;
+}
 
-        QStringList parts = line.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+bool PointCloudRenderer::loadPlyFile(const QString &filename, bool addToScene)
+{
+    QSharedPointer<PointCloudData> cloud(new PointCloudData);
+    if (!cloud->loadPlyFile(filename)) {
+        return false;
+    }
+    if (m_spatialSortOnLoad) {
+        cloud->sortSpatially();
+    }
+    if (m_compressOnLoad) {
+        cloud->compress();
+    }
 
-        if (parts.size() >= 3) {
-            float x = parts[0].toFloat();
-            float y = parts[1].toFloat();
-            float z = parts[2].toFloat();
-
-            QVector3D pos(x, y, z);
-            QVector3D color(1.0f, 1.0f, 1.0f);
-
-            if (parts.size() >= 6) {
-                color = QVector3D(
-                    parts[3].toFloat() / 255.0f,
-                    parts[4].toFloat() / 255.0f,
-                    parts[5].toFloat() / 255.0f
-                    );
-            }
-
-            Vertex vertex = {pos, color};
-            m_vertices.append(vertex);
-
-            m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), x));
-            m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), y));
-            m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), z));
-
-            m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), x));
-            m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), y));
-            m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), z));
-        }
+    const QString name = QFileInfo(filename).fileName();
+    if (addToScene) {
+        addPointCloud(cloud, name);
+    } else {
+        setPointCloud(cloud, name);
     }
 
-    file.close();
-
-    m_modelCenter = (m_boundingBoxMin + m_boundingBoxMax) * 0.5f;
-    QVector3D size = m_boundingBoxMax - m_boundingBoxMin;
-    m_distance = size.length() * 1.5f;
-
-    makeCurrent();
-    setupVertexBuffers();
-    doneCurrent();
-
-    resetView();
-    update();
-
-    qDebug() << "Loaded" << m_vertices.size() << "points from .pts file";
+    qDebug() << "Loaded" << cloud->pointCount() << "points from .ply file";
     return true;
 }
 
-bool PointCloudRenderer::loadPlyFile(const QString &filename)
+void PointCloudRenderer::setPointCloud(const QSharedPointer<PointCloudData> &cloud, const QString &name)
 {
-    std::ifstream file(filename.toStdString(), std::ios::binary);
-    if (!file.is_open()) {
-        qDebug() << "Failed to open .ply file:" << filename;
-        return false;
+    if (m_scene->cloudCount() == 1 && m_scene->node(0).cloud == cloud) {
+        return;
     }
 
-    m_vertices.clear();
+    m_scene->clear();
+    if (cloud) {
+        m_scene->addCloud(cloud, name, QMatrix4x4(), m_colorMode);
+    }
+    setActiveCloud(cloud ? 0 : -1);
+    frameScene();
+}
 
-    m_boundingBoxMin = QVector3D(std::numeric_limits<float>::max(),
-                                 std::numeric_limits<float>::max(),
-                                 std::numeric_limits<float>::max());
-    m_boundingBoxMax = QVector3D(std::numeric_limits<float>::lowest(),
-                                 std::numeric_limits<float>::lowest(),
-                                 std::numeric_limits<float>::lowest());
+void PointCloudRenderer::setScene(const QSharedPointer<PointCloudScene> &scene)
+{
+    if (!scene || m_scene == scene) {
+        return;
+    }
+    m_scene = scene;
+    m_sceneRevision = 0;
+    setActiveCloud(m_scene->cloudCount() > 0 ? 0 : -1);
+    frameScene();
+}
 
-    std::string line;
-    int numVertices = 0;
-    bool isBinary = false;
-    bool isBigEndian = false;
-    bool hasColors = false;
-    bool headerEnd = false;
+int PointCloudRenderer::addPointCloud(const QSharedPointer<PointCloudData> &cloud, const QString &name)
+{
+    const int index = m_scene->addCloud(cloud, name, QMatrix4x4(), m_colorMode);
+    setActiveCloud(index);
+    frameScene();
+    return index;
+}
 
-    enum PropertyType { PROP_NONE, PROP_FLOAT, PROP_UCHAR };
-    struct PropertyInfo {
-        std::string name;
-        PropertyType type;
-    };
-    std::vector<PropertyInfo> properties;
-    int xIndex = -1, yIndex = -1, zIndex = -1;
-    int redIndex = -1, greenIndex = -1, blueIndex = -1;
+void PointCloudRenderer::removeCloud(int index)
+{
+    if (index < 0 || index >= m_scene->cloudCount()) {
+        return;
+    }
+    m_scene->removeCloud(index);
 
-    while (std::getline(file, line)) {
-        std::istringstream ls(line);
-        std::string keyword;
-        ls >> keyword;
+    int active = m_activeCloud;
+    if (active > index) {
+        --active;
+    }
+    setActiveCloud(std::min(active, m_scene->cloudCount() - 1));
+    m_boundingBoxMin = m_scene->boundsMin();
+    m_boundingBoxMax = m_scene->boundsMax();
+    update();
+}
 
-        if (keyword == "end_header") {
-            headerEnd = true;
-            break;
-        } else if (keyword == "format") {
-            std::string format, version;
-            ls >> format >> version;
-            if (format == "ascii") {
-                isBinary = false;
-            } else if (format == "binary_little_endian") {
-                isBinary = true;
-                isBigEndian = false;
-            } else if (format == "binary_big_endian") {
-                isBinary = true;
-                isBigEndian = true;
-                qDebug() << "Warning: Big endian binary PLY files might not be correctly supported.";
-            }
-        } else if (keyword == "element" && line.find("vertex") != std::string::npos) {
-            ls >> keyword >> numVertices;
-        } else if (keyword == "property") {
-            std::string type, name;
-            ls >> type >> name;
-
-            PropertyInfo prop;
-            prop.name = name;
-
-            if (type == "float" || type == "float32") {
-                prop.type = PROP_FLOAT;
-            } else if (type == "uchar" || type == "uint8") {
-                prop.type = PROP_UCHAR;
-            } else {
-                prop.type = PROP_NONE;
-            }
+// Tools hold on to the active cloud's vertex order, so switching clouds
+// ends the current selection and measurement.
+void PointCloudRenderer::setActiveCloud(int index)
+{
+    if (index < 0 || index >= m_scene->cloudCount()) {
+        index = -1;
+    }
+    m_activeCloud = index;
 
-            if (prop.type != PROP_NONE) {
-                int propIndex = properties.size();
-                if (name == "x") xIndex = propIndex;
-                else if (name == "y") yIndex = propIndex;
-                else if (name == "z") zIndex = propIndex;
-                else if (name == "red") {
-                    redIndex = propIndex;
-                    hasColors = true;
-                }
-                else if (name == "green") greenIndex = propIndex;
-                else if (name == "blue") blueIndex = propIndex;
-
-                properties.push_back(prop);
-            }
+    // Filtered clouds that left the scene take their originals with them.
+    for (int i = m_unfilteredClouds.size() - 1; i >= 0; --i) {
+        if (m_scene->indexOf(m_unfilteredClouds[i].first.data()) < 0) {
+            m_unfilteredClouds.remove(i);
         }
     }
 
-    if (!headerEnd || xIndex == -1 || yIndex == -1 || zIndex == -1) {
-        qDebug() << "Invalid PLY file format or missing coordinate properties";
-        file.close();
-        return false;
+    const QSharedPointer<PointCloudData> cloud = index >= 0 ? m_scene->node(index).cloud
+                                                            : QSharedPointer<PointCloudData>();
+    if (m_cloud == cloud) {
+        return;
     }
+    m_cloud = cloud;
 
-    m_vertices.reserve(numVertices);
-
-    if (!isBinary) {
-        for (int i = 0; i < numVertices; i++) {
-            std::getline(file, line);
-            std::istringstream ss(line);
-
-            std::vector<float> values(properties.size(), 0.0f);
-
-            for (size_t j = 0; j < properties.size(); j++) {
-                if (properties[j].type == PROP_FLOAT) {
-                    float val;
-                    ss >> val;
-                    values[j] = val;
-                } else if (properties[j].type == PROP_UCHAR) {
-                    int val;
-                    ss >> val;
-                    values[j] = static_cast<float>(val);
-                }
-            }
-
-            float x = values[xIndex];
-            float y = values[yIndex];
-            float z = values[zIndex];
-
-            QVector3D pos(x, y, z);
-            QVector3D color(1.0f, 1.0f, 1.0f);
-
-            if (hasColors && redIndex != -1 && greenIndex != -1 && blueIndex != -1) {
-                float r = values[redIndex];
-                float g = values[greenIndex];
-                float b = values[blueIndex];
+    m_measurement.setPointCloud(m_cloud);
+    clearMeasurement();
+    m_hasPickedPoint = false;
 
-                if (properties[redIndex].type == PROP_UCHAR) {
-                    r /= 255.0f;
-                    g /= 255.0f;
-                    b /= 255.0f;
-                }
+    m_selection.setPointCloud(m_cloud);
+    m_selecting = false;
+    releaseSelectionBuffer();
+    emit selectionChanged(0);
+    update();
+}
 
-                color = QVector3D(r, g, b);
-            }
+void PointCloudRenderer::setCloudTransform(int index, const QMatrix4x4 &transform)
+{
+    m_scene->setTransform(index, transform);
+    // Measured points are in scene coordinates.
+    if (index == m_activeCloud) {
+        clearMeasurement();
+        m_hasPickedPoint = false;
+    }
+    m_boundingBoxMin = m_scene->boundsMin();
+    m_boundingBoxMax = m_scene->boundsMax();
+    update();
+}
 
-            Vertex vertex = {pos, color};
-            m_vertices.append(vertex);
+void PointCloudRenderer::setCloudVisible(int index, bool visible)
+{
+    m_scene->setVisible(index, visible);
+    m_boundingBoxMin = m_scene->boundsMin();
+    m_boundingBoxMax = m_scene->boundsMax();
+    update();
+}
 
-            m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), x));
-            m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), y));
-            m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), z));
+void PointCloudRenderer::frameScene()
+{
+    m_boundingBoxMin = m_scene->boundsMin();
+    m_boundingBoxMax = m_scene->boundsMax();
 
-            m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), x));
-            m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), y));
-            m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), z));
-        }
-    } else {
-        const int MAX_PROPS = 32;
-        char buffer[MAX_PROPS * sizeof(float)];
-
-        for (int i = 0; i < numVertices; i++) {
-            std::vector<float> values(properties.size(), 0.0f);
-
-            for (size_t j = 0; j < properties.size(); j++) {
-                if (properties[j].type == PROP_FLOAT) {
-                    float val;
-                    file.read(reinterpret_cast<char*>(&val), sizeof(float));
-                    values[j] = val;
-                } else if (properties[j].type == PROP_UCHAR) {
-                    unsigned char val;
-                    file.read(reinterpret_cast<char*>(&val), sizeof(unsigned char));
-                    values[j] = static_cast<float>(val);
-                }
-            }
+    m_modelCenter = (m_boundingBoxMin + m_boundingBoxMax) * 0.5f;
+    QVector3D size = m_boundingBoxMax - m_boundingBoxMin;
+    m_distance = size.length() * 1.5f;
 
-            if (file.fail()) {
-                qDebug() << "Error reading binary PLY data";
-                file.close();
-                return false;
-            }
+    setViewOrientation(m_viewOrientation);
+}
 
-            float x = values[xIndex];
-            float y = values[yIndex];
-            float z = values[zIndex];
+QMatrix4x4 PointCloudRenderer::activeTransform() const
+{
+    return m_activeCloud >= 0 ? m_scene->node(m_activeCloud).transform : QMatrix4x4();
+}
 
-            QVector3D pos(x, y, z);
-            QVector3D color(1.0f, 1.0f, 1.0f);
+void PointCloudRenderer::setViewport(const ViewportObject::ViewportParameters& params)
+{
+    m_modelView = params.modelViewMatrix;
+    m_projection = params.projectionMatrix;
+    m_distance = params.cameraDistance;
+    m_rotation = params.rotation;
+    m_modelCenter = params.modelCenter;
+    m_pointSize = params.pointSize;
+    m_boundingBoxMin = params.boundingBoxMin;
+    m_boundingBoxMax = params.boundingBoxMax;
+    m_perspectiveMode = params.perspectiveMode;
 
-            if (hasColors && redIndex != -1 && greenIndex != -1 && blueIndex != -1) {
-                float r = values[redIndex];
-                float g = values[greenIndex];
-                float b = values[blueIndex];
+    if (!params.sceneState.isEmpty()) {
+        m_scene->restoreState(params.sceneState);
+    }
+    if (params.activeCloud >= 0) {
+        setActiveCloud(params.activeCloud);
+    }
 
-                if (properties[redIndex].type == PROP_UCHAR) {
-                    r /= 255.0f;
-                    g /= 255.0f;
-                    b /= 255.0f;
-                }
+    updateModelViewMatrix();
+}
 
-                color = QVector3D(r, g, b);
-            }
+bool PointCloudRenderer::applyPassThroughFilter(int axis, float minValue, float maxValue)
+{
+    QVector<quint8> keep;
+    return m_cloud && OutlierFilter::passThroughMask(*m_cloud, axis, minValue, maxValue, keep)
+           && applyFilterMask(keep);
+}
 
-            Vertex vertex = {pos, color};
-            m_vertices.append(vertex);
+bool PointCloudRenderer::applyStatisticalOutlierFilter(int neighbors, double stdDevMultiplier)
+{
+    QVector<quint8> keep;
+    return m_cloud && OutlierFilter::statisticalMask(*m_cloud, neighbors, stdDevMultiplier, keep)
+           && applyFilterMask(keep);
+}
 
-            m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), x));
-            m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), y));
-            m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), z));
+bool PointCloudRenderer::applyRadiusOutlierFilter(float radius, int minNeighbors)
+{
+    QVector<quint8> keep;
+    return m_cloud && OutlierFilter::radiusMask(*m_cloud, radius, minNeighbors, keep) && applyFilterMask(keep);
+}
 
-            m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), x));
-            m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), y));
-            m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), z));
+bool PointCloudRenderer::hasFilters() const
+{
+    for (const auto &entry : m_unfilteredClouds) {
+        if (entry.first == m_cloud) {
+            return true;
         }
     }
+    return false;
+}
 
-    file.close();
-
-    m_modelCenter = (m_boundingBoxMin + m_boundingBoxMax) * 0.5f;
-    QVector3D size = m_boundingBoxMax - m_boundingBoxMin;
-    m_distance = size.length() * 1.5f;
+void PointCloudRenderer::resetFilters()
+{
+    for (int i = 0; i < m_unfilteredClouds.size(); ++i) {
+        if (m_unfilteredClouds[i].first == m_cloud) {
+            const QSharedPointer<PointCloudData> unfiltered = m_unfilteredClouds[i].second;
+            m_unfilteredClouds.remove(i);
+            replaceActiveCloud(unfiltered);
+            update();
+            return;
+        }
+    }
+}
 
-    makeCurrent();
-    setupVertexBuffers();
-    doneCurrent();
+// Shows a filtered copy of the active cloud in its place, reframed to the
+// scene bounds, holding on to the unfiltered one for resetFilters().
+bool PointCloudRenderer::applyFilterMask(const QVector<quint8> &keep)
+{
+    QSharedPointer<PointCloudData> filtered = m_cloud->clone();
+    if (!filtered->filterVertices(keep)) {
+        return false;
+    }
+    if (filtered->pointCount() == m_cloud->pointCount()) {
+        return true;
+    }
 
-    resetView();
+    QSharedPointer<PointCloudData> unfiltered = m_cloud;
+    for (int i = 0; i < m_unfilteredClouds.size(); ++i) {
+        if (m_unfilteredClouds[i].first == m_cloud) {
+            unfiltered = m_unfilteredClouds[i].second;
+            m_unfilteredClouds.remove(i);
+            break;
+        }
+    }
+    replaceActiveCloud(filtered);
+    m_unfilteredClouds.append(qMakePair(filtered, unfiltered));
     update();
-
-    qDebug() << "Loaded" << m_vertices.size() << "points from .ply file";
     return true;
 }
 
-void PointCloudRenderer::setViewport(const ViewportObject::ViewportParameters& params)
+void PointCloudRenderer::replaceActiveCloud(const QSharedPointer<PointCloudData> &cloud)
 {
-    m_modelView = params.modelViewMatrix;
-    m_projection = params.projectionMatrix;
-    m_distance = params.cameraDistance;
-    m_rotation = params.rotation;
-    m_modelCenter = params.modelCenter;
-    m_pointSize = params.pointSize;
-    m_boundingBoxMin = params.boundingBoxMin;
-    m_boundingBoxMax = params.boundingBoxMax;
+    m_scene->setCloud(m_activeCloud, cloud);
+    setActiveCloud(m_activeCloud);
+    frameScene();
+}
 
+void PointCloudRenderer::resetView()
+{
+    m_rotation = QVector3D(0.0f, 0.0f, 0.0f);
     updateModelViewMatrix();
+    update();
 }
 
-void PointCloudRenderer::resetView()
+// The camera only rotates about X then Y, so the preset views assume a Y-up
+// cloud: Front looks down -Z, Top looks down -Y and Side looks down -X.
+void PointCloudRenderer::setTopView()
+{
+    m_rotation = QVector3D(90.0f, 0.0f, 0.0f);
+    updateModelViewMatrix();
+    update();
+}
+
+void PointCloudRenderer::setFrontView()
 {
     m_rotation = QVector3D(0.0f, 0.0f, 0.0f);
     updateModelViewMatrix();
     update();
 }
 
+void PointCloudRenderer::setSideView()
+{
+    m_rotation = QVector3D(0.0f, -90.0f, 0.0f);
+    updateModelViewMatrix();
+    update();
+}
+
+void PointCloudRenderer::setViewOrientation(ViewOrientation orientation)
+{
+    m_viewOrientation = orientation;
+
+    switch (orientation) {
+    case ViewOrientation::Top:
+        setTopView();
+        break;
+    case ViewOrientation::Front:
+        setFrontView();
+        break;
+    case ViewOrientation::Side:
+        setSideView();
+        break;
+    case ViewOrientation::Custom:
+        resetView();
+        break;
+    }
+}
+
 void PointCloudRenderer::updateModelViewMatrix()
 {
     m_modelView.setToIdentity();
@@ -562,20 +1407,41 @@ ViewportObject::ViewportParameters PointCloudRenderer::getViewportParameters() c
     params.pointSize = m_pointSize;
     params.boundingBoxMin = m_boundingBoxMin;
     params.boundingBoxMax = m_boundingBoxMax;
+    params.perspectiveMode = m_perspectiveMode;
+    params.sceneState = m_scene->state();
+    params.activeCloud = m_activeCloud;
     return params;
 }
 
 void PointCloudRenderer::mousePressEvent(QMouseEvent *event)
 {
     m_lastMousePos = event->pos();
+    m_pressMousePos = event->pos();
+
+    if (event->button() == Qt::LeftButton && m_selectionMode != SelectionMode::None) {
+        m_selecting = true;
+        m_selectionPath.clear();
+        m_selectionPath.append(event->pos());
+    }
 }
 
 void PointCloudRenderer::mouseMoveEvent(QMouseEvent *event)
 {
-    if (event->buttons() & Qt::LeftButton) {
+    if (m_selecting) {
+        const QPointF pos = event->pos();
+        if (m_selectionMode == SelectionMode::Box) {
+            const QPointF start = m_selectionPath.first();
+            m_selectionPath.clear();
+            m_selectionPath << start << QPointF(pos.x(), start.y()) << pos << QPointF(start.x(), pos.y());
+        } else if ((pos - m_selectionPath.last()).manhattanLength() > 2.0) {
+            m_selectionPath.append(pos);
+        }
+        update();
+    } else if (event->buttons() & Qt::LeftButton) {
         QPoint delta = event->pos() - m_lastMousePos;
         m_rotation.setY(m_rotation.y() + delta.x() * 0.5f);
         m_rotation.setX(m_rotation.x() + delta.y() * 0.5f);
+        m_viewOrientation = ViewOrientation::Custom;
 
         updateModelViewMatrix();
         update();
@@ -586,6 +1452,18 @@ void PointCloudRenderer::mouseMoveEvent(QMouseEvent *event)
 
 void PointCloudRenderer::mouseReleaseEvent(QMouseEvent *event)
 {
+    // A press and release in place is a click; anything longer was a drag
+    // to rotate.
+    const bool click = (event->pos() - m_pressMousePos).manhattanLength() <= 3;
+    if (m_selecting && event->button() == Qt::LeftButton) {
+        finishSelection(event->modifiers());
+    } else if (click && event->button() == Qt::LeftButton
+        && (m_measureMode != MeasureMode::None || m_pickPointToolEnabled)) {
+        handleMeasureClick(event->pos());
+    } else if (click && event->button() == Qt::RightButton && m_measureMode != MeasureMode::None) {
+        finishMeasurement();
+    }
+
     QOpenGLWidget::mouseReleaseEvent(event);
 }
 
@@ -594,8 +1472,438 @@ void PointCloudRenderer::wheelEvent(QWheelEvent *event)
     float delta = event->angleDelta().y() / 120.0f;
     m_distance *= std::pow(0.9f, delta);
 
-    m_distance = std::max(0.1f, std::min(m_distance, 1000.0f));
+    float diagonal = (m_boundingBoxMax - m_boundingBoxMin).length();
+    if (!(diagonal > 0.0f)) {
+        diagonal = 1.0f;
+    }
+    m_distance = std::max(diagonal * MinZoomDistance, std::min(m_distance, diagonal * MaxZoomDistance));
 
     updateModelViewMatrix();
     update();
 }
+
+void PointCloudRenderer::enableMeasureTool(bool enable)
+{
+    setMeasureMode(enable ? MeasureMode::Distance : MeasureMode::None);
+}
+
+void PointCloudRenderer::enablePickPointTool(bool enable)
+{
+    m_pickPointToolEnabled = enable;
+    m_hasPickedPoint = false;
+    updateMeasurementText();
+    update();
+}
+
+void PointCloudRenderer::setMeasureMode(MeasureMode mode)
+{
+    if (m_measureMode == mode) {
+        return;
+    }
+    m_measureMode = mode;
+    clearMeasurement();
+}
+
+void PointCloudRenderer::clearMeasurement()
+{
+    m_measurePoints.clear();
+    m_measureComplete = false;
+    m_volume = MeasurementEngine::VolumeResult();
+    m_measuredDistance = 0.0f;
+    updateMeasurementText();
+    update();
+}
+
+// World position under screenPos at the given normalized device depth (-1
+// is the near plane, 1 the far plane).
+QVector3D PointCloudRenderer::unprojectPoint(const QPoint &screenPos, float depth)
+{
+    const float x = 2.0f * float(screenPos.x()) / float(std::max(1, width())) - 1.0f;
+    const float y = 1.0f - 2.0f * float(screenPos.y()) / float(std::max(1, height()));
+    return (m_projection * m_modelView).inverted().map(QVector3D(x, y, depth));
+}
+
+bool PointCloudRenderer::projectToScreen(const QVector3D &point, QPointF &screenPos) const
+{
+    const QVector4D clip = m_projection * m_modelView * QVector4D(point, 1.0f);
+    if (clip.w() <= 0.0f) {
+        return false;
+    }
+    screenPos = QPointF((clip.x() / clip.w() + 1.0f) * 0.5f * width(),
+                        (1.0f - clip.y() / clip.w()) * 0.5f * height());
+    return true;
+}
+
+// The ray and intersection are in scene coordinates; the pick runs in the
+// active cloud's own.
+bool PointCloudRenderer::rayIntersectsModel(const QVector3D &rayOrigin, const QVector3D &rayDirection, QVector3D &intersection)
+{
+    const QMatrix4x4 transform = activeTransform();
+    const QMatrix4x4 toCloud = transform.inverted();
+    const QVector3D origin = toCloud.map(rayOrigin);
+    const QVector3D direction = toCloud.map(rayOrigin + rayDirection) - origin;
+
+    // Snap within a few pixels, measured at the orbit distance.
+    const float viewHeight = m_perspectiveMode ? 2.0f * m_distance / m_projection(1, 1) : 2.0f / m_projection(1, 1);
+    const float pixelSize = viewHeight / float(std::max(1, height()));
+    QVector3D point;
+    if (!m_measurement.pickAlongRay(origin, direction, PickTolerance * pixelSize, point)) {
+        return false;
+    }
+    intersection = transform.map(point);
+    return true;
+}
+
+void PointCloudRenderer::handleMeasureClick(const QPoint &screenPos)
+{
+    // Normalized device depth of the near and far planes.
+    const QVector3D nearPoint = unprojectPoint(screenPos, m_reversedDepth ? 1.0f : -1.0f);
+    const QVector3D farPoint = unprojectPoint(screenPos, m_reversedDepth ? 0.0f : 1.0f);
+    QVector3D point;
+    if (!rayIntersectsModel(nearPoint, farPoint - nearPoint, point)) {
+        return;
+    }
+
+    if (m_pickPointToolEnabled) {
+        m_pickedPoint = point;
+        m_hasPickedPoint = true;
+    }
+
+    if (m_measureMode != MeasureMode::None) {
+        // Clicking after a completed measurement starts the next one.
+        if (m_measureComplete) {
+            m_measurePoints.clear();
+            m_measureComplete = false;
+        }
+        m_measurePoints.append(point);
+        if (m_measureMode == MeasureMode::Distance && m_measurePoints.size() == 2) {
+            finishMeasurement();
+            return;
+        }
+    }
+
+    updateMeasurementText();
+    update();
+}
+
+void PointCloudRenderer::finishMeasurement()
+{
+    const int required = (m_measureMode == MeasureMode::Area || m_measureMode == MeasureMode::Volume) ? 3 : 2;
+    if (m_measureComplete || m_measurePoints.size() < required) {
+        return;
+    }
+
+    if (m_measureMode == MeasureMode::Volume) {
+        // The engine works in the active cloud's coordinates; transforms
+        // are rigid, so areas and volumes carry over unchanged.
+        const QMatrix4x4 toCloud = activeTransform().inverted();
+        QVector<QVector3D> boundary;
+        for (const QVector3D &point : m_measurePoints) {
+            boundary.append(toCloud.map(point));
+        }
+
+        QVector3D origin;
+        QVector3D normal;
+        MeasurementEngine::fitPlane(boundary, origin, normal);
+
+        // Measure on the side of the base the viewer looks from, so a pile
+        // seen from above is cut and a pit seen from above is fill.
+        const QVector3D eye = toCloud.map(m_modelView.inverted().map(QVector3D(0.0f, 0.0f, 0.0f)));
+        if (QVector3D::dotProduct(normal, eye - origin) < 0.0f) {
+            normal = -normal;
+        }
+        m_volume = m_measurement.volume(origin, normal, boundary);
+    }
+
+    m_measureComplete = true;
+    updateMeasurementText();
+    update();
+}
+
+void PointCloudRenderer::updateMeasurementText()
+{
+    QStringList parts;
+    if (m_pickPointToolEnabled && m_hasPickedPoint) {
+        parts << QString("Point: %1, %2, %3")
+                     .arg(m_pickedPoint.x(), 0, 'f', 3)
+                     .arg(m_pickedPoint.y(), 0, 'f', 3)
+                     .arg(m_pickedPoint.z(), 0, 'f', 3);
+    }
+
+    const int count = m_measurePoints.size();
+    switch (m_measureMode) {
+    case MeasureMode::None:
+        break;
+    case MeasureMode::Distance:
+    case MeasureMode::Polyline:
+        m_measuredDistance = float(MeasurementEngine::polylineLength(m_measurePoints));
+        if (m_measureMode == MeasureMode::Distance && count >= 2) {
+            parts << QString("Distance: %1").arg(m_measuredDistance, 0, 'f', 3);
+        } else if (m_measureMode == MeasureMode::Polyline && count >= 2) {
+            parts << QString("Length: %1 (%2 points)").arg(m_measuredDistance, 0, 'f', 3).arg(count);
+        }
+        break;
+    case MeasureMode::Area:
+        if (count >= 3) {
+            parts << QString("Area: %1, perimeter %2")
+                         .arg(MeasurementEngine::projectedArea(m_measurePoints), 0, 'f', 3)
+                         .arg(MeasurementEngine::polylineLength(m_measurePoints, true), 0, 'f', 3);
+        }
+        break;
+    case MeasureMode::Volume:
+        if (m_measureComplete) {
+            parts << QString("Volume: cut %1, fill %2, net %3 over area %4 (cell %5)")
+                         .arg(m_volume.cut, 0, 'f', 3)
+                         .arg(m_volume.fill, 0, 'f', 3)
+                         .arg(m_volume.cut - m_volume.fill, 0, 'f', 3)
+                         .arg(m_volume.area, 0, 'f', 3)
+                         .arg(m_volume.cellSize, 0, 'g', 3);
+        } else if (count > 0) {
+            parts << QString("Volume: %1 boundary points, right-click to measure").arg(count);
+        }
+        break;
+    }
+
+    const QString text = parts.join("  |  ");
+    if (text != m_measurementText) {
+        m_measurementText = text;
+        emit measurementChanged(text);
+    }
+}
+
+void PointCloudRenderer::drawMeasurementLine(QPainter &painter)
+{
+    QPolygonF outline;
+    for (const QVector3D &point : m_measurePoints) {
+        QPointF screenPos;
+        if (projectToScreen(point, screenPos)) {
+            outline.append(screenPos);
+        }
+    }
+    if (outline.isEmpty()) {
+        return;
+    }
+
+    const QColor color(255, 220, 0);
+    QPen pen(color);
+    pen.setWidth(2);
+    painter.setPen(pen);
+
+    const bool polygon = (m_measureMode == MeasureMode::Area || m_measureMode == MeasureMode::Volume)
+                         && outline.size() >= 3;
+    if (polygon) {
+        painter.setBrush(QColor(255, 220, 0, m_measureComplete ? 60 : 30));
+        painter.drawPolygon(outline);
+    } else {
+        painter.drawPolyline(outline);
+    }
+
+    painter.setBrush(color);
+    for (const QPointF &vertex : outline) {
+        painter.drawEllipse(vertex, 3.0, 3.0);
+    }
+    painter.setBrush(Qt::NoBrush);
+
+    if (!m_measurementText.isEmpty()) {
+        const QPointF anchor = outline.last() + QPointF(8.0, -8.0);
+        painter.setPen(QColor(0, 0, 0));
+        painter.drawText(anchor + QPointF(1.0, 1.0), m_measurementText);
+        painter.setPen(color);
+        painter.drawText(anchor, m_measurementText);
+    }
+}
+
+void PointCloudRenderer::drawPickedPointInfo(QPainter &painter)
+{
+    QPointF screenPos;
+    if (!projectToScreen(m_pickedPoint, screenPos)) {
+        return;
+    }
+
+    const QColor color(0, 255, 255);
+    painter.setPen(QPen(color));
+    painter.setBrush(Qt::NoBrush);
+    painter.drawEllipse(screenPos, 5.0, 5.0);
+    painter.drawLine(screenPos - QPointF(8.0, 0.0), screenPos + QPointF(8.0, 0.0));
+    painter.drawLine(screenPos - QPointF(0.0, 8.0), screenPos + QPointF(0.0, 8.0));
+
+    const QString label = QString("%1, %2, %3")
+                              .arg(m_pickedPoint.x(), 0, 'f', 3)
+                              .arg(m_pickedPoint.y(), 0, 'f', 3)
+                              .arg(m_pickedPoint.z(), 0, 'f', 3);
+    const QPointF anchor = screenPos + QPointF(10.0, 16.0);
+    painter.setPen(QColor(0, 0, 0));
+    painter.drawText(anchor + QPointF(1.0, 1.0), label);
+    painter.setPen(color);
+    painter.drawText(anchor, label);
+}
+
+void PointCloudRenderer::setSelectionMode(SelectionMode mode)
+{
+    m_selectionMode = mode;
+    m_selecting = false;
+    update();
+}
+
+void PointCloudRenderer::clearSelection()
+{
+    m_selection.clear();
+    emit selectionChanged(0);
+    update();
+}
+
+void PointCloudRenderer::finishSelection(Qt::KeyboardModifiers modifiers)
+{
+    m_selecting = false;
+
+    // A click in Replace mode clears; a lasso needs an area to enclose.
+    const QRectF bounds = m_selectionPath.boundingRect();
+    if (m_selectionPath.size() < 3 || bounds.width() < 1.0 || bounds.height() < 1.0) {
+        if (!(modifiers & (Qt::ShiftModifier | Qt::ControlModifier))) {
+            clearSelection();
+        }
+        update();
+        return;
+    }
+
+    PointSelection::Operation operation = PointSelection::Operation::Replace;
+    if (modifiers & Qt::ShiftModifier) {
+        operation = PointSelection::Operation::Add;
+    } else if (modifiers & Qt::ControlModifier) {
+        operation = PointSelection::Operation::Subtract;
+    }
+
+    updateModelViewMatrix();
+    m_selection.selectPolygon(m_selectionPath, m_projection * m_modelView * activeTransform(), size(), operation);
+    emit selectionChanged(m_selection.selectedCount());
+    update();
+}
+
+bool PointCloudRenderer::cropToSelection()
+{
+    if (!m_selection.isValid() || m_selection.isEmpty()) {
+        qDebug() << "Nothing selected";
+        return false;
+    }
+    if (!m_cloud->filterVertices(m_selection.mask())) {
+        return false;
+    }
+    m_scene->cloudChanged(m_activeCloud);
+    m_boundingBoxMin = m_scene->boundsMin();
+    m_boundingBoxMax = m_scene->boundsMax();
+    clearSelection();
+    return true;
+}
+
+bool PointCloudRenderer::deleteSelection()
+{
+    if (!m_selection.isValid() || m_selection.isEmpty()) {
+        qDebug() << "Nothing selected";
+        return false;
+    }
+
+    QVector<quint8> keep = m_selection.mask();
+    quint8 *flags = keep.data();
+    parallelFor(keep.size(), [flags](qint64 begin, qint64 end) {
+        for (qint64 i = begin; i < end; ++i) {
+            flags[i] = flags[i] ? 0 : 1;
+        }
+    });
+    if (!m_cloud->filterVertices(keep)) {
+        return false;
+    }
+    m_scene->cloudChanged(m_activeCloud);
+    m_boundingBoxMin = m_scene->boundsMin();
+    m_boundingBoxMax = m_scene->boundsMax();
+    clearSelection();
+    return true;
+}
+
+bool PointCloudRenderer::exportSelection(const QString &filename)
+{
+    if (!m_selection.isValid() || m_selection.isEmpty()) {
+        qDebug() << "Nothing selected";
+        return false;
+    }
+    if (QFileInfo(filename).suffix().compare("ply", Qt::CaseInsensitive) == 0) {
+        return m_cloud->savePlyFile(filename, m_selection.mask());
+    }
+    return m_cloud->savePtsFile(filename, m_selection.mask());
+}
+
+bool PointCloudRenderer::savePtsFile(const QString &filename)
+{
+    return m_cloud && m_cloud->savePtsFile(filename);
+}
+
+bool PointCloudRenderer::savePlyFile(const QString &filename)
+{
+    return m_cloud && m_cloud->savePlyFile(filename);
+}
+
+// Mirrors the selection mask into this renderer's GPU buffer whenever the
+// selection changed; the tint appears once the whole mask is there.
+void PointCloudRenderer::updateSelectionBuffer()
+{
+    if (!m_selection.isValid() || m_selection.isEmpty()) {
+        releaseSelectionBuffer();
+        return;
+    }
+    if (m_selectionBuffer && m_selectionBufferRevision == m_selection.revision()) {
+        return;
+    }
+
+    GpuUploadManager *uploads = GpuUploadManager::instance();
+    if (m_selectionTicket) {
+        uploads->cancelUpload(m_selectionTicket);
+        m_selectionTicket = 0;
+    }
+
+    const QVector<quint8> mask = m_selection.mask();
+    const qint64 bytes = mask.size();
+    if (m_selectionBuffer && uploads->bufferCapacity(m_selectionBuffer) < bytes) {
+        uploads->releaseBuffer(m_selectionBuffer);
+        m_selectionBuffer = 0;
+    }
+    if (!m_selectionBuffer) {
+        m_selectionBuffer = uploads->acquireBuffer(bytes);
+    }
+    m_selectionBufferRevision = m_selection.revision();
+    m_selectionBufferReady = false;
+
+    const int count = mask.size();
+    m_selectionTicket = uploads->upload(m_selectionBuffer, count, 1,
+        [mask](void *dst, int first, int count) {
+            std::memcpy(dst, mask.constData() + first, size_t(count));
+        },
+        [this, count](int uploaded) {
+            if (uploaded == count) {
+                m_selectionTicket = 0;
+                m_selectionBufferReady = true;
+            }
+        });
+}
+
+void PointCloudRenderer::releaseSelectionBuffer()
+{
+    if (!m_selectionBuffer) {
+        return;
+    }
+    // Also cancels a pending upload into it.
+    GpuUploadManager::instance()->releaseBuffer(m_selectionBuffer);
+    m_selectionBuffer = 0;
+    m_selectionTicket = 0;
+    m_selectionBufferRevision = 0;
+    m_selectionBufferReady = false;
+}
+
+void PointCloudRenderer::drawSelectionPath(QPainter &painter)
+{
+    if (m_selectionPath.size() < 2) {
+        return;
+    }
+    painter.setPen(QPen(QColor(255, 120, 40), 1, Qt::DashLine));
+    painter.setBrush(QColor(255, 120, 40, 40));
+    painter.drawPolygon(m_selectionPath);
+    painter.setBrush(Qt::NoBrush);
+}
@@ -7,11 +7,20 @@
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLShaderProgram>
 #include <QMatrix4x4>
+#include <QVector2D>
 #include <QVector3D>
 #include <QVector>
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <QPainter>
+#include <QSharedPointer>
+#include <QPair>
+#include <QTimer>
+#include "measurementengine.h"
+#include "pointclouddata.h"
+#include "pointcloudscene.h"
+#include "pointselection.h"
+#include "pointstream.h"
 #include "viewportobject.h" // Add this line
 
 class PointCloudRenderer : public QOpenGLWidget, protected QOpenGLFunctions
@@ -19,12 +28,28 @@ class PointCloudRenderer : public QOpenGLWidget, protected QOpenGLFunctions
     Q_OBJECT
 
 public:
-    enum class ColorMode {
-        Original,
-        Unicolor,
-        XGradient,
-        YGradient,
-        ZGradient
+    // Chosen per cloud of the scene.
+    typedef PointCloudScene::ColorMode ColorMode;
+
+    // Interactive measurements. Left clicks snap to the cloud point under
+    // the cursor; Distance completes after two points, the others on a
+    // right click. Volume measures against the plane fitted through the
+    // clicked boundary.
+    enum class MeasureMode {
+        None,
+        Distance,
+        Polyline,
+        Area,
+        Volume
+    };
+
+    // Region selection by left-dragging a rectangle or a freehand lasso.
+    // Shift adds to the current selection, Ctrl subtracts from it; selected
+    // points are tinted.
+    enum class SelectionMode {
+        None,
+        Box,
+        Lasso
     };
 
     enum class ViewOrientation {
@@ -37,21 +62,89 @@ public:
     explicit PointCloudRenderer(QWidget *parent = nullptr);
     ~PointCloudRenderer();
 
-    bool loadPtsFile(const QString &filename);
-    bool loadPlyFile(const QString &filename);
+    // Replace the scene with the loaded cloud, or add it to the scene.
+    bool loadPtsFile(const QString &filename, bool addToScene = false);
+    bool loadPlyFile(const QString &filename, bool addToScene = false);
     bool savePtsFile(const QString &filename);
     bool savePlyFile(const QString &filename);
 
+    // Morton-sorts clouds after loading (see PointCloudData::sortSpatially).
+    // On by default, since level of detail only thins sorted clouds.
+    void setSpatialSortOnLoad(bool enabled) { m_spatialSortOnLoad = enabled; }
+    bool isSpatialSortOnLoadEnabled() const { return m_spatialSortOnLoad; }
+
+    // Keeps loaded clouds in a CompressedPointStore (after sorting, which
+    // makes chunks compact and compress better).
+    void setCompressOnLoad(bool enabled) { m_compressOnLoad = enabled; }
+    bool isCompressOnLoadEnabled() const { return m_compressOnLoad; }
+
+    // Renderers handed the same cloud share its host data and GPU buffer.
+    // Replaces the scene's clouds with this one.
+    void setPointCloud(const QSharedPointer<PointCloudData> &cloud, const QString &name = QString());
+    // The active cloud, which selection, measurement, filters and scalar
+    // coloring work on.
+    QSharedPointer<PointCloudData> pointCloud() const { return m_cloud; }
+
+    // Clouds drawn together, each placed by its own transform (see
+    // PointCloudScene). Renderers handed the same scene show the same
+    // clouds; culling, level of detail and draw commands cover all visible
+    // clouds in one pass.
+    void setScene(const QSharedPointer<PointCloudScene> &scene);
+    QSharedPointer<PointCloudScene> scene() const { return m_scene; }
+    // Adds a cloud and makes it the active one. Returns its index.
+    int addPointCloud(const QSharedPointer<PointCloudData> &cloud, const QString &name);
+    void removeCloud(int index);
+    void setActiveCloud(int index);
+    int activeCloud() const { return m_activeCloud; }
+    void setCloudTransform(int index, const QMatrix4x4 &transform);
+    void setCloudVisible(int index, bool visible);
+    // Centres the orbit on the scene bounds.
+    void frameScene();
+
+    // Live points drawn on top of the loaded cloud; pass null to detach.
+    void setPointStream(const QSharedPointer<PointStream> &stream);
+    QSharedPointer<PointStream> pointStream() const { return m_stream; }
+
     void resetView();
     void setTopView();
     void setFrontView();
     void setSideView();
 
+    void setViewOrientation(ViewOrientation orientation);
+    ViewOrientation getViewOrientation() const { return m_viewOrientation; }
+
+    // Thins out distant chunks to roughly what their screen footprint can
+    // show. On by default; disable for full-detail captures. Applies to
+    // spatially sorted clouds only, whose chunk prefixes are even
+    // subsamples.
+    void setLodEnabled(bool enabled);
+    bool isLodEnabled() const { return m_lodEnabled; }
+
+    // The per-frame level-of-detail selection for one cloud: appends to
+    // counts the points to draw from each chunk (0 outside the frustum,
+    // otherwise its uploaded part, thinned when thin is set) and widens
+    // [nearDepth, farDepth] to the chunks drawn. pixelsPerUnit is the
+    // pixels one world unit covers at view depth 1, footprint the pixel
+    // area of a point.
+    static void selectChunks(const QVector<PointCloudData::Chunk> &chunks, int uploaded, const QMatrix4x4 &projection,
+                             const QMatrix4x4 &modelView, bool perspective, float pixelsPerUnit, float footprint,
+                             bool thin, QVector<int> &counts, float &nearDepth, float &farDepth);
+
+    // Lambert shading from per-point normals, where the cloud has them.
+    void setSurfaceShading(bool enabled);
+    bool isSurfaceShadingEnabled() const { return m_surfaceShading; }
+
     void setPointSize(float size);
     float getPointSize() const { return m_pointSize; }
 
+    // Color mode of the active cloud, and of live points.
     void setColorMode(ColorMode mode);
-    ColorMode getColorMode() const { return m_colorMode; }
+    ColorMode getColorMode() const;
+
+    // Colormaps one of the cloud's scalar attributes (-1 for none) over its
+    // 1st-99th percentile range. The selection belongs to the cloud, so it
+    // applies to every renderer sharing it.
+    bool setScalarColoring(int attribute);
 
     void setShowCoordinateSystem(bool show);
     bool isShowingCoordinateSystem() const { return m_showCoordinateSystem; }
@@ -59,13 +152,26 @@ public:
     void setShowBoundingBox(bool show);
     bool isShowingBoundingBox() const { return m_showBoundingBox; }
 
+    // Orthographic when disabled, showing at any depth what perspective
+    // shows at the orbit distance. Near and far follow the visible chunks
+    // every frame in both modes.
     void setPerspectiveMode(bool enabled);
     bool isPerspectiveModeEnabled() const { return m_perspectiveMode; }
 
+    // Renders the tile at origin (in pixels, from the top left) of an
+    // image of imageSize: the view keeps the image's aspect, and the
+    // framebuffer shows only its part of it. An empty size renders the
+    // widget as usual. See ViewportExporter.
+    void setCaptureTile(const QSize &imageSize, const QPoint &origin);
+
+    // Queues and completes the uploads of every visible cloud, so the next
+    // frame draws them in full instead of as they stream in.
+    void finishUploads();
+
     void setBackgroundColor(const QColor &color);
     QColor getBackgroundColor() const { return m_backgroundColor; }
 
-    int getPointCount() const { return m_vertices.size(); }
+    int getPointCount() const { return m_scene->pointCount(); }
     QVector3D getBoundingBoxSize() const { return m_boundingBoxMax - m_boundingBoxMin; }
     QMatrix4x4 getProjectionMatrix() const { return m_projection; }
     QMatrix4x4 getModelViewMatrix() const { return m_modelView; }
@@ -78,16 +184,49 @@ public:
 
     void setViewport(const ViewportObject::ViewportParameters& params);
 
-    // Filter functions
-    void applyPassThroughFilter(int axis, float minValue, float maxValue);
+    // Filters keep part of the active cloud, so they chain;
+    // resetFilters() brings back that cloud as loaded. Bounds and framing
+    // follow the points that are left. Axis is 0 (x), 1 (y) or 2 (z) of
+    // the cloud's own coordinates; see OutlierFilter for the outlier
+    // criteria.
+    bool applyPassThroughFilter(int axis, float minValue, float maxValue);
+    bool applyStatisticalOutlierFilter(int neighbors, double stdDevMultiplier);
+    bool applyRadiusOutlierFilter(float radius, int minNeighbors);
     void resetFilters();
+    bool hasFilters() const;
 
     // Measurement tools
     void enableMeasureTool(bool enable);
     void enablePickPointTool(bool enable);
+    bool isPickPointToolEnabled() const { return m_pickPointToolEnabled; }
     float getMeasuredDistance() const { return m_measuredDistance; }
     QVector3D getPickedPoint() const { return m_pickedPoint; }
 
+    void setMeasureMode(MeasureMode mode);
+    MeasureMode measureMode() const { return m_measureMode; }
+    void clearMeasurement();
+    const QVector<QVector3D> &measurementPoints() const { return m_measurePoints; }
+    QString measurementText() const { return m_measurementText; }
+
+    // Selection tools
+    void setSelectionMode(SelectionMode mode);
+    SelectionMode selectionMode() const { return m_selectionMode; }
+    const PointSelection &selection() const { return m_selection; }
+    void clearSelection();
+    // Keep only the selected points, or drop them. The cloud is edited in
+    // place, so renderers sharing it follow.
+    bool cropToSelection();
+    bool deleteSelection();
+    // Saves the selected points; the format follows the suffix (.ply or
+    // .pts).
+    bool exportSelection(const QString &filename);
+
+signals:
+    // Result of the current measurement or pick, for a status line; empty
+    // when cleared.
+    void measurementChanged(const QString &text);
+    void selectionChanged(int selectedCount);
+
 protected:
     void initializeGL() override;
     void resizeGL(int w, int h) override;
@@ -99,53 +238,163 @@ protected:
     void paintEvent(QPaintEvent *event) override;
 
 private:
-    struct Vertex {
-        QVector3D position;
-        QVector3D color;
+    typedef PointCloudData::Vertex Vertex;
+
+    // Pick radius for measurements, in pixels.
+    static constexpr float PickTolerance = 4.0f;
+
+    // Layout fixed by glMultiDrawArraysIndirect.
+    struct DrawArraysIndirectCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint first;
+        GLuint baseInstance;
     };
 
+    typedef void (QOPENGLF_APIENTRYP MultiDrawArraysProc)(GLenum mode, const GLint *first, const GLsizei *count, GLsizei drawcount);
+    typedef void (QOPENGLF_APIENTRYP MultiDrawArraysIndirectProc)(GLenum mode, const void *indirect, GLsizei drawcount, GLsizei stride);
+    typedef void (QOPENGLF_APIENTRYP ClipControlProc)(GLenum origin, GLenum depth);
+
     void setupShaders();
-    void setupVertexBuffers();
+    // GL state of one scene node: its VAO, and the range of the shared
+    // draw command list that draws it.
+    struct CloudDraw {
+        QSharedPointer<PointCloudData> cloud;
+        QSharedPointer<QOpenGLVertexArrayObject> vao;
+        // Cloud revision the draw selection was built for, and GPU
+        // revision the VAO bindings were built for.
+        quint64 revision = 0;
+        quint64 gpuRevision = 0;
+        bool selectionBound = false;
+        int firstCommand = 0;
+        int commandCount = 0;
+    };
+
+    void syncCloudDraws();
+    void setupCloudVao(CloudDraw &draw, bool withSelection);
     void updateModelViewMatrix();
+    void updateProjection();
+    void fitDepthRange(float nearDepth, float farDepth);
+    bool updateDepthTarget();
+    void releaseDepthTarget();
+    void updateColorUniforms(ColorMode mode, const PointCloudData *cloud);
+    void updateDrawCommands(float &nearDepth, float &farDepth);
+    void drawClouds();
+    void drawStream();
     void drawCoordinateSystem(QPainter &painter);
     void drawBoundingBox();
     void drawMeasurementLine(QPainter &painter);
     void drawPickedPointInfo(QPainter &painter);
     void updateColorBuffer();
-    QVector3D unprojectPoint(const QPoint &screenPos);
+    QVector3D unprojectPoint(const QPoint &screenPos, float depth);
     bool rayIntersectsModel(const QVector3D &rayOrigin, const QVector3D &rayDirection, QVector3D &intersection);
+    bool projectToScreen(const QVector3D &point, QPointF &screenPos) const;
+    void handleMeasureClick(const QPoint &screenPos);
+    void finishMeasurement();
+    void updateMeasurementText();
+    void finishSelection(Qt::KeyboardModifiers modifiers);
+    void updateSelectionBuffer();
+    void releaseSelectionBuffer();
+    void drawSelectionPath(QPainter &painter);
+    bool applyFilterMask(const QVector<quint8> &keep);
+    void replaceActiveCloud(const QSharedPointer<PointCloudData> &cloud);
+    QMatrix4x4 activeTransform() const;
+
+    // Same vertex stage; the square variant never discards. m_program is
+    // the one used this frame.
+    QOpenGLShaderProgram m_roundProgram;
+    QOpenGLShaderProgram m_squareProgram;
+    QOpenGLShaderProgram *m_program;
 
-    QOpenGLShaderProgram m_program;
-    QOpenGLBuffer m_vbo;
-    QOpenGLVertexArrayObject m_vao;
+    QSharedPointer<PointCloudScene> m_scene;
+    // Scene revision the bounds and draw selection were taken from.
+    quint64 m_sceneRevision;
+    QVector<CloudDraw> m_cloudDraws;
+    int m_activeCloud;
+    QSharedPointer<PointCloudData> m_cloud;
+    bool m_spatialSortOnLoad;
+    bool m_compressOnLoad;
 
-    QVector<Vertex> m_vertices;
-    QVector<Vertex> m_filteredVertices;
-    QVector<Vertex> m_originalVertices;
+    // Per-chunk draw command list over all visible clouds, in scene order,
+    // rebuilt only when the culled/LOD selection changes or the view turns
+    // far enough to spoil the front-to-back order.
+    bool m_lodEnabled;
+    QVector<int> m_chunkSelection;
+    QVector<int> m_drawSelection;
+    QVector3D m_drawSortDirection;
+    QVector<QPair<float, int>> m_drawOrder;
+    QVector<GLint> m_drawFirst;
+    QVector<GLsizei> m_drawCount;
+    GLuint m_indirectBuffer;
+    MultiDrawArraysProc m_glMultiDrawArrays;
+    MultiDrawArraysIndirectProc m_glMultiDrawArraysIndirect;
+
+    QSharedPointer<PointStream> m_stream;
+    QOpenGLVertexArrayObject m_streamVao;
+    QVector<GLint> m_streamFirst;
+    QVector<GLsizei> m_streamCount;
+    QTimer m_streamTimer;
+    bool m_streamFramed;
+    bool m_surfaceShading;
+
+    // Filtered clouds in the scene paired with the clouds they came from,
+    // as loaded.
+    QVector<QPair<QSharedPointer<PointCloudData>, QSharedPointer<PointCloudData>>> m_unfilteredClouds;
 
     QMatrix4x4 m_projection;
     QMatrix4x4 m_modelView;
+    float m_nearPlane;
+    float m_farPlane;
+    // Whether this frame renders reversed-Z into m_depthFramebuffer.
+    bool m_reversedDepth;
+    ClipControlProc m_glClipControl;
+    GLuint m_depthFramebuffer;
+    GLuint m_depthRenderbuffer;
+    // Widget framebuffer and pixel size the depth target was built for.
+    GLuint m_depthTargetSource;
+    QSize m_depthTargetSize;
+    bool m_depthTargetReady;
+    QSize m_captureImageSize;
+    QPoint m_captureOrigin;
     float m_distance;
     QVector3D m_rotation;
     QPoint m_lastMousePos;
+    QPoint m_pressMousePos;
     bool m_perspectiveMode;
 
     float m_pointSize;
     QVector3D m_boundingBoxMin;
     QVector3D m_boundingBoxMax;
     QVector3D m_modelCenter;
+    // For clouds added from now on, and live points.
     ColorMode m_colorMode;
     QColor m_backgroundColor;
     bool m_showCoordinateSystem;
     bool m_showBoundingBox;
+    ViewOrientation m_viewOrientation;
 
-    bool m_measureToolEnabled;
+    MeasurementEngine m_measurement;
+    MeasureMode m_measureMode;
+    QVector<QVector3D> m_measurePoints;
+    bool m_measureComplete;
+    MeasurementEngine::VolumeResult m_volume;
+    QString m_measurementText;
     bool m_pickPointToolEnabled;
-    bool m_isFirstPointSelected;
-    QVector3D m_measurePointStart;
-    QVector3D m_measurePointEnd;
+    bool m_hasPickedPoint;
     float m_measuredDistance;
     QVector3D m_pickedPoint;
+
+    PointSelection m_selection;
+    SelectionMode m_selectionMode;
+    // Region being dragged, in widget pixels.
+    QPolygonF m_selectionPath;
+    bool m_selecting;
+    // Per-renderer copy of the mask on the GPU (one byte per vertex),
+    // bound as attribute 4 once completely uploaded.
+    GLuint m_selectionBuffer;
+    quint64 m_selectionTicket;
+    quint64 m_selectionBufferRevision;
+    bool m_selectionBufferReady;
 };
 
 #endif // POINTCLOUDRENDERER_H
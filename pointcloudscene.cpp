@@ -0,0 +1,217 @@
+#include "pointcloudscene.h"
+#include <algorithm>
+#include <limits>
+
+PointCloudScene::PointCloudScene()
+    : m_boundsMin(0.0f, 0.0f, 0.0f),
+    m_boundsMax(0.0f, 0.0f, 0.0f),
+    m_hasBounds(false),
+    m_revision(0)
+{
+}
+
+int PointCloudScene::addCloud(const QSharedPointer<PointCloudData> &cloud, const QString &name,
+                              const QMatrix4x4 &transform, ColorMode colorMode)
+{
+    Node node;
+    node.name = name;
+    node.cloud = cloud;
+    node.transform = transform;
+    node.visible = true;
+    node.colorMode = colorMode;
+    updateNodeBounds(node);
+    m_nodes.append(node);
+
+    extendBounds(node);
+    ++m_revision;
+    return m_nodes.size() - 1;
+}
+
+void PointCloudScene::removeCloud(int index)
+{
+    if (index < 0 || index >= m_nodes.size()) {
+        return;
+    }
+    m_nodes.remove(index);
+    updateBounds();
+    ++m_revision;
+}
+
+void PointCloudScene::clear()
+{
+    m_nodes.clear();
+    updateBounds();
+    ++m_revision;
+}
+
+void PointCloudScene::setCloud(int index, const QSharedPointer<PointCloudData> &cloud)
+{
+    if (index < 0 || index >= m_nodes.size()) {
+        return;
+    }
+    m_nodes[index].cloud = cloud;
+    cloudChanged(index);
+}
+
+void PointCloudScene::cloudChanged(int index)
+{
+    if (index < 0 || index >= m_nodes.size()) {
+        return;
+    }
+    updateNodeBounds(m_nodes[index]);
+    updateBounds();
+    ++m_revision;
+}
+
+void PointCloudScene::setTransform(int index, const QMatrix4x4 &transform)
+{
+    if (index < 0 || index >= m_nodes.size()) {
+        return;
+    }
+    m_nodes[index].transform = transform;
+    cloudChanged(index);
+}
+
+void PointCloudScene::setVisible(int index, bool visible)
+{
+    if (index < 0 || index >= m_nodes.size() || m_nodes[index].visible == visible) {
+        return;
+    }
+    m_nodes[index].visible = visible;
+    if (visible) {
+        extendBounds(m_nodes[index]);
+    } else {
+        updateBounds();
+    }
+    ++m_revision;
+}
+
+void PointCloudScene::setColorMode(int index, ColorMode mode)
+{
+    if (index < 0 || index >= m_nodes.size()) {
+        return;
+    }
+    m_nodes[index].colorMode = mode;
+    ++m_revision;
+}
+
+int PointCloudScene::indexOf(const PointCloudData *cloud) const
+{
+    for (int i = 0; i < m_nodes.size(); ++i) {
+        if (m_nodes[i].cloud.data() == cloud) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int PointCloudScene::pointCount() const
+{
+    int count = 0;
+    for (const Node &node : m_nodes) {
+        count += node.cloud ? node.cloud->pointCount() : 0;
+    }
+    return count;
+}
+
+QVector<PointCloudScene::NodeState> PointCloudScene::state() const
+{
+    QVector<NodeState> state;
+    for (const Node &node : m_nodes) {
+        NodeState nodeState;
+        nodeState.name = node.name;
+        nodeState.cloud = node.cloud;
+        nodeState.transform = node.transform;
+        nodeState.visible = node.visible;
+        nodeState.colorMode = node.colorMode;
+        state.append(nodeState);
+    }
+    return state;
+}
+
+void PointCloudScene::restoreState(const QVector<NodeState> &state)
+{
+    for (Node &node : m_nodes) {
+        const NodeState *match = nullptr;
+        for (const NodeState &nodeState : state) {
+            if (nodeState.cloud.toStrongRef() == node.cloud) {
+                match = &nodeState;
+                break;
+            }
+            if (!match && nodeState.name == node.name) {
+                match = &nodeState;
+            }
+        }
+        if (match) {
+            node.transform = match->transform;
+            node.visible = match->visible;
+            node.colorMode = match->colorMode;
+            updateNodeBounds(node);
+        }
+    }
+    updateBounds();
+    ++m_revision;
+}
+
+// Maps the eight corners of the cloud's box; exact for translations and
+// rotations about an axis, conservative otherwise.
+void PointCloudScene::updateNodeBounds(Node &node)
+{
+    if (!node.cloud || node.cloud->isEmpty()) {
+        node.boundsMin = QVector3D(0.0f, 0.0f, 0.0f);
+        node.boundsMax = QVector3D(0.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    const QVector3D localMin = node.cloud->getBoundingBoxMin();
+    const QVector3D localMax = node.cloud->getBoundingBoxMax();
+    node.boundsMin = QVector3D(std::numeric_limits<float>::max(),
+                               std::numeric_limits<float>::max(),
+                               std::numeric_limits<float>::max());
+    node.boundsMax = QVector3D(std::numeric_limits<float>::lowest(),
+                               std::numeric_limits<float>::lowest(),
+                               std::numeric_limits<float>::lowest());
+    for (int corner = 0; corner < 8; ++corner) {
+        const QVector3D p = node.transform.map(QVector3D(corner & 1 ? localMax.x() : localMin.x(),
+                                                         corner & 2 ? localMax.y() : localMin.y(),
+                                                         corner & 4 ? localMax.z() : localMin.z()));
+        node.boundsMin.setX(std::min(node.boundsMin.x(), p.x()));
+        node.boundsMin.setY(std::min(node.boundsMin.y(), p.y()));
+        node.boundsMin.setZ(std::min(node.boundsMin.z(), p.z()));
+
+        node.boundsMax.setX(std::max(node.boundsMax.x(), p.x()));
+        node.boundsMax.setY(std::max(node.boundsMax.y(), p.y()));
+        node.boundsMax.setZ(std::max(node.boundsMax.z(), p.z()));
+    }
+}
+
+void PointCloudScene::extendBounds(const Node &node)
+{
+    if (!node.visible || !node.cloud || node.cloud->isEmpty()) {
+        return;
+    }
+    if (!m_hasBounds) {
+        m_boundsMin = node.boundsMin;
+        m_boundsMax = node.boundsMax;
+        m_hasBounds = true;
+        return;
+    }
+
+    m_boundsMin.setX(std::min(m_boundsMin.x(), node.boundsMin.x()));
+    m_boundsMin.setY(std::min(m_boundsMin.y(), node.boundsMin.y()));
+    m_boundsMin.setZ(std::min(m_boundsMin.z(), node.boundsMin.z()));
+
+    m_boundsMax.setX(std::max(m_boundsMax.x(), node.boundsMax.x()));
+    m_boundsMax.setY(std::max(m_boundsMax.y(), node.boundsMax.y()));
+    m_boundsMax.setZ(std::max(m_boundsMax.z(), node.boundsMax.z()));
+}
+
+void PointCloudScene::updateBounds()
+{
+    m_boundsMin = QVector3D(0.0f, 0.0f, 0.0f);
+    m_boundsMax = QVector3D(0.0f, 0.0f, 0.0f);
+    m_hasBounds = false;
+    for (const Node &node : m_nodes) {
+        extendBounds(node);
+    }
+}
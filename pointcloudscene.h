@@ -0,0 +1,99 @@
+#ifndef POINTCLOUDSCENE_H
+#define POINTCLOUDSCENE_H
+
+#include <QMatrix4x4>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector3D>
+#include <QVector>
+#include <QWeakPointer>
+#include "pointclouddata.h"
+
+// Point clouds shown together, e.g. scans from several stations, each
+// placed by its own model transform.
+//
+// Shared between renderers as a QSharedPointer<PointCloudScene>, like the
+// clouds themselves. Every node keeps its cloud's bounding box mapped
+// through its transform; the scene bounds are the union of those over the
+// visible nodes, so adding a cloud only extends them and other edits
+// re-union the cached boxes without touching any points.
+class PointCloudScene
+{
+public:
+    enum class ColorMode {
+        Original,
+        Unicolor,
+        XGradient,
+        YGradient,
+        ZGradient,
+        Scalar
+    };
+
+    struct Node {
+        QString name;
+        QSharedPointer<PointCloudData> cloud;
+        QMatrix4x4 transform;
+        bool visible;
+        ColorMode colorMode;
+        // The cloud's bounding box under transform, in scene coordinates.
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+    };
+
+    // A node's settings without its data, for saved viewports. The cloud
+    // is only referenced, so a viewport does not keep a removed scan alive.
+    struct NodeState {
+        QString name;
+        QWeakPointer<PointCloudData> cloud;
+        QMatrix4x4 transform;
+        bool visible;
+        ColorMode colorMode;
+    };
+
+    PointCloudScene();
+
+    // Returns the index of the new node.
+    int addCloud(const QSharedPointer<PointCloudData> &cloud, const QString &name,
+                 const QMatrix4x4 &transform = QMatrix4x4(), ColorMode colorMode = ColorMode::Original);
+    void removeCloud(int index);
+    void clear();
+
+    // Swaps a node's data (a filtered copy, say), keeping its settings.
+    void setCloud(int index, const QSharedPointer<PointCloudData> &cloud);
+    // Call after a node's cloud was edited in place.
+    void cloudChanged(int index);
+
+    void setTransform(int index, const QMatrix4x4 &transform);
+    void setVisible(int index, bool visible);
+    void setColorMode(int index, ColorMode mode);
+
+    int cloudCount() const { return m_nodes.size(); }
+    const Node &node(int index) const { return m_nodes[index]; }
+    int indexOf(const PointCloudData *cloud) const;
+    int pointCount() const;
+
+    // Union over the visible, non-empty clouds; zero when there are none.
+    QVector3D boundsMin() const { return m_boundsMin; }
+    QVector3D boundsMax() const { return m_boundsMax; }
+
+    QVector<NodeState> state() const;
+    // Applies saved settings to the nodes still holding the same cloud or,
+    // for clouds replaced since (by a filter), the same name.
+    void restoreState(const QVector<NodeState> &state);
+
+    // Bumped on every change; renderers compare it like a cloud revision.
+    quint64 revision() const { return m_revision; }
+
+private:
+    static void updateNodeBounds(Node &node);
+    void extendBounds(const Node &node);
+    void updateBounds();
+
+    QVector<Node> m_nodes;
+    QVector3D m_boundsMin;
+    QVector3D m_boundsMax;
+    bool m_hasBounds;
+    quint64 m_revision;
+};
+
+#endif // POINTCLOUDSCENE_H
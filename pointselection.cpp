@@ -0,0 +1,291 @@
+#include "pointselection.h"
+#include "allocationcounter.h"
+#include "compressedpointstore.h"
+#include "parallelfor.h"
+#include <QElapsedTimer>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Points are projected this many at a time into small coordinate arrays, a
+// loop shape the compiler turns into SIMD code.
+static const int ProjectionBatch = 256;
+
+// The region's pixels inside the viewport, over its bounding rectangle.
+struct Coverage {
+    int left;
+    int top;
+    int width;
+    int height;
+    QVector<quint8> pixels;
+    // Prefix sums of pixels, (width + 1) x (height + 1).
+    QVector<qint32> sums;
+
+    // Covered pixels in the inclusive rectangle [x0, x1] x [y0, y1].
+    qint64 covered(int x0, int y0, int x1, int y1) const
+    {
+        const int stride = width + 1;
+        return qint64(sums[(y1 + 1) * stride + x1 + 1]) - sums[y0 * stride + x1 + 1]
+               - sums[(y1 + 1) * stride + x0] + sums[y0 * stride + x0];
+    }
+};
+
+// Even-odd scanline fill at pixel centers.
+static void rasterize(const QPolygonF &polygon, const QSize &viewport, Coverage &coverage)
+{
+    const QRectF bounds = polygon.boundingRect();
+    coverage.left = std::max(0, int(std::floor(bounds.left())));
+    coverage.top = std::max(0, int(std::floor(bounds.top())));
+    coverage.width = std::min(viewport.width(), int(std::ceil(bounds.right()))) - coverage.left;
+    coverage.height = std::min(viewport.height(), int(std::ceil(bounds.bottom()))) - coverage.top;
+    if (coverage.width <= 0 || coverage.height <= 0 || polygon.size() < 3) {
+        coverage.width = 0;
+        coverage.height = 0;
+        return;
+    }
+
+    const int width = coverage.width;
+    coverage.pixels = QVector<quint8>(width * coverage.height, 0);
+    quint8 *pixels = coverage.pixels.data();
+    parallelFor(coverage.height, [&](qint64 begin, qint64 end) {
+        QVector<double> crossings;
+        for (qint64 row = begin; row < end; ++row) {
+            const double y = coverage.top + row + 0.5;
+            crossings.clear();
+            for (int i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+                const QPointF &a = polygon[i];
+                const QPointF &b = polygon[j];
+                if ((a.y() > y) != (b.y() > y)) {
+                    crossings.append(a.x() + (y - a.y()) * (b.x() - a.x()) / (b.y() - a.y()));
+                }
+            }
+            std::sort(crossings.begin(), crossings.end());
+
+            quint8 *line = pixels + row * width;
+            for (int k = 0; k + 1 < crossings.size(); k += 2) {
+                const int x0 = std::max(0, int(std::ceil(crossings[k] - 0.5)) - coverage.left);
+                const int x1 = std::min(width, int(std::ceil(crossings[k + 1] - 0.5)) - coverage.left);
+                if (x1 > x0) {
+                    std::memset(line + x0, 1, size_t(x1 - x0));
+                }
+            }
+        }
+    }, 16);
+
+    const int stride = width + 1;
+    coverage.sums = QVector<qint32>(stride * (coverage.height + 1), 0);
+    qint32 *sums = coverage.sums.data();
+    for (int y = 0; y < coverage.height; ++y) {
+        qint32 rowSum = 0;
+        for (int x = 0; x < width; ++x) {
+            rowSum += pixels[y * width + x];
+            sums[(y + 1) * stride + x + 1] = sums[y * stride + x + 1] + rowSum;
+        }
+    }
+}
+
+enum class ChunkCoverage {
+    Outside,
+    Inside,
+    Partial
+};
+
+// Decides a chunk from its projected bounds where possible. With all
+// corners in front of the camera the points project inside the corners'
+// screen rectangle; an uncovered or fully covered rectangle settles them
+// all.
+static ChunkCoverage classifyChunk(const PointCloudData::Chunk &chunk, const float *m, float halfWidth,
+                                   float halfHeight, const Coverage &coverage)
+{
+    float minX = std::numeric_limits<float>::max(), maxX = -minX;
+    float minY = minX, maxY = -minX;
+    for (int corner = 0; corner < 8; ++corner) {
+        const float x = corner & 1 ? chunk.boundsMax.x() : chunk.boundsMin.x();
+        const float y = corner & 2 ? chunk.boundsMax.y() : chunk.boundsMin.y();
+        const float z = corner & 4 ? chunk.boundsMax.z() : chunk.boundsMin.z();
+        const float w = m[3] * x + m[7] * y + m[11] * z + m[15];
+        if (w <= 0.0f) {
+            return ChunkCoverage::Partial;
+        }
+        const float sx = (m[0] * x + m[4] * y + m[8] * z + m[12]) / w * halfWidth + halfWidth;
+        const float sy = halfHeight - (m[1] * x + m[5] * y + m[9] * z + m[13]) / w * halfHeight;
+        minX = std::min(minX, sx);
+        maxX = std::max(maxX, sx);
+        minY = std::min(minY, sy);
+        maxY = std::max(maxY, sy);
+    }
+
+    // Clamped before converting so far-off chunks cannot overflow an int.
+    const float limit = 1 << 24;
+    const int x0 = int(std::floor(std::max(-limit, std::min(minX, limit)))) - coverage.left;
+    const int x1 = int(std::floor(std::max(-limit, std::min(maxX, limit)))) - coverage.left;
+    const int y0 = int(std::floor(std::max(-limit, std::min(minY, limit)))) - coverage.top;
+    const int y1 = int(std::floor(std::max(-limit, std::min(maxY, limit)))) - coverage.top;
+    if (x1 < 0 || y1 < 0 || x0 >= coverage.width || y0 >= coverage.height) {
+        return ChunkCoverage::Outside;
+    }
+    if (x0 >= 0 && y0 >= 0 && x1 < coverage.width && y1 < coverage.height) {
+        const qint64 covered = coverage.covered(x0, y0, x1, y1);
+        if (covered == 0) {
+            return ChunkCoverage::Outside;
+        }
+        if (covered == qint64(x1 - x0 + 1) * (y1 - y0 + 1)) {
+            return ChunkCoverage::Inside;
+        }
+    }
+    return ChunkCoverage::Partial;
+}
+
+PointSelection::PointSelection()
+    : m_vertexRevision(0),
+    m_selectedCount(0),
+    m_revision(0)
+{
+}
+
+void PointSelection::setPointCloud(const QSharedPointer<PointCloudData> &cloud)
+{
+    m_cloud = cloud;
+    clear();
+}
+
+void PointSelection::clear()
+{
+    m_mask.clear();
+    m_selectedCount = 0;
+    ++m_revision;
+}
+
+bool PointSelection::isValid() const
+{
+    return m_cloud && !m_mask.isEmpty() && m_cloud->vertexRevision() == m_vertexRevision
+           && m_mask.size() == m_cloud->pointCount();
+}
+
+void PointSelection::selectPolygon(const QPolygonF &polygon, const QMatrix4x4 &viewProjection, const QSize &viewport,
+                                   Operation operation)
+{
+    COUNT_ALLOCATIONS("selectPolygon");
+
+    if (!m_cloud || m_cloud->isEmpty()) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!isValid()) {
+        m_mask = QVector<quint8>(m_cloud->pointCount(), 0);
+        m_vertexRevision = m_cloud->vertexRevision();
+    }
+
+    Coverage coverage;
+    rasterize(polygon, viewport, coverage);
+
+    const float *m = viewProjection.constData();
+    const float halfWidth = 0.5f * viewport.width();
+    const float halfHeight = 0.5f * viewport.height();
+
+    // Rows of the matrix that matter, pre-scaled to pixels, held by value
+    // so the projection loop has nothing that could alias its output.
+    struct ProjectionRows {
+        float x0, x1, x2, x3;
+        float y0, y1, y2, y3;
+        float w0, w1, w2, w3;
+    };
+    const ProjectionRows row = {
+        m[0] * halfWidth, m[4] * halfWidth, m[8] * halfWidth, m[12] * halfWidth,
+        m[1] * halfHeight, m[5] * halfHeight, m[9] * halfHeight, m[13] * halfHeight,
+        m[3], m[7], m[11], m[15]
+    };
+    const QVector<PointCloudData::Chunk> &chunks = m_cloud->chunks();
+    QSharedPointer<const CompressedPointStore> store = m_cloud->compressedStore();
+    const QVector<Vertex> vertices = store ? QVector<Vertex>() : m_cloud->vertices();
+    quint8 *mask = m_mask.data();
+
+    // Chunks are handed out one at a time: regions usually cover a few
+    // chunks of a sorted cloud, which fixed ranges would leave to one core.
+    std::atomic<int> nextChunk(0);
+    std::atomic<qint64> selected(0);
+    const int workers = parallelBlockCount(chunks.size(), 1);
+    parallelFor(workers, [&, row](qint64, qint64) {
+        QVector<Vertex> decoded;
+        float screenX[ProjectionBatch];
+        float screenY[ProjectionBatch];
+        float depth[ProjectionBatch];
+        qint64 count = 0;
+
+        for (int c = nextChunk++; c < chunks.size(); c = nextChunk++) {
+            const PointCloudData::Chunk &chunk = chunks[c];
+            quint8 *chunkMask = mask + chunk.first;
+
+            const ChunkCoverage whole = coverage.width > 0
+                ? classifyChunk(chunk, m, halfWidth, halfHeight, coverage) : ChunkCoverage::Outside;
+            if (whole == ChunkCoverage::Inside && operation != Operation::Subtract) {
+                std::memset(chunkMask, 1, size_t(chunk.count));
+            } else if ((whole == ChunkCoverage::Inside && operation == Operation::Subtract)
+                       || (whole == ChunkCoverage::Outside && operation == Operation::Replace)) {
+                std::memset(chunkMask, 0, size_t(chunk.count));
+            } else if (whole == ChunkCoverage::Partial) {
+                const Vertex *points = nullptr;
+                if (store) {
+                    decoded.resize(chunk.count);
+                    store->decodeChunk(c, decoded.data());
+                    points = decoded.constData();
+                } else {
+                    points = vertices.constData() + chunk.first;
+                }
+
+                const quint8 *pixels = coverage.pixels.constData();
+                const float offsetX = halfWidth - coverage.left;
+                const float offsetY = halfHeight - coverage.top;
+                for (int base = 0; base < chunk.count; base += ProjectionBatch) {
+                    const int batch = std::min(ProjectionBatch, chunk.count - base);
+                    const Vertex *batchPoints = points + base;
+                    for (int i = 0; i < batch; ++i) {
+                        const float x = batchPoints[i].position.x();
+                        const float y = batchPoints[i].position.y();
+                        const float z = batchPoints[i].position.z();
+                        const float w = row.w0 * x + row.w1 * y + row.w2 * z + row.w3;
+                        const float inverseW = 1.0f / w;
+                        screenX[i] = (row.x0 * x + row.x1 * y + row.x2 * z + row.x3) * inverseW + offsetX;
+                        screenY[i] = offsetY - (row.y0 * x + row.y1 * y + row.y2 * z + row.y3) * inverseW;
+                        depth[i] = w;
+                    }
+
+                    quint8 *batchMask = chunkMask + base;
+                    for (int i = 0; i < batch; ++i) {
+                        // NaN coordinates fail every comparison and stay out.
+                        const bool onRegion = depth[i] > 0.0f && screenX[i] >= 0.0f && screenY[i] >= 0.0f
+                                              && screenX[i] < coverage.width && screenY[i] < coverage.height;
+                        const quint8 inside = onRegion ? pixels[int(screenY[i]) * coverage.width + int(screenX[i])] : 0;
+                        switch (operation) {
+                        case Operation::Replace:
+                            batchMask[i] = inside;
+                            break;
+                        case Operation::Add:
+                            batchMask[i] |= inside;
+                            break;
+                        case Operation::Subtract:
+                            batchMask[i] &= quint8(inside ^ 1);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            for (int i = 0; i < chunk.count; ++i) {
+                count += chunkMask[i];
+            }
+        }
+        selected += count;
+    }, 1);
+
+    m_selectedCount = int(selected.load());
+    ++m_revision;
+
+    qDebug() << "Selected" << m_selectedCount << "of" << m_mask.size() << "points in" << timer.elapsed() << "ms";
+}
@@ -0,0 +1,65 @@
+#ifndef POINTSELECTION_H
+#define POINTSELECTION_H
+
+#include <QMatrix4x4>
+#include <QPolygonF>
+#include <QSharedPointer>
+#include <QSize>
+#include <QVector>
+#include "pointclouddata.h"
+
+// Set of cloud points picked by a screen-space region (box or lasso).
+//
+// The region is rasterized once into a coverage mask at pixel resolution,
+// with a summed-area table over it, so classifying a point is a projection
+// and one lookup however many vertices the lasso has. Chunks whose
+// projected bounds miss the region, or lie entirely inside it, are decided
+// as a whole without touching their points; the rest are projected in small
+// batches laid out for the compiler to vectorize, one chunk range per core.
+//
+// The result is a byte per vertex in the cloud's current order, ready for
+// PointCloudData::filterVertices() and the savers. It goes stale when the
+// cloud's vertices change (see isValid()).
+class PointSelection
+{
+public:
+    enum class Operation {
+        Replace,
+        Add,
+        Subtract
+    };
+
+    PointSelection();
+
+    // Starts an empty selection over the cloud.
+    void setPointCloud(const QSharedPointer<PointCloudData> &cloud);
+
+    // Applies the points whose projection through viewProjection falls
+    // inside polygon, given in pixels of a viewport of the given size with
+    // y pointing down. Points behind the camera never match.
+    void selectPolygon(const QPolygonF &polygon, const QMatrix4x4 &viewProjection, const QSize &viewport,
+                       Operation operation);
+    void clear();
+
+    // Nonzero for selected vertices; empty until something was selected.
+    const QVector<quint8> &mask() const { return m_mask; }
+    int selectedCount() const { return m_selectedCount; }
+    bool isEmpty() const { return m_selectedCount == 0; }
+
+    // False once the cloud's vertices changed after the selection was made.
+    bool isValid() const;
+
+    // Bumped on every change, for renderers mirroring the mask on the GPU.
+    quint64 revision() const { return m_revision; }
+
+private:
+    typedef PointCloudData::Vertex Vertex;
+
+    QSharedPointer<PointCloudData> m_cloud;
+    quint64 m_vertexRevision;
+    QVector<quint8> m_mask;
+    int m_selectedCount;
+    quint64 m_revision;
+};
+
+#endif // POINTSELECTION_H
@@ -0,0 +1,271 @@
+#include "pointstream.h"
+#include <QOpenGLContext>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+static const GLuint64 FenceTimeoutNs = 1000000000;
+static const quint64 NeverDrawn = std::numeric_limits<quint64>::max();
+
+PointStream::PointStream(int capacity, int queueSlots)
+    : m_enqueuePos(0),
+    m_droppedBatches(0),
+    m_dequeuePos(0),
+    m_writeSegment(0),
+    m_latestTimestamp(std::numeric_limits<qint64>::min()),
+    m_retentionWindow(10000),
+    m_livePoints(0),
+    m_vbo(QOpenGLBuffer::VertexBuffer),
+    m_frame(0)
+{
+    // The queue indexes slots with a mask, so round up to a power of two.
+    quint64 slotCount = 2;
+    while (slotCount < quint64(std::max(queueSlots, 2))) {
+        slotCount <<= 1;
+    }
+    m_slots.reset(new Slot[slotCount]);
+    m_slotMask = slotCount - 1;
+    for (quint64 i = 0; i < slotCount; ++i) {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        m_slots[i].timestamp = 0;
+    }
+
+    m_segmentSize = std::max(1, capacity / SegmentCount);
+    m_segments.resize(SegmentCount);
+    for (Segment &segment : m_segments) {
+        segment.count = 0;
+        segment.newestTimestamp = std::numeric_limits<qint64>::min();
+        segment.lastDrawnFrame = NeverDrawn;
+        segment.live = false;
+    }
+
+    for (int i = 0; i < MaxFramesInFlight; ++i) {
+        m_fences[i] = nullptr;
+        m_fenceFrames[i] = NeverDrawn;
+    }
+}
+
+PointStream::~PointStream()
+{
+    if (QOpenGLContext *context = QOpenGLContext::currentContext()) {
+        releaseGpuResources(context->extraFunctions());
+    }
+}
+
+bool PointStream::pushBatch(const QVector<Vertex> &points, qint64 timestampMs)
+{
+    return pushBatch(points.constData(), int(points.size()), timestampMs);
+}
+
+bool PointStream::pushBatch(const Vertex *points, int count, qint64 timestampMs)
+{
+    if (count <= 0) {
+        return true;
+    }
+
+    // Bounded MPMC queue after Vyukov, used with a single consumer. A slot
+    // is free for enqueue position p when its sequence equals p, and holds a
+    // batch for dequeue position p when its sequence equals p + 1.
+    quint64 pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Slot *slot = nullptr;
+    for (;;) {
+        slot = &m_slots[pos & m_slotMask];
+        const quint64 sequence = slot->sequence.load(std::memory_order_acquire);
+        const qint64 diff = qint64(sequence) - qint64(pos);
+        if (diff == 0) {
+            if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            m_droppedBatches.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Slots keep their capacity, so steady-state batches do not allocate.
+    slot->points.resize(count);
+    std::memcpy(slot->points.data(), points, size_t(count) * sizeof(Vertex));
+    slot->timestamp = timestampMs;
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool PointStream::update(QOpenGLExtraFunctions *gl)
+{
+    if (!m_vbo.isCreated()) {
+        m_vbo.create();
+        m_vbo.setUsagePattern(QOpenGLBuffer::StreamDraw);
+        m_vbo.bind();
+        m_vbo.allocate(m_segmentSize * SegmentCount * int(sizeof(Vertex)));
+        m_vbo.release();
+    }
+
+    bool changed = false;
+
+    m_vbo.bind();
+    for (;;) {
+        Slot &slot = m_slots[m_dequeuePos & m_slotMask];
+        if (slot.sequence.load(std::memory_order_acquire) != m_dequeuePos + 1) {
+            break;
+        }
+
+        // A batch larger than the whole ring only keeps its newest points.
+        const int keep = std::min(int(slot.points.size()), m_segmentSize * SegmentCount);
+        writePoints(gl, slot.points.constData() + (slot.points.size() - keep), keep, slot.timestamp);
+        m_latestTimestamp = std::max(m_latestTimestamp, slot.timestamp);
+
+        slot.sequence.store(m_dequeuePos + m_slotMask + 1, std::memory_order_release);
+        ++m_dequeuePos;
+        changed = true;
+    }
+    m_vbo.release();
+
+    if (m_retentionWindow > 0) {
+        for (Segment &segment : m_segments) {
+            if (segment.live && segment.newestTimestamp < m_latestTimestamp - m_retentionWindow) {
+                segment.live = false;
+                changed = true;
+            }
+        }
+    }
+
+    if (changed) {
+        updateBounds();
+    }
+    return changed;
+}
+
+void PointStream::writePoints(QOpenGLExtraFunctions *gl, const Vertex *points, int count, qint64 timestamp)
+{
+    while (count > 0) {
+        if (m_segments[m_writeSegment].count == m_segmentSize) {
+            m_writeSegment = (m_writeSegment + 1) % SegmentCount;
+            beginSegment(gl, m_writeSegment);
+        }
+
+        Segment &segment = m_segments[m_writeSegment];
+        const int written = std::min(count, m_segmentSize - segment.count);
+        const int offset = (m_writeSegment * m_segmentSize + segment.count) * int(sizeof(Vertex));
+
+        // In-flight draws only read [0, count) of this segment, so the tail
+        // can be written without synchronizing.
+        void *dst = m_vbo.mapRange(offset, written * int(sizeof(Vertex)),
+                                   QOpenGLBuffer::RangeWrite | QOpenGLBuffer::RangeInvalidate
+                                       | QOpenGLBuffer::RangeUnsynchronized);
+        if (!dst) {
+            qWarning("PointStream: failed to map stream buffer");
+            return;
+        }
+        std::memcpy(dst, points, size_t(written) * sizeof(Vertex));
+        m_vbo.unmap();
+
+        if (segment.count == 0) {
+            segment.boundsMin = points[0].position;
+            segment.boundsMax = points[0].position;
+        }
+        for (int i = 0; i < written; ++i) {
+            const QVector3D &p = points[i].position;
+            segment.boundsMin.setX(std::min(segment.boundsMin.x(), p.x()));
+            segment.boundsMin.setY(std::min(segment.boundsMin.y(), p.y()));
+            segment.boundsMin.setZ(std::min(segment.boundsMin.z(), p.z()));
+
+            segment.boundsMax.setX(std::max(segment.boundsMax.x(), p.x()));
+            segment.boundsMax.setY(std::max(segment.boundsMax.y(), p.y()));
+            segment.boundsMax.setZ(std::max(segment.boundsMax.z(), p.z()));
+        }
+
+        segment.count += written;
+        segment.newestTimestamp = std::max(segment.newestTimestamp, timestamp);
+        segment.live = true;
+
+        points += written;
+        count -= written;
+    }
+}
+
+void PointStream::beginSegment(QOpenGLExtraFunctions *gl, int index)
+{
+    Segment &segment = m_segments[index];
+
+    // Overwriting from the start: the GPU must be done with the last frame
+    // that drew this segment. Fences older than MaxFramesInFlight were
+    // already waited on when their slot was recycled in markDrawn().
+    if (segment.lastDrawnFrame != NeverDrawn) {
+        const int slot = int(segment.lastDrawnFrame % MaxFramesInFlight);
+        if (m_fences[slot] && m_fenceFrames[slot] == segment.lastDrawnFrame) {
+            gl->glClientWaitSync(m_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, FenceTimeoutNs);
+        }
+    }
+
+    segment.count = 0;
+    segment.newestTimestamp = std::numeric_limits<qint64>::min();
+    segment.lastDrawnFrame = NeverDrawn;
+    segment.live = false;
+}
+
+void PointStream::appendDrawRanges(QVector<GLint> &first, QVector<GLsizei> &count) const
+{
+    for (int i = 0; i < m_segments.size(); ++i) {
+        if (m_segments[i].live) {
+            first.append(i * m_segmentSize);
+            count.append(m_segments[i].count);
+        }
+    }
+}
+
+void PointStream::markDrawn(QOpenGLExtraFunctions *gl)
+{
+    const int slot = int(m_frame % MaxFramesInFlight);
+    if (m_fences[slot]) {
+        gl->glClientWaitSync(m_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, FenceTimeoutNs);
+        gl->glDeleteSync(m_fences[slot]);
+    }
+    m_fences[slot] = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_fenceFrames[slot] = m_frame;
+
+    for (Segment &segment : m_segments) {
+        if (segment.live) {
+            segment.lastDrawnFrame = m_frame;
+        }
+    }
+    ++m_frame;
+}
+
+void PointStream::releaseGpuResources(QOpenGLExtraFunctions *gl)
+{
+    for (int i = 0; i < MaxFramesInFlight; ++i) {
+        if (m_fences[i]) {
+            gl->glDeleteSync(m_fences[i]);
+            m_fences[i] = nullptr;
+        }
+    }
+    if (m_vbo.isCreated()) {
+        m_vbo.destroy();
+    }
+}
+
+void PointStream::updateBounds()
+{
+    m_livePoints = 0;
+    for (const Segment &segment : m_segments) {
+        if (!segment.live) {
+            continue;
+        }
+
+        if (m_livePoints == 0) {
+            m_boundingBoxMin = segment.boundsMin;
+            m_boundingBoxMax = segment.boundsMax;
+        } else {
+            m_boundingBoxMin.setX(std::min(m_boundingBoxMin.x(), segment.boundsMin.x()));
+            m_boundingBoxMin.setY(std::min(m_boundingBoxMin.y(), segment.boundsMin.y()));
+            m_boundingBoxMin.setZ(std::min(m_boundingBoxMin.z(), segment.boundsMin.z()));
+
+            m_boundingBoxMax.setX(std::max(m_boundingBoxMax.x(), segment.boundsMax.x()));
+            m_boundingBoxMax.setY(std::max(m_boundingBoxMax.y(), segment.boundsMax.y()));
+            m_boundingBoxMax.setZ(std::max(m_boundingBoxMax.z(), segment.boundsMax.z()));
+        }
+        m_livePoints += segment.count;
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef POINTSTREAM_H
+#define POINTSTREAM_H
+
+#include <QOpenGLBuffer>
+#include <QOpenGLExtraFunctions>
+#include <QVector3D>
+#include <QVector>
+#include <atomic>
+#include <memory>
+#include "pointclouddata.h"
+
+// Live point feed: batches pushed from any number of producer threads are
+// drained on the GL thread into a ring of fixed-size segments inside one
+// vertex buffer.
+//
+// Producers never block. Batches go through a bounded lock-free MPSC queue
+// whose slots keep their allocations, and a batch is dropped (and counted)
+// when the queue is full. Segments are written with unsynchronized mapped
+// writes; before a segment is reused the writer waits on the fence of the
+// last frame that drew it. Segments whose newest point is older than the
+// retention window stop being drawn.
+class PointStream
+{
+public:
+    typedef PointCloudData::Vertex Vertex;
+
+    explicit PointStream(int capacity = 4 * 1024 * 1024, int queueSlots = 256);
+    ~PointStream();
+
+    // Thread-safe. timestampMs is the sensor time of the batch; the window
+    // is measured against the newest timestamp seen. Returns false if the
+    // batch was dropped because the queue is full.
+    bool pushBatch(const Vertex *points, int count, qint64 timestampMs);
+    bool pushBatch(const QVector<Vertex> &points, qint64 timestampMs);
+
+    void setRetentionWindow(qint64 milliseconds) { m_retentionWindow = milliseconds; }
+    qint64 retentionWindow() const { return m_retentionWindow; }
+
+    // GL thread only, with a context from the renderers' share group
+    // current. Drains queued batches into the GPU ring and expires old
+    // segments; returns true when the drawable set changed.
+    bool update(QOpenGLExtraFunctions *gl);
+    // Adds the live segment ranges to a multi-draw list.
+    void appendDrawRanges(QVector<GLint> &first, QVector<GLsizei> &count) const;
+    // Fences the frame that just drew the stream.
+    void markDrawn(QOpenGLExtraFunctions *gl);
+    void releaseGpuResources(QOpenGLExtraFunctions *gl);
+
+    QOpenGLBuffer &vertexBuffer() { return m_vbo; }
+    bool isGpuReady() const { return m_vbo.isCreated(); }
+
+    int pointCount() const { return m_livePoints; }
+    bool hasBounds() const { return m_livePoints > 0; }
+    QVector3D getBoundingBoxMin() const { return m_boundingBoxMin; }
+    QVector3D getBoundingBoxMax() const { return m_boundingBoxMax; }
+    quint64 droppedBatches() const { return m_droppedBatches.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<quint64> sequence;
+        QVector<Vertex> points;
+        qint64 timestamp;
+    };
+
+    struct Segment {
+        int count;
+        qint64 newestTimestamp;
+        quint64 lastDrawnFrame;
+        bool live;
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+    };
+
+    static const int SegmentCount = 64;
+    static const int MaxFramesInFlight = 4;
+
+    void writePoints(QOpenGLExtraFunctions *gl, const Vertex *points, int count, qint64 timestamp);
+    void beginSegment(QOpenGLExtraFunctions *gl, int segment);
+    void updateBounds();
+
+    // Producer side.
+    std::unique_ptr<Slot[]> m_slots;
+    quint64 m_slotMask;
+    std::atomic<quint64> m_enqueuePos;
+    std::atomic<quint64> m_droppedBatches;
+
+    // Consumer (GL thread) side.
+    quint64 m_dequeuePos;
+    int m_segmentSize;
+    QVector<Segment> m_segments;
+    int m_writeSegment;
+    qint64 m_latestTimestamp;
+    qint64 m_retentionWindow;
+    int m_livePoints;
+    QVector3D m_boundingBoxMin;
+    QVector3D m_boundingBoxMax;
+
+    QOpenGLBuffer m_vbo;
+    GLsync m_fences[MaxFramesInFlight];
+    quint64 m_fenceFrames[MaxFramesInFlight];
+    quint64 m_frame;
+};
+
+#endif // POINTSTREAM_H
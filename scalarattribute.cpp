@@ -0,0 +1,244 @@
+#include "scalarattribute.h"
+#include "parallelfor.h"
+#include <QFile>
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+bool ScalarAttribute::typeFromPlyName(const std::string &name, Type &type)
+{
+    if (name == "char" || name == "int8") type = Type::Int8;
+    else if (name == "uchar" || name == "uint8") type = Type::UInt8;
+    else if (name == "short" || name == "int16") type = Type::Int16;
+    else if (name == "ushort" || name == "uint16") type = Type::UInt16;
+    else if (name == "int" || name == "int32") type = Type::Int32;
+    else if (name == "uint" || name == "uint32") type = Type::UInt32;
+    else if (name == "float" || name == "float32") type = Type::Float32;
+    else if (name == "double" || name == "float64") type = Type::Float64;
+    else return false;
+    return true;
+}
+
+int ScalarAttribute::typeSize(Type type)
+{
+    switch (type) {
+    case Type::Int8:
+    case Type::UInt8:
+        return 1;
+    case Type::Int16:
+    case Type::UInt16:
+        return 2;
+    case Type::Int32:
+    case Type::UInt32:
+    case Type::Float32:
+        return 4;
+    case Type::Float64:
+        return 8;
+    }
+    return 0;
+}
+
+template <typename T>
+static T readRaw(const char *data, bool bigEndian)
+{
+    char bytes[sizeof(T)];
+    if (bigEndian) {
+        std::reverse_copy(data, data + sizeof(T), bytes);
+    } else {
+        std::memcpy(bytes, data, sizeof(T));
+    }
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+// Assumes a little-endian host, like the rest of the loader.
+double ScalarAttribute::readValue(const char *data, Type type, bool bigEndian)
+{
+    switch (type) {
+    case Type::Int8: return readRaw<qint8>(data, false);
+    case Type::UInt8: return readRaw<quint8>(data, false);
+    case Type::Int16: return readRaw<qint16>(data, bigEndian);
+    case Type::UInt16: return readRaw<quint16>(data, bigEndian);
+    case Type::Int32: return readRaw<qint32>(data, bigEndian);
+    case Type::UInt32: return readRaw<quint32>(data, bigEndian);
+    case Type::Float32: return readRaw<float>(data, bigEndian);
+    case Type::Float64: return readRaw<double>(data, bigEndian);
+    }
+    return 0.0;
+}
+
+ScalarAttribute::ScalarAttribute()
+    : ScalarAttribute(QString(), Type::Float32)
+{
+}
+
+ScalarAttribute::ScalarAttribute(const QString &name, Type type)
+    : m_name(name),
+    m_type(type),
+    m_dataOffset(0),
+    m_recordSize(0),
+    m_fieldOffset(0),
+    m_bigEndian(false),
+    m_count(0),
+    m_offset(0.0),
+    m_loaded(false)
+{
+    m_statistics.minimum = 0.0;
+    m_statistics.maximum = 0.0;
+    m_statistics.low = 0.0;
+    m_statistics.high = 0.0;
+}
+
+void ScalarAttribute::setFileSource(const QString &filename, qint64 dataOffset, int recordSize, int fieldOffset,
+                                    bool bigEndian, int count)
+{
+    m_sourceFile = filename;
+    m_dataOffset = dataOffset;
+    m_recordSize = recordSize;
+    m_fieldOffset = fieldOffset;
+    m_bigEndian = bigEndian;
+    m_count = count;
+    m_values.clear();
+    m_loaded = false;
+}
+
+void ScalarAttribute::appendValue(double value)
+{
+    if (m_values.isEmpty()) {
+        m_offset = value;
+    }
+    m_values.append(float(value - m_offset));
+    m_loaded = false;
+}
+
+bool ScalarAttribute::load()
+{
+    if (m_loaded) {
+        return true;
+    }
+
+    if (!m_sourceFile.isEmpty() && m_values.isEmpty() && m_count > 0) {
+        QFile file(m_sourceFile);
+        const qint64 length = qint64(m_count) * m_recordSize;
+        if (!file.open(QIODevice::ReadOnly) || file.size() < m_dataOffset + length) {
+            qDebug() << "Failed to read attribute" << m_name << "from" << m_sourceFile;
+            return false;
+        }
+
+        const uchar *mapped = file.map(m_dataOffset, length);
+        if (!mapped) {
+            qDebug() << "Failed to map" << m_sourceFile;
+            return false;
+        }
+
+        const char *records = reinterpret_cast<const char *>(mapped) + m_fieldOffset;
+        const int recordSize = m_recordSize;
+        const Type type = m_type;
+        const bool bigEndian = m_bigEndian;
+        const double offset = readValue(records, type, bigEndian);
+
+        m_values.resize(m_count);
+        float *values = m_values.data();
+        parallelFor(m_count, [=](qint64 begin, qint64 end) {
+            for (qint64 i = begin; i < end; ++i) {
+                values[i] = float(readValue(records + i * recordSize, type, bigEndian) - offset);
+            }
+        });
+        m_offset = offset;
+
+        file.unmap(const_cast<uchar *>(mapped));
+    }
+
+    computeStatistics();
+    m_loaded = true;
+    return true;
+}
+
+void ScalarAttribute::computeStatistics()
+{
+    Statistics &stats = m_statistics;
+    stats.histogram.fill(0, HistogramBins);
+
+    const int count = m_values.size();
+    const float *values = m_values.constData();
+    const int blockCount = parallelBlockCount(count);
+
+    // Pass one: per-block extrema. NaNs fail both comparisons and drop out.
+    QVector<float> blockMin(blockCount, std::numeric_limits<float>::max());
+    QVector<float> blockMax(blockCount, std::numeric_limits<float>::lowest());
+    float *blockMinData = blockMin.data();
+    float *blockMaxData = blockMax.data();
+    parallelForBlocks(count, blockCount, [=](int block, qint64 begin, qint64 end) {
+        float lo = std::numeric_limits<float>::max();
+        float hi = std::numeric_limits<float>::lowest();
+        for (qint64 i = begin; i < end; ++i) {
+            if (values[i] < lo) lo = values[i];
+            if (values[i] > hi) hi = values[i];
+        }
+        blockMinData[block] = lo;
+        blockMaxData[block] = hi;
+    });
+
+    const float lo = *std::min_element(blockMin.constBegin(), blockMin.constEnd());
+    const float hi = *std::max_element(blockMax.constBegin(), blockMax.constEnd());
+    if (count == 0 || lo > hi) {
+        stats.minimum = stats.maximum = stats.low = stats.high = m_offset;
+        return;
+    }
+
+    // Pass two: per-block histograms over [lo, hi], merged.
+    const float scale = hi > lo ? float(HistogramBins) / (hi - lo) : 0.0f;
+    QVector<quint32> blockHistograms(blockCount * HistogramBins, 0);
+    quint32 *blockHistogramData = blockHistograms.data();
+    parallelForBlocks(count, blockCount, [=](int block, qint64 begin, qint64 end) {
+        quint32 *histogram = blockHistogramData + block * HistogramBins;
+        for (qint64 i = begin; i < end; ++i) {
+            if (values[i] >= lo && values[i] <= hi) {
+                ++histogram[std::min(HistogramBins - 1, int((values[i] - lo) * scale))];
+            }
+        }
+    });
+
+    quint64 total = 0;
+    for (int block = 0; block < blockCount; ++block) {
+        for (int bin = 0; bin < HistogramBins; ++bin) {
+            stats.histogram[bin] += blockHistograms[block * HistogramBins + bin];
+        }
+    }
+    for (quint32 binCount : stats.histogram) {
+        total += binCount;
+    }
+
+    // Percentiles at bin resolution: the lower edge of the bin reaching 1%,
+    // the upper edge of the bin reaching 99%.
+    const double binWidth = double(hi - lo) / HistogramBins;
+    int lowBin = 0;
+    int highBin = HistogramBins - 1;
+    quint64 cumulative = 0;
+    for (int bin = 0; bin < HistogramBins; ++bin) {
+        cumulative += stats.histogram[bin];
+        if (cumulative * 100 >= total) {
+            lowBin = bin;
+            break;
+        }
+    }
+    cumulative = 0;
+    for (int bin = HistogramBins - 1; bin >= 0; --bin) {
+        cumulative += stats.histogram[bin];
+        if (cumulative * 100 >= total) {
+            highBin = bin;
+            break;
+        }
+    }
+
+    stats.minimum = m_offset + lo;
+    stats.maximum = m_offset + hi;
+    stats.low = m_offset + lo + lowBin * binWidth;
+    stats.high = m_offset + lo + (highBin + 1) * binWidth;
+    if (stats.high <= stats.low) {
+        stats.low = stats.minimum;
+        stats.high = stats.maximum;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef SCALARATTRIBUTE_H
+#define SCALARATTRIBUTE_H
+
+#include <QString>
+#include <QVector>
+#include <string>
+
+// One per-point scalar property of a loaded file: intensity, classification,
+// return number, GPS time and the like.
+//
+// Values are a column in file order. Columns backed by a binary file are
+// decoded on first load(), straight from the mapped file, so attributes that
+// are never looked at cost no memory. Values are stored as floats relative
+// to offset(), which keeps large-magnitude doubles such as GPS time precise
+// enough to colormap.
+class ScalarAttribute
+{
+public:
+    enum class Type {
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Float32,
+        Float64
+    };
+
+    struct Statistics {
+        double minimum;
+        double maximum;
+        // 1st and 99th percentile, for a colormap range that stray values
+        // do not flatten.
+        double low;
+        double high;
+        QVector<quint32> histogram;
+    };
+
+    static const int HistogramBins = 256;
+
+    // PLY type names, both the classic (uchar) and sized (uint8) spellings.
+    static bool typeFromPlyName(const std::string &name, Type &type);
+    static int typeSize(Type type);
+    static double readValue(const char *data, Type type, bool bigEndian);
+
+    ScalarAttribute();
+    ScalarAttribute(const QString &name, Type type);
+
+    QString name() const { return m_name; }
+    Type type() const { return m_type; }
+
+    // Column of a binary file with fixed-size records starting at
+    // dataOffset; decoded on first load().
+    void setFileSource(const QString &filename, qint64 dataOffset, int recordSize, int fieldOffset,
+                       bool bigEndian, int count);
+
+    // Eager filling, for sources that are parsed anyway (text formats).
+    void reserve(int count) { m_values.reserve(count); }
+    void appendValue(double value);
+
+    // Decodes the column if needed and computes statistics. Returns false
+    // if the backing file can no longer be read.
+    bool load();
+    bool isLoaded() const { return m_loaded; }
+
+    const QVector<float> &values() const { return m_values; }
+    double offset() const { return m_offset; }
+    const Statistics &statistics() const { return m_statistics; }
+
+private:
+    void computeStatistics();
+
+    QString m_name;
+    Type m_type;
+
+    QString m_sourceFile;
+    qint64 m_dataOffset;
+    int m_recordSize;
+    int m_fieldOffset;
+    bool m_bigEndian;
+    int m_count;
+
+    QVector<float> m_values;
+    double m_offset;
+    bool m_loaded;
+    Statistics m_statistics;
+};
+
+#endif // SCALARATTRIBUTE_H
@@ -0,0 +1,262 @@
+#include "spatialindex.h"
+#include "parallelfor.h"
+#include <algorithm>
+
+SpatialIndex::SpatialIndex()
+{
+}
+
+void SpatialIndex::build(const QVector<PointCloudData::Vertex> &vertices)
+{
+    const int count = vertices.size();
+    m_points.resize(count);
+    m_splitValue.clear();
+    m_splitAxis.clear();
+    if (count == 0) {
+        return;
+    }
+
+    {
+        const PointCloudData::Vertex *vertexData = vertices.constData();
+        Point *points = m_points.data();
+        parallelFor(count, [vertexData, points](qint64 begin, qint64 end) {
+            for (qint64 i = begin; i < end; ++i) {
+                points[i].position = vertexData[i].position;
+                points[i].index = int(i);
+            }
+        });
+    }
+
+    // Midpoint splits at most halve a node (rounding up), so after this many
+    // levels every node is a leaf.
+    int depth = 0;
+    for (int size = count; size > LeafSize; size = (size + 1) / 2) {
+        ++depth;
+    }
+    const int nodeCount = (1 << (depth + 1)) - 1;
+    m_splitValue.resize(nodeCount);
+    m_splitAxis.resize(nodeCount);
+
+    // Split the top levels here until there is a subtree per worker or so,
+    // then build the disjoint subtrees in parallel.
+    struct Subtree {
+        int node;
+        int begin;
+        int end;
+    };
+    QVector<Subtree> subtrees;
+    subtrees.append({ 0, 0, count });
+    const int wanted = 4 * parallelThreadCount();
+    while (subtrees.size() < wanted && subtrees.first().end - subtrees.first().begin > 16 * LeafSize) {
+        QVector<Subtree> next;
+        for (const Subtree &subtree : subtrees) {
+            const int mid = splitNode(subtree.node, subtree.begin, subtree.end);
+            next.append({ 2 * subtree.node + 1, subtree.begin, mid });
+            next.append({ 2 * subtree.node + 2, mid, subtree.end });
+        }
+        subtrees = next;
+    }
+
+    const Subtree *subtreeData = subtrees.constData();
+    parallelFor(subtrees.size(), [this, subtreeData](qint64 begin, qint64 end) {
+        for (qint64 i = begin; i < end; ++i) {
+            buildNode(subtreeData[i].node, subtreeData[i].begin, subtreeData[i].end);
+        }
+    }, 1);
+}
+
+// Splits [begin, end) at its midpoint along the axis of largest variance
+// and records the plane; returns the midpoint. Variance rather than extent:
+// a handful of stray points spans a node's whole bounding box, but hardly
+// moves its variance, so the split still follows the surface.
+int SpatialIndex::splitNode(int node, int begin, int end)
+{
+    Point *points = m_points.data();
+
+    // Relative to the first point, for precision with large coordinates.
+    const QVector3D origin = points[begin].position;
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    double sumSquares[3] = { 0.0, 0.0, 0.0 };
+    for (int i = begin + 1; i < end; ++i) {
+        const QVector3D d = points[i].position - origin;
+        for (int a = 0; a < 3; ++a) {
+            sum[a] += d[a];
+            sumSquares[a] += double(d[a]) * d[a];
+        }
+    }
+
+    const double n = double(end - begin);
+    int axis = 0;
+    double bestVariance = -1.0;
+    for (int a = 0; a < 3; ++a) {
+        const double variance = sumSquares[a] / n - (sum[a] / n) * (sum[a] / n);
+        if (variance > bestVariance) {
+            bestVariance = variance;
+            axis = a;
+        }
+    }
+
+    const int mid = begin + (end - begin) / 2;
+    std::nth_element(points + begin, points + mid, points + end, [axis](const Point &a, const Point &b) {
+        return a.position[axis] < b.position[axis];
+    });
+
+    m_splitAxis[node] = quint8(axis);
+    m_splitValue[node] = points[mid].position[axis];
+    return mid;
+}
+
+void SpatialIndex::buildNode(int node, int begin, int end)
+{
+    if (end - begin <= LeafSize) {
+        return;
+    }
+    const int mid = splitNode(node, begin, end);
+    buildNode(2 * node + 1, begin, mid);
+    buildNode(2 * node + 2, mid, end);
+}
+
+void SpatialIndex::kNearest(const QVector3D &position, int k, QVector<QPair<float, int>> &neighbors) const
+{
+    neighbors.clear();
+    if (isEmpty() || k <= 0) {
+        return;
+    }
+
+    // neighbors is kept as a max-heap on distance while searching.
+    float offsets[3] = { 0.0f, 0.0f, 0.0f };
+    searchNearest(0, 0, m_points.size(), position, k, offsets, 0.0f, neighbors);
+    std::sort_heap(neighbors.begin(), neighbors.end());
+}
+
+// offsets holds the query's distance along each axis to the node's region
+// (as bounded by the ancestors' split planes), and regionDistance the sum
+// of their squares: a lower bound on the distance to any point in the node.
+// Planes along one axis alone prune badly around stray points, whose
+// search sphere cuts through dense regions on the other axes.
+void SpatialIndex::searchNearest(int node, int begin, int end, const QVector3D &position, int k,
+                                 float offsets[3], float regionDistance,
+                                 QVector<QPair<float, int>> &neighbors) const
+{
+    if (end - begin <= LeafSize) {
+        for (int i = begin; i < end; ++i) {
+            const float distance = (m_points[i].position - position).lengthSquared();
+            if (neighbors.size() < k) {
+                neighbors.append(qMakePair(distance, m_points[i].index));
+                std::push_heap(neighbors.begin(), neighbors.end());
+            } else if (distance < neighbors.first().first) {
+                std::pop_heap(neighbors.begin(), neighbors.end());
+                neighbors.last() = qMakePair(distance, m_points[i].index);
+                std::push_heap(neighbors.begin(), neighbors.end());
+            }
+        }
+        return;
+    }
+
+    const int mid = begin + (end - begin) / 2;
+    const int axis = m_splitAxis[node];
+    const float offset = position[axis] - m_splitValue[node];
+
+    // Nearer side first; the far side only while its region is closer than
+    // the current k-th neighbour.
+    const int nearNode = offset < 0.0f ? 2 * node + 1 : 2 * node + 2;
+    const int farNode = offset < 0.0f ? 2 * node + 2 : 2 * node + 1;
+    if (offset < 0.0f) {
+        searchNearest(nearNode, begin, mid, position, k, offsets, regionDistance, neighbors);
+    } else {
+        searchNearest(nearNode, mid, end, position, k, offsets, regionDistance, neighbors);
+    }
+
+    const float farDistance = regionDistance - offsets[axis] * offsets[axis] + offset * offset;
+    if (neighbors.size() < k || farDistance < neighbors.first().first) {
+        const float previousOffset = offsets[axis];
+        offsets[axis] = offset;
+        if (offset < 0.0f) {
+            searchNearest(farNode, mid, end, position, k, offsets, farDistance, neighbors);
+        } else {
+            searchNearest(farNode, begin, mid, position, k, offsets, farDistance, neighbors);
+        }
+        offsets[axis] = previousOffset;
+    }
+}
+
+void SpatialIndex::radiusSearch(const QVector3D &position, float radius, QVector<int> &indices) const
+{
+    indices.clear();
+    if (isEmpty() || radius < 0.0f) {
+        return;
+    }
+    searchRadius(0, 0, m_points.size(), position, radius * radius, indices);
+}
+
+void SpatialIndex::searchRadius(int node, int begin, int end, const QVector3D &position, float radiusSquared,
+                                QVector<int> &indices) const
+{
+    if (end - begin <= LeafSize) {
+        for (int i = begin; i < end; ++i) {
+            if ((m_points[i].position - position).lengthSquared() <= radiusSquared) {
+                indices.append(m_points[i].index);
+            }
+        }
+        return;
+    }
+
+    const int mid = begin + (end - begin) / 2;
+    const float offset = position[m_splitAxis[node]] - m_splitValue[node];
+    if (offset <= 0.0f || offset * offset <= radiusSquared) {
+        searchRadius(2 * node + 1, begin, mid, position, radiusSquared, indices);
+    }
+    if (offset >= 0.0f || offset * offset <= radiusSquared) {
+        searchRadius(2 * node + 2, mid, end, position, radiusSquared, indices);
+    }
+}
+
+int SpatialIndex::countWithin(const QVector3D &position, float radius, int limit) const
+{
+    int count = 0;
+    if (!isEmpty() && radius >= 0.0f && limit > 0) {
+        countRadius(0, 0, m_points.size(), position, radius * radius, limit, count);
+    }
+    return count;
+}
+
+void SpatialIndex::countRadius(int node, int begin, int end, const QVector3D &position, float radiusSquared,
+                               int limit, int &count) const
+{
+    if (end - begin <= LeafSize) {
+        for (int i = begin; i < end && count < limit; ++i) {
+            if ((m_points[i].position - position).lengthSquared() <= radiusSquared) {
+                ++count;
+            }
+        }
+        return;
+    }
+
+    const int mid = begin + (end - begin) / 2;
+    const float offset = position[m_splitAxis[node]] - m_splitValue[node];
+
+    // Nearer side first: dense neighbourhoods reach the limit there. The
+    // far side only when the plane is within the radius.
+    const bool planeInRange = offset * offset <= radiusSquared;
+    if (offset <= 0.0f) {
+        countRadius(2 * node + 1, begin, mid, position, radiusSquared, limit, count);
+        if (planeInRange && count < limit) {
+            countRadius(2 * node + 2, mid, end, position, radiusSquared, limit, count);
+        }
+    } else {
+        countRadius(2 * node + 2, mid, end, position, radiusSquared, limit, count);
+        if (planeInRange && count < limit) {
+            countRadius(2 * node + 1, begin, mid, position, radiusSquared, limit, count);
+        }
+    }
+}
+
+int SpatialIndex::nearest(const QVector3D &position, float maxDistance) const
+{
+    QVector<QPair<float, int>> neighbors;
+    kNearest(position, 1, neighbors);
+    if (neighbors.isEmpty() || neighbors.first().first > maxDistance * maxDistance) {
+        return -1;
+    }
+    return neighbors.first().second;
+}
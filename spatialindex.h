@@ -0,0 +1,71 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QVector3D>
+#include <QVector>
+#include <QPair>
+#include "pointclouddata.h"
+
+// Balanced kd-tree over a snapshot of point positions, for neighbourhood
+// queries.
+//
+// The tree is implicit: build() reorders a copy of the points so every node
+// is a contiguous range split at its midpoint along the axis of largest
+// variance, and only the split planes are stored, heap-indexed. Scans mix
+// dense surfaces with empty space and stray returns, which a balanced tree
+// handles without tuning. Queries are const and may run from any number of
+// threads; callers pass their own result vectors and reuse them across
+// queries to avoid allocating.
+class SpatialIndex
+{
+public:
+    SpatialIndex();
+
+    void build(const QVector<PointCloudData::Vertex> &vertices);
+
+    bool isEmpty() const { return m_points.isEmpty(); }
+    int pointCount() const { return m_points.size(); }
+
+    // The k points closest to position as (squared distance, vertex index),
+    // nearest first. Fewer when the index holds fewer than k points.
+    void kNearest(const QVector3D &position, int k, QVector<QPair<float, int>> &neighbors) const;
+
+    // Vertex indices of all points within radius of position, unordered.
+    void radiusSearch(const QVector3D &position, float radius, QVector<int> &indices) const;
+
+    // Number of points within radius of position, counting stops at limit.
+    // Cheaper than radiusSearch() where only "at least limit" matters.
+    int countWithin(const QVector3D &position, float radius, int limit) const;
+
+    // Closest vertex within maxDistance, or -1.
+    int nearest(const QVector3D &position, float maxDistance) const;
+
+    // Vertex index of the point at position i of the tree's own order, in
+    // which neighbouring positions are spatial neighbours. Batch queries
+    // over every point run far more cache-friendly walking this order than
+    // the vertex order of an unsorted cloud.
+    int treeOrderIndex(int i) const { return m_points[i].index; }
+
+private:
+    struct Point {
+        QVector3D position;
+        int index;
+    };
+
+    static const int LeafSize = 16;
+
+    int splitNode(int node, int begin, int end);
+    void buildNode(int node, int begin, int end);
+    void searchNearest(int node, int begin, int end, const QVector3D &position, int k, float offsets[3],
+                       float regionDistance, QVector<QPair<float, int>> &neighbors) const;
+    void searchRadius(int node, int begin, int end, const QVector3D &position, float radiusSquared,
+                      QVector<int> &indices) const;
+    void countRadius(int node, int begin, int end, const QVector3D &position, float radiusSquared, int limit,
+                     int &count) const;
+
+    QVector<Point> m_points;
+    QVector<float> m_splitValue;
+    QVector<quint8> m_splitAxis;
+};
+
+#endif // SPATIALINDEX_H
@@ -0,0 +1,206 @@
+#include "syntheticcloudgenerator.h"
+#include "parallelfor.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QSaveFile>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const float HalfExtent = 50.0f;
+static const float ClutterHeight = 20.0f;
+// Longest "x y z r g b" line: three %.9g floats and three bytes.
+static const int MaxLineLength = 3 * 17 + 3 * 4 + 1;
+// x y z as float, r g b as uchar.
+static const int BinaryRecordSize = 3 * 4 + 3;
+
+// SplitMix64 finalizer: a full-avalanche hash of a counter, the cheapest
+// generator with independent, random-access outputs.
+static quint64 mix(quint64 z)
+{
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1) from the top 24 bits.
+static float unit(quint64 bits)
+{
+    return float(bits >> 40) * (1.0f / 16777216.0f);
+}
+
+// Standard normal from two uniforms (Box-Muller).
+static float gaussian(quint64 a, quint64 b)
+{
+    const float u = std::max(unit(a), 1e-7f);
+    return std::sqrt(-2.0f * std::log(u)) * std::cos(2.0f * float(M_PI) * unit(b));
+}
+
+static float terrainHeight(float x, float z)
+{
+    return 3.0f * std::sin(x * 0.07f) * std::cos(z * 0.05f)
+           + 1.0f * std::sin(x * 0.23f + 1.3f) * std::sin(z * 0.19f + 0.4f)
+           + 0.3f * std::cos(x * 0.71f - z * 0.53f);
+}
+
+bool SyntheticCloudGenerator::parseShape(const QString &name, Shape &shape)
+{
+    const QString lower = name.toLower();
+    if (lower == "plane") {
+        shape = Shape::Plane;
+    } else if (lower == "terrain") {
+        shape = Shape::Terrain;
+    } else if (lower == "clutter") {
+        shape = Shape::Clutter;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void SyntheticCloudGenerator::generate(Shape shape, quint64 seed, qint64 first, int count,
+                                       PointCloudData::Vertex *vertices)
+{
+    const quint64 stream = mix(seed ^ (quint64(shape) << 56));
+    for (int i = 0; i < count; ++i) {
+        // Four independent draws per point.
+        const quint64 base = mix(stream + quint64(first + i));
+        const quint64 r0 = mix(base);
+        const quint64 r1 = mix(base + 1);
+        const quint64 r2 = mix(base + 2);
+        const quint64 r3 = mix(base + 3);
+
+        const float x = (unit(r0) * 2.0f - 1.0f) * HalfExtent;
+        const float z = (unit(r1) * 2.0f - 1.0f) * HalfExtent;
+        PointCloudData::Vertex &vertex = vertices[i];
+        switch (shape) {
+        case Shape::Plane: {
+            const float y = 0.02f * x + 0.01f * z + 0.002f * gaussian(r2, r3);
+            vertex.position = QVector3D(x, y, z);
+            vertex.color = QVector3D(0.6f, 0.6f, 0.6f);
+            break;
+        }
+        case Shape::Terrain: {
+            const float y = terrainHeight(x, z) + 0.02f * gaussian(r2, r3);
+            const float t = std::clamp((y + 4.5f) / 9.0f, 0.0f, 1.0f);
+            vertex.position = QVector3D(x, y, z);
+            vertex.color = QVector3D(0.3f + 0.5f * t, 0.5f + 0.3f * t, 0.2f + 0.2f * t);
+            break;
+        }
+        case Shape::Clutter: {
+            const float y = unit(r2) * ClutterHeight - 5.0f;
+            vertex.position = QVector3D(x, y, z);
+            vertex.color = QVector3D(unit(r3), unit(r3 << 24), unit(r3 << 48));
+            break;
+        }
+        }
+    }
+}
+
+QSharedPointer<PointCloudData> SyntheticCloudGenerator::generateCloud(Shape shape, int count, quint64 seed)
+{
+    QVector<PointCloudData::Vertex> vertices(std::max(0, count));
+    PointCloudData::Vertex *data = vertices.data();
+    parallelFor(vertices.size(), [&](qint64 begin, qint64 end) {
+        generate(shape, seed, begin, int(end - begin), data + begin);
+    });
+
+    QSharedPointer<PointCloudData> cloud(new PointCloudData);
+    cloud->setVertices(vertices);
+    return cloud;
+}
+
+static quint8 colorByte(float value)
+{
+    return quint8(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+}
+
+// Formats vertices as the records of the given format; returns the length.
+static qint64 formatRecords(const PointCloudData::Vertex *vertices, int count,
+                            SyntheticCloudGenerator::Format format, char *buffer)
+{
+    char *cursor = buffer;
+    for (int i = 0; i < count; ++i) {
+        const QVector3D &p = vertices[i].position;
+        const quint8 r = colorByte(vertices[i].color.x());
+        const quint8 g = colorByte(vertices[i].color.y());
+        const quint8 b = colorByte(vertices[i].color.z());
+        if (format == SyntheticCloudGenerator::Format::BinaryPly) {
+            const float xyz[3] = { p.x(), p.y(), p.z() };
+            std::memcpy(cursor, xyz, sizeof(xyz));
+            cursor[12] = char(r);
+            cursor[13] = char(g);
+            cursor[14] = char(b);
+            cursor += BinaryRecordSize;
+        } else {
+            cursor += std::snprintf(cursor, MaxLineLength, "%.9g %.9g %.9g %d %d %d\n",
+                                    p.x(), p.y(), p.z(), r, g, b);
+        }
+    }
+    return cursor - buffer;
+}
+
+bool SyntheticCloudGenerator::writeFile(const QString &filename, Shape shape, qint64 count, Format format,
+                                        quint64 seed)
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to open file for writing:" << filename;
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray header;
+    if (format == Format::Pts) {
+        header = QByteArray::number(count) + "\n";
+    } else {
+        header = format == Format::AsciiPly ? "ply\nformat ascii 1.0\n" : "ply\nformat binary_little_endian 1.0\n";
+        header += "element vertex " + QByteArray::number(count) + "\n";
+        header += "property float x\nproperty float y\nproperty float z\n";
+        header += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+        header += "end_header\n";
+    }
+    if (file.write(header) != header.size()) {
+        qDebug() << "Error writing file:" << filename;
+        return false;
+    }
+
+    // Each round generates and formats one chunk per thread, then writes
+    // them in order.
+    const int ChunkSize = PointCloudData::ChunkSize;
+    const int recordSize = format == Format::BinaryPly ? BinaryRecordSize : MaxLineLength;
+    const int threads = parallelBlockCount(count, ChunkSize);
+    std::vector<std::vector<PointCloudData::Vertex>> vertices(threads, std::vector<PointCloudData::Vertex>(ChunkSize));
+    std::vector<std::vector<char>> buffers(threads, std::vector<char>(size_t(ChunkSize) * recordSize));
+    std::vector<qint64> lengths(threads);
+
+    for (qint64 roundBegin = 0; roundBegin < count; roundBegin += qint64(threads) * ChunkSize) {
+        const qint64 roundCount = std::min(count - roundBegin, qint64(threads) * ChunkSize);
+        const int blocks = int((roundCount + ChunkSize - 1) / ChunkSize);
+        parallelForBlocks(blocks, blocks, [&](int block, qint64, qint64) {
+            const qint64 first = roundBegin + qint64(block) * ChunkSize;
+            const int chunkCount = int(std::min<qint64>(ChunkSize, count - first));
+            generate(shape, seed, first, chunkCount, vertices[block].data());
+            lengths[block] = formatRecords(vertices[block].data(), chunkCount, format, buffers[block].data());
+        });
+        for (int block = 0; block < blocks; ++block) {
+            if (file.write(buffers[block].data(), lengths[block]) != lengths[block]) {
+                qDebug() << "Error writing file:" << filename;
+                return false;
+            }
+        }
+    }
+
+    if (!file.commit()) {
+        qDebug() << "Error writing file:" << filename;
+        return false;
+    }
+    qDebug() << "Generated" << count << "points to" << filename << "in" << timer.elapsed() << "ms";
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef SYNTHETICCLOUDGENERATOR_H
+#define SYNTHETICCLOUDGENERATOR_H
+
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+#include "pointclouddata.h"
+
+// Deterministic point clouds for benchmarks and loader round trips.
+//
+// Point i depends only on the shape, the seed and i, hashed through
+// SplitMix64, so a cloud is the same whatever its size is split into: a
+// 1K cloud is the first thousand points of the 1B one, and files are
+// generated a chunk per thread. Files are streamed, so their size is only
+// limited by the disk. Y is up, as in the live sources; all shapes span
+// [-50, 50] in x and z.
+class SyntheticCloudGenerator
+{
+public:
+    enum class Shape {
+        // Gently tilted plane with millimetre noise.
+        Plane,
+        // Rolling heightfield of a few octaves, with centimetre noise.
+        Terrain,
+        // Uniform over the box above the terrain; stray returns.
+        Clutter
+    };
+
+    enum class Format {
+        Pts,
+        AsciiPly,
+        BinaryPly
+    };
+
+    // Accepts "plane", "terrain" and "clutter"; false for anything else.
+    static bool parseShape(const QString &name, Shape &shape);
+
+    // Vertices [first, first + count) of the shape's sequence.
+    static void generate(Shape shape, quint64 seed, qint64 first, int count, PointCloudData::Vertex *vertices);
+
+    // In-memory cloud; count is limited by QVector.
+    static QSharedPointer<PointCloudData> generateCloud(Shape shape, int count, quint64 seed = 1);
+
+    // Writes count points in a format the loaders read back exactly (to
+    // float precision, and 8-bit color).
+    static bool writeFile(const QString &filename, Shape shape, qint64 count, Format format, quint64 seed = 1);
+};
+
+#endif // SYNTHETICCLOUDGENERATOR_H
@@ -0,0 +1,117 @@
+#include "syntheticpointsource.h"
+#include <QElapsedTimer>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+static const int BeamCount = 32;
+static const float MaxRange = 40.0f;
+static const float SensorHeight = 2.0f; // sensor at the origin, ground at -SensorHeight
+static const float DriveSpeed = 1.0f; // metres per second along +X
+
+SyntheticPointSource::SyntheticPointSource(const QSharedPointer<PointStream> &stream,
+                                           int pointsPerSecond, int framesPerSecond, QObject *parent)
+    : QThread(parent),
+    m_stream(stream),
+    m_pointsPerSecond(pointsPerSecond),
+    m_framesPerSecond(std::max(1, framesPerSecond))
+{
+}
+
+SyntheticPointSource::~SyntheticPointSource()
+{
+    stop();
+}
+
+void SyntheticPointSource::stop()
+{
+    requestInterruption();
+    wait();
+}
+
+// Distance along the horizontal ray (ox, oz) + t * (dx, dz) to a vertical
+// pillar of the given radius, or MaxRange when it misses.
+static float pillarHit(float ox, float oz, float dx, float dz, float cx, float cz, float radius)
+{
+    const float fx = ox - cx;
+    const float fz = oz - cz;
+    const float a = dx * dx + dz * dz;
+    const float b = 2.0f * (fx * dx + fz * dz);
+    const float c = fx * fx + fz * fz - radius * radius;
+    const float disc = b * b - 4.0f * a * c;
+    if (a <= 0.0f || disc < 0.0f) {
+        return MaxRange;
+    }
+    const float t = (-b - std::sqrt(disc)) / (2.0f * a);
+    return t > 0.0f ? t : MaxRange;
+}
+
+void SyntheticPointSource::run()
+{
+    const int pointsPerFrame = std::max(BeamCount, m_pointsPerSecond / m_framesPerSecond);
+    const int stepsPerRevolution = pointsPerFrame / BeamCount;
+    const float pillarX[] = { -6.0f, 6.0f, -6.0f, 6.0f, 18.0f, 30.0f };
+    const float pillarZ[] = { -6.0f, -6.0f, 6.0f, 6.0f, -4.0f, 5.0f };
+
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    QVector<PointStream::Vertex> batch;
+    batch.reserve(pointsPerFrame);
+
+    QElapsedTimer clock;
+    clock.start();
+    qint64 nextFrame = 0;
+
+    while (!isInterruptionRequested()) {
+        const qint64 now = clock.elapsed();
+        const float sensorX = DriveSpeed * float(now) / 1000.0f;
+
+        batch.clear();
+        for (int step = 0; step < stepsPerRevolution; ++step) {
+            const float azimuth = 2.0f * float(M_PI) * float(step) / float(stepsPerRevolution);
+            const float dx = std::cos(azimuth);
+            const float dz = std::sin(azimuth);
+
+            for (int beam = 0; beam < BeamCount; ++beam) {
+                const float elevation = qDegreesToRadians(-25.0f + 30.0f * float(beam) / float(BeamCount - 1));
+                const float horizontal = std::cos(elevation);
+                const float vertical = std::sin(elevation);
+
+                float range = MaxRange;
+                if (vertical < 0.0f) {
+                    range = std::min(range, -SensorHeight / vertical);
+                }
+                bool pillar = false;
+                for (int p = 0; p < 6; ++p) {
+                    const float t = pillarHit(sensorX, 0.0f, dx * horizontal, dz * horizontal,
+                                              pillarX[p], pillarZ[p], 0.5f);
+                    if (t < range) {
+                        range = t;
+                        pillar = true;
+                    }
+                }
+                if (range >= MaxRange) {
+                    continue;
+                }
+
+                range += noise(rng);
+                PointStream::Vertex vertex;
+                vertex.position = QVector3D(sensorX + dx * horizontal * range,
+                                            vertical * range,
+                                            dz * horizontal * range);
+                vertex.color = pillar ? QVector3D(0.9f, 0.4f, 0.3f)
+                                      : QVector3D(0.3f, 0.6f + 0.01f * range, 0.3f);
+                batch.append(vertex);
+            }
+        }
+
+        m_stream->pushBatch(batch, now);
+
+        nextFrame += 1000 / m_framesPerSecond;
+        const qint64 sleep = nextFrame - clock.elapsed();
+        if (sleep > 0) {
+            msleep(static_cast<unsigned long>(sleep));
+        }
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef SYNTHETICPOINTSOURCE_H
+#define SYNTHETICPOINTSOURCE_H
+
+#include <QThread>
+#include <QSharedPointer>
+#include "pointstream.h"
+
+// Stand-in for a spinning lidar: a worker thread that sweeps a ring of beams
+// over a ground plane and a few pillars and pushes one batch per frame into
+// a PointStream, with timestamps in milliseconds since start().
+class SyntheticPointSource : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit SyntheticPointSource(const QSharedPointer<PointStream> &stream,
+                                  int pointsPerSecond = 300000,
+                                  int framesPerSecond = 20,
+                                  QObject *parent = nullptr);
+    ~SyntheticPointSource();
+
+    // Requests interruption and joins the thread.
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    QSharedPointer<PointStream> m_stream;
+    int m_pointsPerSecond;
+    int m_framesPerSecond;
+};
+
+#endif // SYNTHETICPOINTSOURCE_H
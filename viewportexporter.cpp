@@ -0,0 +1,179 @@
+#include "viewportexporter.h"
+#include "pointcloudrenderer.h"
+#include <QDebug>
+#include <QDir>
+#include <QImage>
+#include <QImageWriter>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QPainter>
+#include <QRegularExpression>
+#include <QRunnable>
+#include <QStringList>
+#include <QThreadPool>
+#include <algorithm>
+
+// Finished images waiting for an encoder; each full-size image is held
+// until written.
+static const int MaxPendingWrites = 4;
+
+namespace {
+
+class ImageWriteTask : public QRunnable
+{
+public:
+    ImageWriteTask(const QImage &image, const QString &filename, QSemaphore &pending, QAtomicInt &failed)
+        : m_image(image), m_filename(filename), m_pending(pending), m_failed(failed)
+    {
+    }
+
+    void run() override
+    {
+        QImageWriter writer(m_filename, "png");
+        if (!writer.write(m_image)) {
+            qDebug() << "Error writing image" << m_filename << ":" << writer.errorString();
+            m_failed.ref();
+        }
+        m_image = QImage();
+        m_pending.release();
+    }
+
+private:
+    QImage m_image;
+    QString m_filename;
+    QSemaphore &m_pending;
+    QAtomicInt &m_failed;
+};
+
+} // namespace
+
+ViewportExporter::ViewportExporter(const QSharedPointer<PointCloudScene> &scene)
+    : m_scene(scene),
+    m_renderer(new PointCloudRenderer),
+    m_imageSize(3840, 2160),
+    m_tileSize(2048),
+    m_pendingWrites(MaxPendingWrites),
+    m_failedWrites(0)
+{
+    m_renderer->setAttribute(Qt::WA_DontShowOnScreen);
+    m_renderer->setScene(m_scene);
+    m_renderer->setLodEnabled(false);
+    m_renderer->setShowCoordinateSystem(false);
+}
+
+ViewportExporter::~ViewportExporter()
+{
+    m_pendingWrites.acquire(MaxPendingWrites);
+    m_pendingWrites.release(MaxPendingWrites);
+    delete m_renderer;
+}
+
+QSize ViewportExporter::parseImageSize(const QString &text)
+{
+    const QStringList parts = text.trimmed().toLower().split('x');
+    if (parts.size() != 2) {
+        return QSize();
+    }
+    bool widthOk = false;
+    bool heightOk = false;
+    const QSize size(parts[0].toInt(&widthOk), parts[1].toInt(&heightOk));
+    return widthOk && heightOk && !size.isEmpty() ? size : QSize();
+}
+
+QString ViewportExporter::imageFileName(int index, const QString &viewportName)
+{
+    QString name = viewportName;
+    name.replace(QRegularExpression("[^A-Za-z0-9_.-]+"), "_");
+    return QString("%1_%2.png").arg(index + 1, 3, 10, QChar('0')).arg(name);
+}
+
+bool ViewportExporter::exportViewports(const QList<ViewportObject*> &viewports, const QString &directory)
+{
+    if (m_imageSize.isEmpty()) {
+        qDebug() << "Invalid export image size:" << m_imageSize;
+        return false;
+    }
+    QDir dir(directory);
+    if (!dir.exists() && !dir.mkpath(".")) {
+        qDebug() << "Failed to create export directory:" << directory;
+        return false;
+    }
+
+    // Tiles never exceed the image, so small exports take a single frame.
+    // The first grab creates the context the tile size is checked against.
+    m_renderer->resize(std::min(m_tileSize, m_imageSize.width()), std::min(m_tileSize, m_imageSize.height()));
+    m_renderer->show();
+    m_renderer->grabFramebuffer();
+
+    m_renderer->makeCurrent();
+    QOpenGLFunctions *gl = QOpenGLContext::currentContext()->functions();
+    GLint maxTextureSize = 0;
+    GLint maxRenderbufferSize = 0;
+    gl->glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    gl->glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &maxRenderbufferSize);
+    m_renderer->doneCurrent();
+    const int maxSize = std::min(maxTextureSize, maxRenderbufferSize);
+    const qreal pixelRatio = m_renderer->devicePixelRatioF();
+    const int tileSize = std::max(1, std::min(m_tileSize, int(maxSize / pixelRatio)));
+    m_renderer->resize(std::min(tileSize, m_imageSize.width()), std::min(tileSize, m_imageSize.height()));
+
+    const QVector<PointCloudScene::NodeState> sceneState = m_scene->state();
+    m_failedWrites.storeRelease(0);
+    bool ok = true;
+    for (int i = 0; i < viewports.size(); ++i) {
+        QImage image;
+        if (!renderImage(*viewports[i], image)) {
+            ok = false;
+            continue;
+        }
+        queueWrite(image, dir.filePath(imageFileName(i, viewports[i]->getName())));
+    }
+    m_scene->restoreState(sceneState);
+    m_renderer->setCaptureTile(QSize(), QPoint());
+    m_renderer->hide();
+
+    // Waits for the encoders.
+    m_pendingWrites.acquire(MaxPendingWrites);
+    m_pendingWrites.release(MaxPendingWrites);
+    return ok && m_failedWrites.loadAcquire() == 0;
+}
+
+bool ViewportExporter::renderImage(const ViewportObject &viewport, QImage &image)
+{
+    image = QImage(m_imageSize, QImage::Format_RGB32);
+    if (image.isNull()) {
+        qDebug() << "Not enough memory for a" << m_imageSize << "image of viewport" << viewport.getName();
+        return false;
+    }
+
+    viewport.applyViewport(m_renderer);
+    m_renderer->finishUploads();
+
+    // Framebuffer pixels per tile; the widget size is in device independent
+    // pixels.
+    const qreal pixelRatio = m_renderer->devicePixelRatioF();
+    const int tileWidth = int(m_renderer->width() * pixelRatio);
+    const int tileHeight = int(m_renderer->height() * pixelRatio);
+
+    QPainter painter(&image);
+    for (int y = 0; y < m_imageSize.height(); y += tileHeight) {
+        for (int x = 0; x < m_imageSize.width(); x += tileWidth) {
+            m_renderer->setCaptureTile(m_imageSize, QPoint(x, y));
+            QImage tile = m_renderer->grabFramebuffer();
+            if (tile.isNull()) {
+                qDebug() << "Failed to render viewport" << viewport.getName();
+                return false;
+            }
+            tile.setDevicePixelRatio(1.0);
+            // Tiles on the right and bottom edges are clipped to the image.
+            painter.drawImage(x, y, tile);
+        }
+    }
+    return true;
+}
+
+void ViewportExporter::queueWrite(const QImage &image, const QString &filename)
+{
+    m_pendingWrites.acquire();
+    QThreadPool::globalInstance()->start(new ImageWriteTask(image, filename, m_pendingWrites, m_failedWrites));
+}
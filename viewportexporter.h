@@ -0,0 +1,62 @@
+#ifndef VIEWPORTEXPORTER_H
+#define VIEWPORTEXPORTER_H
+
+#include <QAtomicInt>
+#include <QList>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QSize>
+#include <QString>
+#include "pointcloudscene.h"
+#include "viewportobject.h"
+
+class PointCloudRenderer;
+
+// Renders saved viewports of a scene to PNG files, at any resolution.
+//
+// Draws through a renderer of its own that is never shown, sharing the
+// scene (and so the GPU buffers) with the visible ones. Images larger than
+// one tile are put together from tiles, each rendered with the projection
+// narrowed to its part of the image, so the output size is bounded by host
+// memory rather than the framebuffer or texture limits. Level of detail is
+// off and every upload completes before a viewport is drawn, so the images
+// show every point. PNG encoding is single-threaded, so finished images are
+// encoded on the global thread pool while the next viewport renders.
+class ViewportExporter
+{
+public:
+    explicit ViewportExporter(const QSharedPointer<PointCloudScene> &scene);
+    ~ViewportExporter();
+
+    // Reads "WIDTHxHEIGHT", e.g. "3840x2160"; empty if malformed.
+    static QSize parseImageSize(const QString &text);
+
+    void setImageSize(const QSize &size) { m_imageSize = size; }
+    QSize imageSize() const { return m_imageSize; }
+
+    // Edge of the square tiles in pixels; clamped to what the GL
+    // implementation can render.
+    void setTileSize(int size) { m_tileSize = size; }
+    int tileSize() const { return m_tileSize; }
+
+    // Writes one NNN_<name>.png per viewport into directory and waits for
+    // the files. The scene's settings are restored afterwards. Returns
+    // false if any image could not be rendered or written.
+    bool exportViewports(const QList<ViewportObject*> &viewports, const QString &directory);
+
+private:
+    static QString imageFileName(int index, const QString &viewportName);
+    bool renderImage(const ViewportObject &viewport, QImage &image);
+    void queueWrite(const QImage &image, const QString &filename);
+
+    QSharedPointer<PointCloudScene> m_scene;
+    PointCloudRenderer *m_renderer;
+    QSize m_imageSize;
+    int m_tileSize;
+
+    // Bounds the images held by pending writes.
+    QSemaphore m_pendingWrites;
+    QAtomicInt m_failedWrites;
+};
+
+#endif // VIEWPORTEXPORTER_H
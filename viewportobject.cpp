@@ -1,5 +1,11 @@
 #include "viewportobject.h"
 #include "pointcloudrenderer.h"
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
 
 ViewportObject::ViewportObject(const QString& name)
     : m_display(nullptr)
@@ -14,6 +20,8 @@ ViewportObject::ViewportObject(const QString& name)
     m_params.pointSize = 2.0f;
     m_params.boundingBoxMin = QVector3D(0.0f, 0.0f, 0.0f);
     m_params.boundingBoxMax = QVector3D(0.0f, 0.0f, 0.0f);
+    m_params.perspectiveMode = true;
+    m_params.activeCloud = -1;
 }
 
 ViewportObject::~ViewportObject()
@@ -33,3 +41,161 @@ void ViewportObject::applyViewport(PointCloudRenderer* renderer) const
         renderer->update();
     }
 }
+
+static QJsonArray toJson(const float *values, int count)
+{
+    QJsonArray array;
+    for (int i = 0; i < count; ++i) {
+        array.append(double(values[i]));
+    }
+    return array;
+}
+
+static QJsonArray toJson(const QVector3D &v)
+{
+    const float values[3] = { v.x(), v.y(), v.z() };
+    return toJson(values, 3);
+}
+
+// Row-major, as QMatrix4x4 takes it.
+static QJsonArray toJson(const QMatrix4x4 &m)
+{
+    float values[16];
+    m.copyDataTo(values);
+    return toJson(values, 16);
+}
+
+static bool fromJson(const QJsonValue &value, float *values, int count)
+{
+    const QJsonArray array = value.toArray();
+    if (array.size() != count) {
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        values[i] = float(array.at(i).toDouble());
+    }
+    return true;
+}
+
+static bool fromJson(const QJsonValue &value, QVector3D &v)
+{
+    float values[3];
+    if (!fromJson(value, values, 3)) {
+        return false;
+    }
+    v = QVector3D(values[0], values[1], values[2]);
+    return true;
+}
+
+static bool fromJson(const QJsonValue &value, QMatrix4x4 &m)
+{
+    float values[16];
+    if (!fromJson(value, values, 16)) {
+        return false;
+    }
+    m = QMatrix4x4(values);
+    return true;
+}
+
+bool ViewportObject::saveViewports(const QString &filename, const QList<ViewportObject*> &viewports)
+{
+    QJsonArray list;
+    for (const ViewportObject *viewport : viewports) {
+        const ViewportParameters &params = viewport->getParameters();
+        QJsonObject object;
+        object.insert("name", viewport->getName());
+        object.insert("modelView", toJson(params.modelViewMatrix));
+        object.insert("projection", toJson(params.projectionMatrix));
+        object.insert("cameraDistance", double(params.cameraDistance));
+        object.insert("rotation", toJson(params.rotation));
+        object.insert("modelCenter", toJson(params.modelCenter));
+        object.insert("pointSize", double(params.pointSize));
+        object.insert("boundingBoxMin", toJson(params.boundingBoxMin));
+        object.insert("boundingBoxMax", toJson(params.boundingBoxMax));
+        object.insert("perspective", params.perspectiveMode);
+        object.insert("activeCloud", params.activeCloud);
+
+        QJsonArray clouds;
+        for (const PointCloudScene::NodeState &state : params.sceneState) {
+            QJsonObject cloud;
+            cloud.insert("name", state.name);
+            cloud.insert("transform", toJson(state.transform));
+            cloud.insert("visible", state.visible);
+            cloud.insert("colorMode", int(state.colorMode));
+            clouds.append(cloud);
+        }
+        object.insert("clouds", clouds);
+        list.append(object);
+    }
+
+    QJsonObject root;
+    root.insert("viewports", list);
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Failed to open viewport file for writing:" << filename;
+        return false;
+    }
+    file.write(QJsonDocument(root).toJson());
+    if (!file.commit()) {
+        qDebug() << "Error writing viewport file:" << filename;
+        return false;
+    }
+    return true;
+}
+
+bool ViewportObject::loadViewports(const QString &filename, QList<ViewportObject*> &viewports)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Failed to open viewport file:" << filename;
+        return false;
+    }
+
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &error);
+    if (error.error != QJsonParseError::NoError || !document.isObject()) {
+        qDebug() << "Invalid viewport file:" << filename << error.errorString();
+        return false;
+    }
+
+    const QJsonArray list = document.object().value("viewports").toArray();
+    QList<ViewportObject*> loaded;
+    for (int i = 0; i < list.size(); ++i) {
+        const QJsonObject object = list.at(i).toObject();
+        ViewportParameters params;
+        bool valid = fromJson(object.value("modelView"), params.modelViewMatrix)
+                     && fromJson(object.value("projection"), params.projectionMatrix)
+                     && fromJson(object.value("rotation"), params.rotation)
+                     && fromJson(object.value("modelCenter"), params.modelCenter)
+                     && fromJson(object.value("boundingBoxMin"), params.boundingBoxMin)
+                     && fromJson(object.value("boundingBoxMax"), params.boundingBoxMax);
+        params.cameraDistance = float(object.value("cameraDistance").toDouble());
+        params.pointSize = float(object.value("pointSize").toDouble(2.0));
+        params.perspectiveMode = object.value("perspective").toBool(true);
+        params.activeCloud = object.value("activeCloud").toInt(-1);
+
+        const QJsonArray clouds = object.value("clouds").toArray();
+        for (int c = 0; c < clouds.size() && valid; ++c) {
+            const QJsonObject cloud = clouds.at(c).toObject();
+            PointCloudScene::NodeState state;
+            state.name = cloud.value("name").toString();
+            valid = fromJson(cloud.value("transform"), state.transform);
+            state.visible = cloud.value("visible").toBool(true);
+            state.colorMode = PointCloudScene::ColorMode(cloud.value("colorMode").toInt());
+            params.sceneState.append(state);
+        }
+
+        if (!valid) {
+            qDebug() << "Invalid viewport" << i << "in" << filename;
+            qDeleteAll(loaded);
+            return false;
+        }
+        ViewportObject *viewport = new ViewportObject(object.value("name").toString());
+        viewport->setParameters(params);
+        loaded.append(viewport);
+    }
+
+    viewports += loaded;
+    return true;
+}
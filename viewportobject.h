@@ -1,9 +1,12 @@
 #ifndef VIEWPORTOBJECT_H
 #define VIEWPORTOBJECT_H
 
+#include <QList>
 #include <QMatrix4x4>
 #include <QVector3D>
 #include <QString>
+#include <QVector>
+#include "pointcloudscene.h"
 
 // Forward declaration
 class PointCloudRenderer;
@@ -20,6 +23,11 @@ public:
         float pointSize;
         QVector3D boundingBoxMin;
         QVector3D boundingBoxMax;
+        bool perspectiveMode;
+        // Transform, visibility and color mode of every cloud in the
+        // scene, and the active cloud (-1 for none).
+        QVector<PointCloudScene::NodeState> sceneState;
+        int activeCloud;
     };
 
     ViewportObject(const QString& name = "Viewport");
@@ -34,6 +42,12 @@ public:
     // Apply this viewport to the provided renderer
     void applyViewport(PointCloudRenderer* renderer) const;
 
+    // Viewport files hold a JSON list of named viewports. Clouds are not
+    // saved, so their settings are matched by cloud name when applied.
+    // Loaded viewports have no display and are owned by the caller.
+    static bool saveViewports(const QString &filename, const QList<ViewportObject*> &viewports);
+    static bool loadViewports(const QString &filename, QList<ViewportObject*> &viewports);
+
 private:
     ViewportParameters m_params;
     PointCloudRenderer* m_display; // Weak reference to the renderer (for potential restoration)